@@ -5,87 +5,367 @@
 #include <chrono>
 // File Loading & Savestate
 #include <fstream>
-
+#include <string>
+#include <filesystem>
+#include "statefile.h"
+#include "hash.h"
+#include "palette.h"
+
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#ifndef XCHIP8_HEADLESS
 // For ImGui Menus
 #include <GLFW/glfw3.h>
 #include "imgui/imgui_impl_opengl3.h"
 #include "imgui/imgui_impl_glfw.h"
 #include "imgui/fonts/OpenSans.h"
 #include "imgui/fonts/RobotoMono.h"
+#endif
+
+SaveStates::SaveStates(size_t memoryCap, const char* spillDir) : spillDir(spillDir) {
+	SetMemoryCap(memoryCap);
+}
 
-SaveStates::SaveStates() {
-	for (int i = 0; i < 10; i++) {
-		States[i] = new State();
+SaveStates::~SaveStates() {
+	// Make sure spilled slots actually reach the disk
+	writer.Flush();
+	Reap();
+}
+
+void SaveStates::SetMemoryCap(size_t bytes) {
+	Reap();
+	maxResident = bytes / sizeof(State);
+	if (maxResident == 0)
+		maxResident = 1;
+	while (lru.size() > maxResident) {
+		Evict();
 	}
 }
 
-void SaveStates::CreateState(Chip8* c, State* s) {
+std::string SaveStates::SpillPath(const std::string& name) const {
+	// Slot names are free text, keep the file name portable
+	std::string file;
+	for (char ch : name) {
+		bool safe = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == '_';
+		file += safe ? ch : '_';
+	}
+	char suffix[24];
+	snprintf(suffix, sizeof(suffix), "-%016llx.state", static_cast<unsigned long long>(Hash64(name.data(), name.size())));
+	return spillDir + "/" + file + suffix;
+}
 
-	for (int i = 0; i < 4096; i++) {
-		s->ram[i] = c->ram[i];
+void SaveStates::Touch(const std::string& name, Slot& slot) {
+	if (slot.lruPos != lru.end()) {
+		lru.splice(lru.begin(), lru, slot.lruPos);
+		return;
+	}
+	// Evicted, but its spill is still in flight, so the state is all there.
+	// Listed first, the eviction below cannot pick it.
+	lru.push_front(name);
+	slot.lruPos = lru.begin();
+	if (lru.size() > maxResident) {
+		Evict();
 	}
-	for (int i = 0; i < 2048; i++) {
-		s->video[i] = c->video[i];
+}
+
+void SaveStates::Evict() {
+	std::string name = lru.back();
+	Slot& slot = slots[name];
+	if (slot.spilling) {
+		// Let the earlier spill land first, two writes of one file could
+		// otherwise finish in either order
+		writer.Flush();
+		Reap();
 	}
-	for (int i = 0; i < 2048; i++) {
-		s->display[i] = c->display[i];
+	lru.erase(slot.lruPos);
+	slot.lruPos = lru.end();
+
+	if (slot.dirty || !slot.onDisk) {
+		// A failure here shows up as a failed write below
+		std::error_code error;
+		std::filesystem::create_directories(spillDir, error);
+		// The slot stays dirty and keeps its state until the writer
+		// confirms the file, see Reap
+		uint64_t version = slot.version;
+		writer.Submit(*slot.state, slot.romHash, slot.quirks, true, SpillPath(name),
+			[this, name, version](const std::string&, bool ok) {
+				std::lock_guard<std::mutex> guard(spilledLock);
+				spilled.push_back({ name, version, ok });
+			});
+		slot.spilling = true;
+		++spills;
+		return;
 	}
-	for (int i = 0; i < 16; i++) {
-		s->V[i] = c->V[i];
+	pool.Release(slot.state);
+	slot.state = nullptr;
+}
+
+void SaveStates::Reap() {
+	std::vector<Spilled> done;
+	{
+		std::lock_guard<std::mutex> guard(spilledLock);
+		done.swap(spilled);
 	}
-	for (int i = 0; i < 16; i++) {
-		s->stack[i] = c->stack[i];
+	for (const Spilled& spill : done) {
+		auto it = slots.find(spill.name);
+		if (it == slots.end())
+			continue;
+		Slot& slot = it->second;
+		slot.spilling = false;
+		if (spill.ok) {
+			slot.onDisk = true;
+			// Saved again since, the file is already behind
+			if (spill.version == slot.version)
+				slot.dirty = false;
+		} else {
+			std::cout << "Failed to spill savestate " << spill.name << ", keeping it in memory" << std::endl;
+		}
+		if (slot.lruPos != lru.end())
+			continue;
+
+		if (slot.dirty) {
+			// Whatever spill file there is predates this state, so the slot
+			// must not fall back on it. Relisted last, the next eviction
+			// tries again.
+			lru.push_back(spill.name);
+			slot.lruPos = std::prev(lru.end());
+		} else {
+			pool.Release(slot.state);
+			slot.state = nullptr;
+		}
 	}
-	for (int i = 0; i < 16; i++) {
-		s->keypad[i] = c->keypad[i];
+}
+
+State* SaveStates::Acquire(const std::string& name, Slot& slot) {
+	if (lru.size() >= maxResident) {
+		Evict();
 	}
-	s->opcode = c->opcode;
-	s->I = c->I;
-	s->pc = c->pc;
-	s->sp = c->sp;
-	s->delayTimer = c->delayTimer;
-	s->soundTimer = c->soundTimer;
+	slot.state = pool.Acquire();
+	lru.push_front(name);
+	slot.lruPos = lru.begin();
+	return slot.state;
+}
 
-	// TODO: Save savestate to filesys
+void SaveStates::Unload(Slot& slot) {
+	pool.Release(slot.state);
+	lru.erase(slot.lruPos);
+	slot.lruPos = lru.end();
+	slot.state = nullptr;
 }
 
-void SaveStates::Loadstate(Chip8* c, State* s) {
-	// TODO: Load savestate from filesys
-	for (int i = 0; i < 4096; i++) {
-		c->ram[i] = s->ram[i];
+State* SaveStates::Resident(const std::string& name, Slot& slot) {
+	if (slot.state) {
+		++hits;
+		Touch(name, slot);
+		return slot.state;
 	}
-	for (int i = 0; i < 2048; i++) {
-		c->video[i] = s->video[i];
+
+	++misses;
+	// The state only goes once its spill is confirmed, so the file is current
+	if (!slot.onDisk)
+		return nullptr;
+	State* s = Acquire(name, slot);
+	StateFileHeader header;
+	if (!ReadStateFile(SpillPath(name).c_str(), *s, &header)) {
+		// Corrupt or from an older format, the slot stays spilled as it was
+		std::cout << "Failed to read back savestate " << name << std::endl;
+		Unload(slot);
+		return nullptr;
 	}
-	for (int i = 0; i < 2048; i++) {
-		c->display[i] = s->display[i];
+	slot.romHash = header.romHash;
+	slot.quirks = header.quirks;
+	return s;
+}
+
+void SaveStates::SaveSlot(Chip8* c, const std::string& name) {
+	Reap();
+	Slot& slot = slots[name];
+	// Overwritten in full, a spilled copy need not be read back first
+	State* s = slot.state;
+	if (s)
+		Touch(name, slot);
+	else
+		s = Acquire(name, slot);
+	CreateState(c, s);
+	slot.romHash = c->romHash;
+	slot.quirks = c->quirks;
+	slot.dirty = true;
+	slot.version++;
+}
+
+bool SaveStates::LoadSlot(Chip8* c, const std::string& name) {
+	Reap();
+	auto it = slots.find(name);
+	if (it == slots.end()) {
+		// Spill files outlive the session, pick one up if it is there
+		if (!std::filesystem::exists(SpillPath(name)))
+			return false;
+		it = slots.emplace(name, Slot()).first;
+		it->second.onDisk = true;
 	}
-	for (int i = 0; i < 16; i++) {
-		c->V[i] = s->V[i];
+
+	Slot& slot = it->second;
+	State* s = Resident(name, slot);
+	if (!s)
+		return false;
+	if (c->isLoaded && slot.romHash != c->romHash) {
+		std::cout << "Savestate " << name << " was made with a different ROM" << std::endl;
+		return false;
 	}
-	for (int i = 0; i < 16; i++) {
-		c->stack[i] = s->stack[i];
+	c->quirks = slot.quirks;
+	Loadstate(c, s);
+	return true;
+}
+
+bool SaveStates::HasSlot(const std::string& name) const {
+	return slots.count(name) != 0;
+}
+
+void SaveStates::DropSlot(const std::string& name) {
+	auto it = slots.find(name);
+	if (it == slots.end())
+		return;
+	if (it->second.spilling) {
+		writer.Flush();
+		Reap();
 	}
-	for (int i = 0; i < 16; i++) {
-		c->keypad[i] = s->keypad[i];
+	if (it->second.state)
+		Unload(it->second);
+	if (it->second.onDisk) {
+		writer.Flush();
+		std::filesystem::remove(SpillPath(name));
 	}
+	slots.erase(it);
+}
+
+void SaveStates::CreateState(Chip8* c, State* s) {
+	XCHIP8_ZONE("CreateState");
+	memcpy(s->ram, c->ram, sizeof(s->ram));
+	memcpy(s->video, c->video, sizeof(s->video));
+	memcpy(s->display, c->display, sizeof(s->display));
+	memcpy(s->V, c->V, sizeof(s->V));
+	memcpy(s->stack, c->stack, sizeof(s->stack));
+	memcpy(s->keypad, c->keypad, sizeof(s->keypad));
+	s->opcode = c->opcode;
+	s->I = c->I;
+	s->pc = c->pc;
+	s->sp = c->sp;
+	s->delayTimer = c->delayTimer;
+	s->soundTimer = c->soundTimer;
+	s->cycles = c->cycles;
+	s->rngSeed = c->rngSeed;
+	s->rngCounter = c->rngCounter;
+}
+
+void SaveStates::Loadstate(Chip8* c, State* s) {
+	XCHIP8_ZONE("Loadstate");
+	memcpy(c->ram, s->ram, sizeof(c->ram));
+	memcpy(c->video, s->video, sizeof(c->video));
+	c->PackVideo();
+	c->MarkAllDirty();
+	c->RehashMemory();
+	memcpy(c->display, s->display, sizeof(c->display));
+	memcpy(c->V, s->V, sizeof(c->V));
+	memcpy(c->stack, s->stack, sizeof(c->stack));
+	memcpy(c->keypad, s->keypad, sizeof(c->keypad));
 	c->opcode = s->opcode;
 	c->I = s->I;
 	c->pc = s->pc;
 	c->sp = s->sp;
 	c->delayTimer = s->delayTimer;
 	c->soundTimer = s->soundTimer;
+	c->cycles = s->cycles;
+	c->rngSeed = s->rngSeed;
+	c->rngCounter = s->rngCounter;
 
+#ifndef XCHIP8_HEADLESS
 	glBindTexture(GL_TEXTURE_2D, c->TEX);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 64, 32, 0, GL_RGBA,
 		GL_UNSIGNED_BYTE, c->display);
 	glBindTexture(GL_TEXTURE_2D, 0);
+#else
+	c->updateDrawImage = true;
+#endif
+}
+
+bool SaveStates::SaveToFile(Chip8* c, State* s, const char* path, bool compress) {
+	XCHIP8_ZONE("SaveToFile");
+	CreateState(c, s);
+	return WriteStateFile(path, *s, c->romHash, c->quirks, compress);
+}
+
+void SaveStates::SaveToFileAsync(Chip8* c, State* s, const char* path, bool compress) {
+	CreateState(c, s);
+	writer.Submit(*s, c->romHash, c->quirks, compress, path);
+}
+
+bool SaveStates::LoadFromFile(Chip8* c, State* s, const char* path) {
+	XCHIP8_ZONE("LoadFromFile");
+	// Decode into a scratch state so a bad file leaves the slot untouched
+	State loaded;
+	StateFileHeader header;
+	if (!ReadStateFile(path, loaded, &header)) {
+		return false;
+	}
+	if (c->isLoaded && header.romHash != c->romHash) {
+		std::cout << "Savestate " << path << " was made with a different ROM" << std::endl;
+		return false;
+	}
+
+	*s = loaded;
+	c->quirks = header.quirks;
+	Loadstate(c, s);
+	return true;
+}
+
+bool ParseQuirks(const char* text, uint32_t& quirks) {
+	std::string spec(text);
+	if (spec == "none" || spec == "xchip8") {
+		quirks = 0;
+		return true;
+	}
+	if (spec == "vip" || spec == "chip8") {
+		quirks = QUIRK_SHIFT_VY | QUIRK_LOADSTORE_I | QUIRK_VF_RESET;
+		return true;
+	}
+	if (spec == "schip" || spec == "chip48") {
+		quirks = QUIRK_JUMP_VX;
+		return true;
+	}
+	if (!spec.empty() && spec[0] >= '0' && spec[0] <= '9') {
+		quirks = static_cast<uint32_t>(strtoul(text, nullptr, 0));
+		return true;
+	}
+
+	uint32_t result = 0;
+	size_t start = 0;
+	while (start <= spec.size()) {
+		size_t end = spec.find(',', start);
+		if (end == std::string::npos)
+			end = spec.size();
+		std::string name = spec.substr(start, end - start);
+		if (name == "shift")
+			result |= QUIRK_SHIFT_VY;
+		else if (name == "loadstore")
+			result |= QUIRK_LOADSTORE_I;
+		else if (name == "jump")
+			result |= QUIRK_JUMP_VX;
+		else if (name == "vfreset")
+			result |= QUIRK_VF_RESET;
+		else
+			return false;
+		start = end + 1;
+	}
+	quirks = result;
+	return true;
 }
 
-// Fixed font address at $50
-const unsigned int FONTSET_START_ADDRESS = 0x50;
-// Fixed start address at $200
-const unsigned int START_ADDRESS = 0x200;
 const unsigned int FONTSET_SIZE = 80;
 
 // Used mattmikolay's Mastering Chip8 github wiki
@@ -108,11 +388,11 @@ uint8_t fontset[FONTSET_SIZE] = {
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-// randGen part is from austinmorlan
-Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().count()) {
+Chip8::Chip8() {
 	isRunning = true;
 	// Zero out memory for registers
 	memset(video, 0, sizeof(video));
+	memset(plane, 0, sizeof(plane));
 	memset(display, 0, sizeof(display));
 	memset(ram, 0, sizeof(ram));
 	memset(V, 0, sizeof(V));
@@ -129,14 +409,19 @@ Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().cou
 	videoScale = 10;
 
 	// Initialize RNG
-	randByte = std::uniform_int_distribution<uint16_t>(0, 255U);
+	Seed(std::chrono::system_clock::now().time_since_epoch().count());
 
 	// Load fonts into memory
 	for (int i = 0; i < FONTSET_SIZE; ++i) {
 		Chip8::ram[FONTSET_START_ADDRESS + i] = fontset[i];
 	}
+	RehashMemory();
 
-	savestates = SaveStates();
+	// Unassigned opcodes decode to a NOP instead of a null member pointer
+	for (auto& f : table0) f = &Chip8::OP_NULL;
+	for (auto& f : table8) f = &Chip8::OP_NULL;
+	for (auto& f : tableE) f = &Chip8::OP_NULL;
+	for (auto& f : tableF) f = &Chip8::OP_NULL;
 
 	// Set up function pointer table, thanks to austinmorlan for the tutorial
 	// Master Table
@@ -185,6 +470,7 @@ Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().cou
 	tableF[0x55] = &Chip8::OP_Fx55;
 	tableF[0x65] = &Chip8::OP_Fx65;
 
+#ifndef XCHIP8_HEADLESS
 	ImGuiIO& io = ImGui::GetIO(); (void)io;
 	OpenSans = io.Fonts->AddFontFromMemoryCompressedTTF(OpenSans_data, OpenSans_size, 18.0f, NULL, NULL);
 	RobotoMono = io.Fonts->AddFontFromMemoryCompressedTTF(RobotoMono_data, RobotoMono_size, 18.0f, NULL, NULL);
@@ -198,12 +484,15 @@ Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().cou
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+#endif
 }
 
 void Chip8::Reset() {
 	isRunning = true;
+	MarkAllDirty();
 	// Zero out memory for registers
 	memset(video, 0, sizeof(video));
+	memset(plane, 0, sizeof(plane));
 	memset(display, 0, sizeof(display));
 	memset(ram, 0, sizeof(ram));
 	memset(V, 0, sizeof(V));
@@ -216,45 +505,133 @@ void Chip8::Reset() {
 	sp = 0;
 	delayTimer = 0;
 	soundTimer = 0;
+	cycles = 0;
+	pendingTicks = 0;
+	outOfBounds = false;
 	//cycleDelay = 875;
 
-	// Initialize RNG
-	randByte = std::uniform_int_distribution<uint16_t>(0, 255U);
-
 	// Load fonts into memory
 	for (int i = 0; i < FONTSET_SIZE; ++i) {
 		Chip8::ram[FONTSET_START_ADDRESS + i] = fontset[i];
 	}
+	static const uint64_t fontHash = MemoryHash();
+	memHash = fontHash;
 }
 
-void Chip8::LoadRom(const char* filename) {
-	// ensure that if we load a new rom, the CPU is reset to boot state
-	Reset();
+bool Chip8::LoadRom(const char* filename) {
+	XCHIP8_ZONE("LoadRom");
 	std::ifstream is(filename, std::ios::in | std::ios::binary);
-	std::vector<char> prog(
+	if (!is) {
+		std::cout << "Failed to open ROM " << filename << std::endl;
+		return false;
+	}
+	std::vector<uint8_t> image(
 		(std::istreambuf_iterator<char>(is)),
 		std::istreambuf_iterator<char>()
 	);
 	is.close();
-	//copy program into memory
-	for (int i = 0; i < prog.size(); ++i) {
-		ram[START_ADDRESS + i] = prog[i];
+	return LoadRom(image);
+}
+
+bool Chip8::LoadRom(const std::vector<uint8_t>& image) {
+	rom = image;
+	romHash = Hash64(rom.data(), rom.size());
+	golden.Clear();
+	romMemHash = 0;
+	for (size_t i = 0; i < rom.size() && START_ADDRESS + i < MEMORY_SIZE; i++) {
+		romMemHash ^= RamKey(static_cast<unsigned int>(START_ADDRESS + i), rom[i]);
 	}
+	// ensure that if we load a new rom, the CPU is reset to boot state
+	Boot();
 	isLoaded = true;
+	return true;
+}
+
+void Chip8::Boot() {
+	XCHIP8_ZONE("Boot");
+	Reset();
+	//copy program into memory
+	size_t size = rom.size() < MEMORY_SIZE - START_ADDRESS ? rom.size() : MEMORY_SIZE - START_ADDRESS;
+	memcpy(&ram[START_ADDRESS], rom.data(), size);
+	memHash ^= romMemHash;
+}
+
+void Chip8::CaptureBoot(unsigned int warmupFrames, unsigned int ips, uint64_t seed) {
+	Boot();
+	// The constructor seeds from the clock, Cxnn in the warmup must not see that
+	Seed(seed);
+	for (unsigned int f = 0; f < warmupFrames; f++) {
+		RunFrame(FrameInstructions(f, ips));
+	}
+
+	golden.Capture(*this);
+}
+
+bool Chip8::Restore() {
+	if (golden.Empty())
+		return false;
+	golden.Restore(*this);
+	return true;
+}
+
+void Chip8::Seed(uint64_t seed) {
+	rngSeed = seed;
+	rngCounter = 0;
+}
+
+void Chip8::Poke(unsigned int addr, const uint8_t* data, size_t size) {
+	if (addr >= MEMORY_SIZE)
+		return;
+	if (size > MEMORY_SIZE - addr)
+		size = MEMORY_SIZE - addr;
+	if (size == 0)
+		return;
+	MarkRam(addr, static_cast<unsigned int>(addr + size));
+	for (size_t i = 0; i < size; i++) {
+		WriteRam(static_cast<unsigned int>(addr + i), data[i]);
+	}
 }
 
 void Chip8::RunCycle() {
+#ifdef XCHIP8_CHECK_BOUNDS
+	if (!NextInBounds()) {
+		outOfBounds = true;
+		return;
+	}
+#endif
+#ifdef XCHIP8_PROFILE
+	heatmap.Exec(pc);
+#endif
 	// Fetch
 	opcode = ram[pc] << 8 | ram[pc + 1];
 
 	// Increment the PC
 	pc += 2;
+	++cycles;
 
 	// Decode & Execute
-	((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+#ifdef XCHIP8_PROFILE
+	profile.Count(opcode);
+	uint64_t sampleStart = profile.SampleNext() ? ReadCycleCounter() : 0;
+#endif
+	if (trace) {
+		uint16_t at = static_cast<uint16_t>(pc - 2);
+		// Two word loads, Record compares them with V afterwards
+		uint64_t before[2];
+		memcpy(before, V, sizeof(before));
+		((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+		trace->Record(at, opcode, cycles, before, V);
+	} else {
+		((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+	}
+#ifdef XCHIP8_PROFILE
+	if (sampleStart)
+		profile.AddSample(opcode, ReadCycleCounter() - sampleStart);
+#endif
 }
 
 void Chip8::RunTimers() {
+	XCHIP8_ZONE("RunTimers");
 	// Decrement the delay timer if it's been set
 	if (delayTimer > 0) {
 		--delayTimer;
@@ -263,51 +640,120 @@ void Chip8::RunTimers() {
 	if (soundTimer > 0) {
 		--soundTimer;
 	}
+	if (trace)
+		trace->Mark(TRACE_TICK);
 }
 
-// Get color byte and replace it with our custom colors.
-// This whole process also flips it from RGBA to ABGR. Because endianess, or something.
-// From 0xRRGGBBAA to 0xAABBGGRR, for example. I don't know a better way to do this tbh.
-// Grab red byte, and don't shift.
-uint32_t Chip8::GetColoredPixel(uint32_t video, ImVec4 fgCol, ImVec4 bgCol) {
-	uint8_t pixel = 0U; uint32_t newPixel = 0U;
+void Chip8::RunFrame(unsigned int instructions) {
+	XCHIP8_ZONE("RunFrame");
+	for (unsigned int i = 0; i < instructions; ++i) {
+		RunCycle();
+	}
+	RunTimers();
+	if (trace)
+		trace->Mark(TRACE_FRAME);
+}
 
-	// Storing the bitwised variable is required, it can't be done in the if.
-	pixel = (video & 0xFF000000) >> 24;
-	if (pixel == 0xFF) {
-		newPixel |= static_cast<uint8_t>(fgCol.x * 255);
-	} else {
-		newPixel |= static_cast<uint8_t>(bgCol.x * 255);
+void Chip8::PackVideo() {
+	for (int y = 0; y < VIDEO_HEIGHT; y++) {
+		uint64_t row = 0;
+		for (int x = 0; x < VIDEO_WIDTH; x++) {
+			row = (row << 1) | (video[y * VIDEO_WIDTH + x] == 0xFFFFFFFF);
+		}
+		plane[y] = row;
 	}
-	pixel = (video & 0xFF0000) >> 16;
-	if (pixel == 0xFF) {
-		newPixel |= (static_cast<uint8_t>(fgCol.y * 255) << 8);
-	} else {
-		newPixel |= (static_cast<uint8_t>(bgCol.y * 255) << 8);
+}
+
+size_t Chip8::PackRegisters(uint8_t* out) const {
+	// Registers packed by hand so padding never leaks into the hash
+	uint8_t* p = out;
+	memcpy(p, V, sizeof(V)); p += sizeof(V);
+	memcpy(p, stack, sizeof(stack)); p += sizeof(stack);
+	memcpy(p, &I, 2); p += 2;
+	memcpy(p, &pc, 2); p += 2;
+	memcpy(p, &sp, 2); p += 2;
+	*p++ = delayTimer;
+	*p++ = soundTimer;
+	memcpy(p, &rngSeed, 8); p += 8;
+	memcpy(p, &rngCounter, 8); p += 8;
+	return p - out;
+}
+
+bool Chip8::NextInBounds() const {
+	if (pc + 1u >= MEMORY_SIZE)
+		return false;
+	uint16_t op = static_cast<uint16_t>(ram[pc] << 8 | ram[pc + 1]);
+	unsigned int x = (op & 0x0F00u) >> 8u;
+	switch (op >> 12u) {
+	case 0x0:
+		// 00EE pops stack[sp - 1]
+		return (op & 0x000Fu) != 0xE || (sp >= 1 && sp <= STACK_LEVELS);
+	case 0x2:
+		return sp < STACK_LEVELS;
+	case 0xD: {
+		// Sprites clip at the bottom, only the rows drawn are read from I
+		unsigned int y = (op & 0x00F0u) >> 4u;
+		return I + std::min<unsigned int>(op & 0x000Fu, VIDEO_HEIGHT - V[y] % VIDEO_HEIGHT) <= MEMORY_SIZE;
 	}
-	pixel = (video & 0xFF00) >> 8;
-	if (pixel == 0xFF) {
-		newPixel |= (static_cast<uint8_t>(fgCol.z * 255) << 16);
-	} else {
-		newPixel |= (static_cast<uint8_t>(bgCol.z * 255) << 16);
+	case 0xE:
+		return V[x] < KEY_COUNT;
+	case 0xF:
+		switch (op & 0x00FFu) {
+		case 0x33:
+			return I + 3u <= MEMORY_SIZE;
+		case 0x55:
+		case 0x65:
+			return I + x + 1u <= MEMORY_SIZE;
+		}
+		return true;
 	}
-	pixel = (video & 0xFF);
-	if (pixel == 0xFF) {
-		newPixel |= (static_cast<uint8_t>(fgCol.w * 255) << 24);
-	} else {
-		newPixel |= (static_cast<uint8_t>(bgCol.w * 255) << 24);
+	return true;
+}
+
+uint64_t Chip8::StateHash() const {
+	uint8_t regs[REGISTER_COUNT + STACK_LEVELS * 2 + 32];
+	size_t size = PackRegisters(regs);
+
+	uint64_t h = Hash64(ram, sizeof(ram));
+	h = Hash64(video, sizeof(video), h);
+	return Hash64(regs, size, h);
+}
+
+uint64_t Chip8::MemoryHash() const {
+	uint64_t h = 0;
+	for (unsigned int a = 0; a < MEMORY_SIZE; a++) {
+		h ^= RamKey(a, ram[a]);
+	}
+	for (unsigned int i = 0; i < VIDEO_WIDTH * VIDEO_HEIGHT; i++) {
+		if (video[i] == 0xFFFFFFFF)
+			h ^= PixelKey(i);
 	}
+	return h;
+}
 
-	return newPixel;
+uint64_t Chip8::IncrementalHash() const {
+#ifdef XCHIP8_CHECK_HASH
+	if (memHash != MemoryHash()) {
+		std::cout << "Incremental state hash out of sync at cycle " << cycles << std::endl;
+		abort();
+	}
+#endif
+	uint8_t regs[REGISTER_COUNT + STACK_LEVELS * 2 + 32];
+	size_t size = PackRegisters(regs);
+	return Hash64(regs, size, memHash);
 }
 
+#ifndef XCHIP8_HEADLESS
 void Chip8::RunMenu(int screenWidth, int screenHeight) {
+	XCHIP8_ZONE("RunMenu");
 	if (showMenu) {
 		// Menu Window
 		ImGui::SetNextWindowPos(ImVec2(5, 5));
-		ImGui::SetNextWindowSize(ImVec2(300, 325));
+		ImGui::SetNextWindowSize(ImVec2(300, 410));
 		ImGui::Begin("Menu", NULL, ImGuiWindowFlags_NoResize);
 		ImGui::Text("%.1f FPS", ImGui::GetIO().Framerate);
+		ImGui::SameLine();
+		ImGui::Checkbox("Pacing", &showPacing);
 		if (ImGui::Button("Load ROM")) {
 			LoadRom((const char*)buf);
 		}
@@ -324,21 +770,62 @@ void Chip8::RunMenu(int screenWidth, int screenHeight) {
 			RunCycle();
 			isRunning = false;
 		}
-		ImGui::InputInt("State Number", &whichState, 1, 1);
-		if (whichState <= 0)
-			whichState = 0;
-		else if (whichState >= 9)
-			whichState = 9;
+		ImGui::InputText("State Slot", slotName, sizeof(slotName));
 		if (ImGui::Button("Save State")) {
 			isRunning = false; // Pause the other thread while creating state.
-			savestates.CreateState(this, savestates.States[whichState]);
+			savestates.SaveSlot(this, slotName);
 			isRunning = true; // Resume the other thread.
 		}
 		ImGui::SameLine();
 		if (ImGui::Button("Load State")) {
 			isRunning = false;
-			savestates.Loadstate(this, savestates.States[whichState]);
+			savestates.LoadSlot(this, slotName);
+		}
+		if (ImGui::Button("Save to Disk")) {
+			isRunning = false;
+			std::string path = std::string(buf) + "." + slotName + ".state";
+			savestates.SaveToFileAsync(this, &exportState, path.c_str(), compressStates);
+			isRunning = true;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Load from Disk")) {
+			isRunning = false;
+			std::string path = std::string(buf) + "." + slotName + ".state";
+			savestates.LoadFromFile(this, &exportState, path.c_str());
+		}
+		ImGui::SameLine();
+		ImGui::Checkbox("RLE", &compressStates);
+		if (ImGui::Button(recorder.IsRecording() ? "Stop Rec" : "Record")) {
+			isRunning = false;
+			std::string path = std::string(buf) + ".movie";
+			if (recorder.IsRecording()) {
+				recorder.Stop(this);
+				movie.Save(path.c_str());
+			} else if (isLoaded) {
+				player.Stop();
+				recorder.Start(this, &movie, std::chrono::system_clock::now().time_since_epoch().count());
+			}
+			isRunning = true;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button(player.IsPlaying() ? "Stop Movie" : "Play Movie")) {
+			isRunning = false;
+			std::string path = std::string(buf) + ".movie";
+			if (player.IsPlaying()) {
+				player.Stop();
+			} else if (isLoaded && movie.Load(path.c_str())) {
+				recorder.Stop(this);
+				player.Start(this, &movie);
+			}
+			isRunning = true;
 		}
+		ImGui::SameLine();
+		ImGui::Text("%llu", static_cast<unsigned long long>(cycles));
+		ImGui::Text("Slots: %zu (%zu in RAM) H/M: %llu/%llu", savestates.SlotCount(), savestates.ResidentCount(),
+			static_cast<unsigned long long>(savestates.hits), static_cast<unsigned long long>(savestates.misses));
+		ImGui::Text("Disk queue: %zu, %llu written%s", savestates.writer.QueueDepth(),
+			static_cast<unsigned long long>(savestates.writer.completed.load()),
+			savestates.writer.UsingUring() ? " (io_uring)" : "");
 		
 		ImGui::InputInt("Video Scale", &videoScale, 1, 5);
 		if (videoScale <= 1)
@@ -362,11 +849,15 @@ void Chip8::RunMenu(int screenWidth, int screenHeight) {
 		ImGui::Begin("Interpreter", NULL, ImGuiWindowFlags_NoResize);
 		ImGui::SetWindowSize(ImVec2(static_cast<float>(gameW), static_cast<float>(gameH)));
 		if (updateDrawImage) {
-			// Convert Monochrome B/W to custom palette
-			for (int i = 0; i < 2048; i++) {
-				display[i] = GetColoredPixel(video[i], foreground, background);
+			{
+				XCHIP8_ZONE("ColorizeVideo");
+				// Convert Monochrome B/W to custom palette
+				ColorizeVideo(video, display, VIDEO_WIDTH * VIDEO_HEIGHT,
+					PackColor(foreground.x, foreground.y, foreground.z, foreground.w),
+					PackColor(background.x, background.y, background.z, background.w));
 			}
 
+			XCHIP8_ZONE("TexUpload");
 			glBindTexture(GL_TEXTURE_2D, TEX);
 			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 64, 32, 0, GL_RGBA,
 				GL_UNSIGNED_BYTE, display);
@@ -377,10 +868,10 @@ void Chip8::RunMenu(int screenWidth, int screenHeight) {
 		ImGui::End();
 
 		// Debugger Windows
-		ImGui::SetNextWindowPos(ImVec2(5, 330));
+		ImGui::SetNextWindowPos(ImVec2(5, 415));
 		ImGui::Begin("Debugger", NULL, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoScrollbar);
 		ImGui::PushFont(RobotoMono); // Proper push/pop
-		ImGui::BeginChild("DebugL", ImVec2(140, 425), false);
+		ImGui::BeginChild("DebugL", ImVec2(140, 380), false);
 		ImGui::Text("opcode: %x", opcode);
 		ImGui::Text("PC: %hu", pc);
 		ImGui::Text("I: %hu", I);
@@ -389,7 +880,7 @@ void Chip8::RunMenu(int screenWidth, int screenHeight) {
 		}
 		ImGui::EndChild(); ImGui::SameLine(); //DebugL
 		
-		ImGui::BeginChild("DebugR", ImVec2(135, 425), false);
+		ImGui::BeginChild("DebugR", ImVec2(135, 380), false);
 		ImGui::Text("Delay Timer: %x", delayTimer);
 		ImGui::Text("Sound Timer: %x", soundTimer);
 		ImGui::Text("Stack Ptr: %hu", sp);
@@ -397,12 +888,83 @@ void Chip8::RunMenu(int screenWidth, int screenHeight) {
 			ImGui::Text("S[%i]: %x", i, stack[i]);
 		}
 		ImGui::EndChild(); ImGui::SameLine(); // DebugR
+
+#ifdef XCHIP8_PROFILE
+		// Opcode profile, busiest first
+		ImGui::BeginChild("DebugProfile", ImVec2(330, 380), false);
+		ImGui::Checkbox("Cycles", &profile.sampleCycles);
+		ImGui::SameLine();
+		ImGui::Checkbox("By family", &profileByFamily);
+		ImGui::SameLine();
+		if (ImGui::Button("Clear"))
+			profile.Clear();
+		ImGui::SameLine();
+		if (ImGui::Button("CSV")) {
+			std::string path = std::string(buf) + ".profile.csv";
+			profile.WriteCsv(path.c_str());
+		}
+		uint64_t total = profile.Total();
+		unsigned int rows = profileByFamily ? 16 : OPH_COUNT;
+		uint64_t counts[OPH_COUNT];
+		unsigned int order[OPH_COUNT];
+		for (unsigned int i = 0; i < rows; i++) {
+			counts[i] = profileByFamily ? profile.FamilyCount(i) : profile.counts[i];
+			order[i] = i;
+		}
+		std::stable_sort(order, order + rows, [&counts](unsigned int a, unsigned int b) { return counts[a] > counts[b]; });
+		if (ImGui::BeginTable("Profile", profileByFamily ? 3 : 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_ScrollY)) {
+			ImGui::TableSetupScrollFreeze(0, 1);
+			ImGui::TableSetupColumn(profileByFamily ? "Family" : "Handler");
+			ImGui::TableSetupColumn("Count");
+			ImGui::TableSetupColumn("%");
+			if (!profileByFamily)
+				ImGui::TableSetupColumn("Cyc/op");
+			ImGui::TableHeadersRow();
+			for (unsigned int r = 0; r < rows; r++) {
+				unsigned int i = order[r];
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				if (profileByFamily)
+					ImGui::Text("%Xxxx", i);
+				else
+					ImGui::TextUnformatted(OpHandlerName(static_cast<OpHandler>(i)));
+				ImGui::TableNextColumn();
+				ImGui::Text("%llu", static_cast<unsigned long long>(counts[i]));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.1f", total ? 100.0 * counts[i] / total : 0.0);
+				if (!profileByFamily) {
+					ImGui::TableNextColumn();
+					ImGui::Text("%.0f", profile.CyclesPerOp(static_cast<OpHandler>(i)));
+				}
+			}
+			ImGui::EndTable();
+		}
+		ImGui::EndChild(); ImGui::SameLine(); // DebugProfile
+
+		ImGui::BeginChild("DebugCounters", ImVec2(300, 380), false);
+		DrawHostCounters();
+		ImGui::EndChild(); ImGui::SameLine(); // DebugCounters
+#endif
 		ImGui::PopFont(); // Proper push/pop
 		ImGui::End(); ImGui::SameLine();
 		
 		// RAM Contents Window
 		ImGui::SetNextWindowPos(ImVec2(305, static_cast<float>(gameH + 5)));
 		ImGui::Begin("RAM", NULL);
+#ifdef XCHIP8_PROFILE
+		ImGui::Checkbox("Heatmap", &showHeatmap);
+		if (showHeatmap) {
+			ImGui::SameLine();
+			if (ImGui::Button("Clear##heatmap"))
+				heatmap.Clear();
+			ImGui::SameLine();
+			if (ImGui::Button("Save##heatmap")) {
+				std::string path = std::string(buf) + ".heatmap";
+				heatmap.Save(path.c_str(), romHash);
+			}
+			DrawHeatmap();
+		}
+#endif
 		ImGui::PushFont(RobotoMono); // Proper push/pop
 		ramViewer.Cols = 16;
 		ramViewer.OptShowAscii = true;
@@ -410,9 +972,334 @@ void Chip8::RunMenu(int screenWidth, int screenHeight) {
 		ramViewer.DrawContents(&ram, sizeof(ram), 0);
 		ImGui::PopFont(); // Proper push/pop
 		ImGui::End();
+
+#ifdef XCHIP8_PROFILE
+		DrawCallProfile();
+#endif
+#ifdef XCHIP8_ZONES
+		DrawTimeline();
+#endif
+	}
+	if (showPacing)
+		DrawPacing(screenWidth);
+}
+
+void Chip8::DrawPacing(int screenWidth) {
+	ImGui::SetNextWindowPos(ImVec2(static_cast<float>(screenWidth - 420), 5), ImGuiCond_FirstUseEver);
+	ImGui::Begin("Pacing", &showPacing, ImGuiWindowFlags_AlwaysAutoResize);
+	const double targetIps = cycleDelay > 0 ? 1e6 / cycleDelay : 0;
+	ImGui::Text("IPS %.0f of %.0f (%.1f%%)", pacing.MeasuredIps(), targetIps, targetIps > 0 ? 100 * pacing.MeasuredIps() / targetIps : 0.0);
+	ImGui::Text("Skipped ticks %llu  Dropped frames %llu", static_cast<unsigned long long>(pacing.skippedTicks.load()),
+		static_cast<unsigned long long>(pacing.droppedFrames.load()));
+	if (ImGui::Button("Reset##pacing"))
+		pacing.Clear();
+	ImGui::SameLine();
+	if (ImGui::Button("Export##pacing"))
+		pacing.WriteCsv("xchip8.pacing.csv");
+
+	if (ImGui::BeginTable("Pacing", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV)) {
+		ImGui::TableSetupColumn("Series");
+		ImGui::TableSetupColumn("Mean");
+		ImGui::TableSetupColumn("Stddev");
+		ImGui::TableSetupColumn("p50");
+		ImGui::TableSetupColumn("p99");
+		ImGui::TableSetupColumn("Max");
+		ImGui::TableHeadersRow();
+		for (unsigned int s = 0; s < PACE_SERIES_COUNT; s++) {
+			const PacingHistogram& h = pacing.series[s];
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(PacingSeriesName(static_cast<PacingSeries>(s)));
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", h.Mean());
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", h.Stddev());
+			ImGui::TableNextColumn();
+			ImGui::Text("%.0f", h.Percentile(0.5));
+			ImGui::TableNextColumn();
+			ImGui::Text("%.0f", h.Percentile(0.99));
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", static_cast<unsigned long long>(h.Max()));
+		}
+		ImGui::EndTable();
+	}
+
+	// Occupied bucket range of each series, log-spaced
+	for (unsigned int s = 0; s < PACE_SERIES_COUNT; s++) {
+		const PacingHistogram& h = pacing.series[s];
+		unsigned int first = PacingHistogram::BUCKETS, last = 0;
+		float counts[PacingHistogram::BUCKETS];
+		for (unsigned int b = 0; b < PacingHistogram::BUCKETS; b++) {
+			counts[b] = static_cast<float>(h.Bucket(b));
+			if (counts[b] > 0) {
+				first = std::min(first, b);
+				last = b;
+			}
+		}
+		if (first > last)
+			continue;
+		char overlay[64];
+		snprintf(overlay, sizeof(overlay), "%llu .. %llu", static_cast<unsigned long long>(PacingHistogram::BucketLow(first)),
+			static_cast<unsigned long long>(PacingHistogram::BucketLow(last + 1 < PacingHistogram::BUCKETS ? last + 1 : last)));
+		ImGui::PlotHistogram(PacingSeriesName(static_cast<PacingSeries>(s)), counts + first, static_cast<int>(last - first + 1), 0,
+			overlay, 0.0f, FLT_MAX, ImVec2(360, 60));
 	}
+	ImGui::End();
 }
 
+#ifdef XCHIP8_ZONES
+void Chip8::DrawTimeline() {
+	ImGui::SetNextWindowSize(ImVec2(720, 360), ImGuiCond_FirstUseEver);
+	ImGui::Begin("Timeline", NULL);
+	ImGui::Checkbox("Pause", &timelinePaused);
+	ImGui::SameLine();
+	ImGui::SliderInt("ms", &timelineMs, 5, 500);
+	ImGui::SameLine();
+	if (ImGui::Button("Save##zones"))
+		WriteZonesJson("xchip8.zones.json");
+
+	const uint64_t span = static_cast<uint64_t>(timelineMs) * 1000000u;
+	if (!timelinePaused) {
+		timelineEnd = ZoneNow();
+		timelineThreads = ZoneThreads();
+		timelineEvents.resize(timelineThreads.size());
+		for (size_t t = 0; t < timelineThreads.size(); t++) {
+			timelineEvents[t].clear();
+			timelineThreads[t].buffer->Recent(timelineEvents[t], timelineEnd - span);
+		}
+	}
+	const uint64_t begin = timelineEnd - span;
+
+	// One row per nesting level, deeper zones below their parents
+	const float WIDTH = 680.0f, ROW = 16.0f;
+	const uint32_t ROWS = 4;
+	ImDrawList* draw = ImGui::GetWindowDrawList();
+	struct Stat { uint64_t count = 0, total = 0, max = 0; };
+	std::map<std::string, Stat> stats;
+	for (size_t t = 0; t < timelineThreads.size(); t++) {
+		ImGui::TextUnformatted(timelineThreads[t].name.c_str());
+		ImVec2 origin = ImGui::GetCursorScreenPos();
+		draw->AddRectFilled(origin, ImVec2(origin.x + WIDTH, origin.y + ROWS * ROW), IM_COL32(16, 16, 16, 255));
+		auto x = [&](uint64_t time) {
+			time = std::clamp(time, begin, timelineEnd);
+			return origin.x + static_cast<float>(time - begin) * WIDTH / span;
+		};
+		const ZoneEvent* hovered = nullptr;
+		ImVec2 mouse = ImGui::GetMousePos();
+		for (const ZoneEvent& e : timelineEvents[t]) {
+			if (e.start > timelineEnd)
+				continue;
+			Stat& stat = stats[e.name];
+			stat.count++;
+			stat.total += e.end - e.start;
+			stat.max = std::max(stat.max, e.end - e.start);
+			if (e.depth >= ROWS)
+				continue;
+			// Anything shorter than a pixel still shows
+			float x0 = x(e.start), x1 = std::max(x(e.end), x0 + 1.0f);
+			float y0 = origin.y + e.depth * ROW, y1 = y0 + ROW - 1.0f;
+			uint64_t hue = Hash64(e.name, strlen(e.name));
+			draw->AddRectFilled(ImVec2(x0, y0), ImVec2(x1, y1),
+				IM_COL32(64 + (hue & 0x7Fu), 64 + ((hue >> 8) & 0x7Fu), 64 + ((hue >> 16) & 0x7Fu), 255));
+			if (x1 - x0 > 48.0f)
+				draw->AddText(ImVec2(x0 + 2.0f, y0), IM_COL32(255, 255, 255, 255), e.name);
+			if (mouse.x >= x0 && mouse.x < x1 && mouse.y >= y0 && mouse.y < y1)
+				hovered = &e;
+		}
+		ImGui::Dummy(ImVec2(WIDTH, ROWS * ROW));
+		if (hovered && ImGui::IsItemHovered())
+			ImGui::SetTooltip("%s %.3f ms", hovered->name, (hovered->end - hovered->start) / 1e6);
+	}
+
+	// Totals over the visible span
+	if (ImGui::BeginTable("Zones", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV)) {
+		ImGui::TableSetupColumn("Zone");
+		ImGui::TableSetupColumn("Count");
+		ImGui::TableSetupColumn("Avg ms");
+		ImGui::TableSetupColumn("Max ms");
+		ImGui::TableHeadersRow();
+		for (const auto& [name, stat] : stats) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(name.c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", static_cast<unsigned long long>(stat.count));
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stat.total / 1e6 / stat.count);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stat.max / 1e6);
+		}
+		ImGui::EndTable();
+	}
+	ImGui::End();
+}
+#endif
+
+#ifdef XCHIP8_PROFILE
+void Chip8::DrawHostCounters() {
+	if (!hostCountersOpen) {
+		ImGui::TextWrapped("Host counters unavailable (Linux perf_event only)");
+		return;
+	}
+	if (ImGui::Button("Clear##counters"))
+		hostCounters.Clear();
+	const PerfSample& last = hostCounters.last;
+	const PerfSample& total = hostCounters.total;
+	const uint64_t frames = hostCounters.frames;
+	ImGui::Text("IPC %.2f  miss %.2f%%", last.Ipc(), 100 * last.BranchMissRate());
+	// Counted around each RunCycle only, so the pacing spin is left out. Each
+	// instruction still pays for two counter reads, chip8_bench --counters
+	// measures the bare core.
+	if (ImGui::BeginTable("Counters", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV)) {
+		ImGui::TableSetupColumn("Counter");
+		ImGui::TableSetupColumn("Frame");
+		ImGui::TableSetupColumn("Avg");
+		ImGui::TableHeadersRow();
+		for (unsigned int i = 0; i < PERF_COUNTER_COUNT; i++) {
+			PerfCounter counter = static_cast<PerfCounter>(i);
+			if (!last.Has(counter))
+				continue;
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(PerfCounterName(counter));
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", static_cast<unsigned long long>(last[counter]));
+			ImGui::TableNextColumn();
+			ImGui::Text("%.0f", frames ? static_cast<double>(total[counter]) / frames : 0.0);
+		}
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn();
+		ImGui::TextUnformatted("guest ops");
+		ImGui::TableNextColumn();
+		ImGui::Text("%llu", static_cast<unsigned long long>(hostCounters.guestLast));
+		ImGui::TableNextColumn();
+		ImGui::Text("%.0f", frames ? static_cast<double>(hostCounters.guestTotal) / frames : 0.0);
+		ImGui::EndTable();
+	}
+}
+
+void Chip8::DrawCallProfile() {
+	ImGui::SetNextWindowPos(ImVec2(static_cast<float>(305 + 32 + 64 * videoScale), 5), ImGuiCond_FirstUseEver);
+	ImGui::SetNextWindowSize(ImVec2(480, 400), ImGuiCond_FirstUseEver);
+	ImGui::Begin("Subroutines", NULL);
+	if (ImGui::Button("Clear"))
+		calls.Clear();
+	ImGui::SameLine();
+	if (ImGui::Button("Load Labels")) {
+		std::string path = std::string(buf) + ".labels";
+		calls.LoadLabels(path.c_str());
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Save Folded")) {
+		std::string path = std::string(buf) + ".folded";
+		calls.WriteFolded(path.c_str(), cycles);
+	}
+
+	std::vector<std::pair<uint16_t, CallSite>> rows = calls.Sites(cycles);
+	uint64_t total = 0;
+	for (const auto& row : rows) {
+		total += row.second.exclusive;
+	}
+	const ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV
+		| ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable;
+	if (ImGui::BeginTable("Calls", 6, flags)) {
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Subroutine");
+		ImGui::TableSetupColumn("Calls", ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Inclusive", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Exclusive", ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Excl %", ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Host/call", ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableHeadersRow();
+
+		// Instructions for the first columns, host cycles per call for the last
+		auto key = [](const std::pair<uint16_t, CallSite>& row, int column) -> double {
+			const CallSite& site = row.second;
+			switch (column) {
+			case 0: return row.first;
+			case 1: return static_cast<double>(site.calls);
+			case 2: return static_cast<double>(site.inclusive);
+			case 5: return site.calls ? static_cast<double>(site.inclusiveHost) / site.calls : 0.0;
+			}
+			return static_cast<double>(site.exclusive);
+		};
+		int column = 2;
+		bool ascending = false;
+		if (ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs()) {
+			if (specs->SpecsCount > 0) {
+				column = specs->Specs[0].ColumnIndex;
+				ascending = specs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+			}
+		}
+		std::stable_sort(rows.begin(), rows.end(), [&](const auto& a, const auto& b) {
+			return ascending ? key(a, column) < key(b, column) : key(a, column) > key(b, column);
+		});
+
+		for (const auto& row : rows) {
+			const CallSite& site = row.second;
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			if (row.first == CallProfile::ROOT)
+				ImGui::TextUnformatted("main");
+			else
+				ImGui::Text("%s (%03X)", calls.Name(row.first).c_str(), row.first);
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", static_cast<unsigned long long>(site.calls));
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", static_cast<unsigned long long>(site.inclusive));
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu", static_cast<unsigned long long>(site.exclusive));
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", total ? 100.0 * site.exclusive / total : 0.0);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.0f", key(row, 5));
+		}
+		ImGui::EndTable();
+	}
+	ImGui::End();
+}
+
+void Chip8::DrawHeatmap() {
+	// One cell per byte, 64 to a row. Red is fetches, green data writes and
+	// blue data reads, each log-scaled against its busiest byte.
+	const float CELL = 5.0f;
+	const unsigned int COLS = 64, ROWS = HEATMAP_SIZE / COLS;
+	uint64_t maxExec = 1, maxRead = 1, maxWrite = 1;
+	for (unsigned int a = 0; a < HEATMAP_SIZE; a++) {
+		maxExec = std::max(maxExec, heatmap.exec[a]);
+		maxRead = std::max(maxRead, heatmap.reads[a]);
+		maxWrite = std::max(maxWrite, heatmap.writes[a]);
+	}
+	auto level = [](uint64_t count, uint64_t max) {
+		// Anything touched at all stays visible
+		return count ? static_cast<unsigned int>(64 + 191 * std::log1p(static_cast<double>(count)) / std::log1p(static_cast<double>(max))) : 0u;
+	};
+
+	ImDrawList* draw = ImGui::GetWindowDrawList();
+	ImVec2 origin = ImGui::GetCursorScreenPos();
+	draw->AddRectFilled(origin, ImVec2(origin.x + COLS * CELL, origin.y + ROWS * CELL), IM_COL32(16, 16, 16, 255));
+	for (unsigned int a = 0; a < HEATMAP_SIZE; a++) {
+		unsigned int r = level(heatmap.exec[a], maxExec);
+		unsigned int g = level(heatmap.writes[a], maxWrite);
+		unsigned int b = level(heatmap.reads[a], maxRead);
+		if (!(r | g | b))
+			continue;
+		ImVec2 min(origin.x + (a % COLS) * CELL, origin.y + (a / COLS) * CELL);
+		draw->AddRectFilled(min, ImVec2(min.x + CELL, min.y + CELL), IM_COL32(r, g, b, 255));
+	}
+	ImGui::Dummy(ImVec2(COLS * CELL, ROWS * CELL));
+	if (ImGui::IsItemHovered()) {
+		ImVec2 mouse = ImGui::GetMousePos();
+		unsigned int col = static_cast<unsigned int>((mouse.x - origin.x) / CELL);
+		unsigned int row = static_cast<unsigned int>((mouse.y - origin.y) / CELL);
+		unsigned int a = std::min(row, ROWS - 1) * COLS + std::min(col, COLS - 1);
+		ImGui::SetTooltip("%03X exec %llu read %llu write %llu", a, static_cast<unsigned long long>(heatmap.exec[a]),
+			static_cast<unsigned long long>(heatmap.reads[a]), static_cast<unsigned long long>(heatmap.writes[a]));
+	}
+}
+#endif
+#endif
+
 void Chip8::Table0() {
 	((*this).*(table0[opcode & 0x000Fu]))();
 }
@@ -436,13 +1323,24 @@ void Chip8::OP_NULL() {
 
 // Clear screen
 void Chip8::OP_00E0() {
+	// Take every lit pixel out of the hash
+	for (int y = 0; y < VIDEO_HEIGHT; y++) {
+		for (uint64_t row = plane[y]; row; row &= row - 1) {
+			memHash ^= PixelKey(y * VIDEO_WIDTH + 63 - std::countr_zero(row));
+		}
+	}
 	memset(video, 0, sizeof(video));
+	memset(plane, 0, sizeof(plane));
+	MarkVideo(0, VIDEO_WIDTH * VIDEO_HEIGHT);
 }
 
 // Return from subroutine
 void Chip8::OP_00EE() {
 	--sp;
 	pc = stack[sp];
+#ifdef XCHIP8_PROFILE
+	calls.Return(sp, cycles);
+#endif
 }
 
 // Jump to a machine code routine at nnn.
@@ -462,6 +1360,9 @@ void Chip8::OP_2nnn() {
 	stack[sp] = pc;
 	++sp;
 	pc = addr;
+#ifdef XCHIP8_PROFILE
+	calls.Call(addr, sp, cycles);
+#endif
 }
 
 // Skips next instruction if Vx equals byte at nn
@@ -525,6 +1426,10 @@ void Chip8::OP_8xy1() {
 	uint8_t y = (opcode & 0x00F0u) >> 4u;
 
 	V[x] |= V[y];
+
+	if (quirks & QUIRK_VF_RESET) {
+		V[0xF] = 0;
+	}
 }
 
 // Sets Vx to (Vx AND Vy)
@@ -533,6 +1438,10 @@ void Chip8::OP_8xy2() {
 	uint8_t y = (opcode & 0x00F0u) >> 4u;
 
 	V[x] &= V[y];
+
+	if (quirks & QUIRK_VF_RESET) {
+		V[0xF] = 0;
+	}
 }
 
 // Sets Vx to (Vx XOR VY)
@@ -541,6 +1450,10 @@ void Chip8::OP_8xy3() {
 	uint8_t y = (opcode & 0x00F0u) >> 4u;
 
 	V[x] ^= V[y];
+
+	if (quirks & QUIRK_VF_RESET) {
+		V[0xF] = 0;
+	}
 }
 
 // Adds VY to Vx. VF is set to 1 when there's a carry, and to 0 when there isn't.
@@ -576,6 +1489,9 @@ void Chip8::OP_8xy5() {
 // Shifts Vx right by one. VF is set to the value of the least significant bit of Vx before the shift.
 void Chip8::OP_8xy6() {
 	uint8_t x = (opcode & 0x0F00u) >> 8u;
+	if (quirks & QUIRK_SHIFT_VY) {
+		V[x] = V[(opcode & 0x00F0u) >> 4u];
+	}
 	V[0xF] = (V[x] & 0x1u);
 
 	V[x] >>= 1;
@@ -598,6 +1514,9 @@ void Chip8::OP_8xy7() {
 // Shifts Vx left by one. VF is set to the value of the most significant bit of Vx before the shift.
 void Chip8::OP_8xyE() {
 	uint8_t x = (opcode & 0xF00u) >> 8u;
+	if (quirks & QUIRK_SHIFT_VY) {
+		V[x] = V[(opcode & 0x00F0u) >> 4u];
+	}
 	V[0xF] = (V[x] & 0x80u) >> 7u;
 
 	V[x] <<= 1;
@@ -623,7 +1542,11 @@ void Chip8::OP_Annn() {
 // Jumps to the address nnn plus V0
 void Chip8::OP_Bnnn() {
 	uint16_t addr = opcode & 0x0FFFu;
-	pc = V[0] + addr;
+	if (quirks & QUIRK_JUMP_VX) {
+		pc = V[(opcode & 0x0F00u) >> 8u] + addr;
+	} else {
+		pc = V[0] + addr;
+	}
 }
 
 // Sets Vx to a random number, masked by byte nn
@@ -631,7 +1554,7 @@ void Chip8::OP_Cxbb() {
 	uint8_t x = (opcode & 0x0F00u) >> 8u;
 	uint8_t byte = opcode & 0x00FFu;
 
-	V[x] = randByte(randGen) & byte;
+	V[x] = RandomByte() & byte;
 }
 
 // Draws a sprite at coordinate (Vx, Vy) that has a width of 8 pixels and a height of N pixels.
@@ -644,19 +1567,29 @@ void Chip8::OP_Dxyn() {
 	uint8_t y = (opcode & 0x00F0u) >> 4u;
 	uint8_t height = opcode & 0x000Fu;
 
-	// Wrap if going beyond screen boundaries
+	// Wrap the position if going beyond screen boundaries, then clip the
+	// sprite at the right and bottom edges
 	uint8_t xPos = V[x] % VIDEO_WIDTH;
 	uint8_t yPos = V[y] % VIDEO_HEIGHT;
+	unsigned int rows = std::min<unsigned int>(height, VIDEO_HEIGHT - yPos);
+	unsigned int cols = std::min<unsigned int>(8, VIDEO_WIDTH - xPos);
 
 	V[0xF] = 0;
+#ifdef XCHIP8_PROFILE
+	heatmap.Read(I, rows);
+#endif
+	if (rows) {
+		MarkVideo(yPos * VIDEO_WIDTH, (yPos + rows) * VIDEO_WIDTH);
+	}
 
-	for (unsigned int row = 0; row < height; ++row) {
+	for (unsigned int row = 0; row < rows; ++row) {
 		uint8_t pixel = ram[I + row];
 
-		for (unsigned int col = 0; col < 8; ++col) {
+		for (unsigned int col = 0; col < cols; ++col) {
 			// Weird math to AND together pixel bytes with bitwise
 			uint8_t spritePixel = pixel & (0x80u >> col);
-			uint32_t* screenPixel = &video[(yPos + row) * VIDEO_WIDTH + (xPos + col)];
+			unsigned int index = (yPos + row) * VIDEO_WIDTH + (xPos + col);
+			uint32_t* screenPixel = &video[index];
 
 			// Sprite pixel is on
 			if (spritePixel) {
@@ -667,6 +1600,8 @@ void Chip8::OP_Dxyn() {
 
 				// Effectively XOR with the sprite pixel
 				*screenPixel ^= 0xFFFFFFFF;
+				plane[yPos + row] ^= 1ull << (63 - (xPos + col));
+				memHash ^= PixelKey(index);
 			}
 		}
 	}
@@ -780,34 +1715,53 @@ void Chip8::OP_Fx29() {
 void Chip8::OP_Fx33() {
 	uint8_t x = (opcode & 0x0F00u) >> 8u;
 	uint8_t value = V[x];
+	MarkRam(I, I + 3);
+#ifdef XCHIP8_PROFILE
+	heatmap.Write(I, 3);
+#endif
 
 	// Ones-place
-	ram[I + 2] = value % 10;
+	WriteRam(I + 2, value % 10);
 	value /= 10;
 
 	// Tens-place
-	ram[I + 1] = value % 10;
+	WriteRam(I + 1, value % 10);
 	value /= 10;
 
 	// Hundreds-place
-	ram[I] = value % 10;
+	WriteRam(I, value % 10);
 
 }
 
 // Stores V0 to VX in memory starting at address I
 void Chip8::OP_Fx55() {
 	uint8_t x = (opcode & 0x0F00) >> 8u;
+	MarkRam(I, I + x + 1);
+#ifdef XCHIP8_PROFILE
+	heatmap.Write(I, x + 1);
+#endif
 
 	for (int i = 0; i <= x; ++i) {
-		ram[I + i] = V[i];
+		WriteRam(I + i, V[i]);
+	}
+
+	if (quirks & QUIRK_LOADSTORE_I) {
+		I += x + 1;
 	}
 }
 
 // Fill registers V0 to VX inclusive with the values stored in memory starting at address I
 void Chip8::OP_Fx65() {
 	uint8_t x = (opcode & 0x0F00) >> 8u;
+#ifdef XCHIP8_PROFILE
+	heatmap.Read(I, x + 1);
+#endif
 
 	for (int i = 0; i <= x; ++i) {
 		V[i] = ram[I + i];
 	}
+
+	if (quirks & QUIRK_LOADSTORE_I) {
+		I += x + 1;
+	}
 }
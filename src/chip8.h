@@ -1,10 +1,28 @@
 #pragma once
 
 #include "state.h"
+#include "statewriter.h"
+#include "movie.h"
+#include "pacing.h"
+#include "pagedstate.h"
+#include "hash.h"
+#include "perfcounters.h"
+#include "profile.h"
+#include "trace.h"
+#include "zones.h"
+#include <atomic>
 #include <cstdint>
-#include <random>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+// XCHIP8_HEADLESS builds the bare interpreter for the command-line tools,
+// without GLFW, OpenGL or ImGui
+#ifndef XCHIP8_HEADLESS
 #include <GLFW/glfw3.h>
 #include "imgui/imgui_memory_editor.h"
+#endif
 
 const unsigned int KEY_COUNT = 16;
 const unsigned int MEMORY_SIZE = 4096;
@@ -12,34 +30,179 @@ const unsigned int REGISTER_COUNT = 16;
 const unsigned int STACK_LEVELS = 16;
 const int VIDEO_HEIGHT = 32;
 const int VIDEO_WIDTH = 64;
+// Fixed font address at $50
+const unsigned int FONTSET_START_ADDRESS = 0x50;
+// Fixed start address at $200
+const unsigned int START_ADDRESS = 0x200;
+
+// Quirk profile bits, zero is this interpreter's original behaviour.
+enum Quirk : uint32_t {
+	QUIRK_SHIFT_VY = 1u << 0,    // 8xy6/8xyE shift Vy into Vx (COSMAC VIP)
+	QUIRK_LOADSTORE_I = 1u << 1, // Fx55/Fx65 leave I at I + x + 1 (COSMAC VIP)
+	QUIRK_JUMP_VX = 1u << 2,     // Bnnn jumps to xnn + Vx (CHIP-48/SCHIP)
+	QUIRK_VF_RESET = 1u << 3,    // 8xy1/8xy2/8xy3 reset VF to 0 (COSMAC VIP)
+};
+
+// Timers tick at 60Hz
+const unsigned int FRAME_RATE = 60;
+
+// Instructions to run in frame n at the given rate, spreading the remainder
+// so ips / 60 need not be a whole number
+inline unsigned int FrameInstructions(uint64_t frame, unsigned int ips) {
+	return static_cast<unsigned int>((frame + 1) * ips / FRAME_RATE - frame * ips / FRAME_RATE);
+}
+
+// Parses a quirk profile: a profile name (none, vip, schip), a comma
+// separated list of quirks (shift, loadstore, jump, vfreset) or a number
+bool ParseQuirks(const char* text, uint32_t& quirks);
 
 class Chip8;
 
 class SaveStates {
 public:
-	SaveStates();
-	State* States[10];
+	// memoryCap bounds how many bytes of states stay resident, the least
+	// recently used slots beyond it are spilled to spillDir. A slot keeps its
+	// state until the writer confirms the file, and stays in memory if the
+	// write fails.
+	SaveStates(size_t memoryCap = 64 * sizeof(State), const char* spillDir = "states");
+	~SaveStates();
+
 	void CreateState(Chip8* chip8, State* state);
 	void Loadstate(Chip8* chip8, State* state);
+	// Persist a slot to disk, see statefile.h for the format
+	bool SaveToFile(Chip8* chip8, State* state, const char* path, bool compress);
+	bool LoadFromFile(Chip8* chip8, State* state, const char* path);
+	// Snapshots the slot now and leaves the disk write to the background writer
+	void SaveToFileAsync(Chip8* chip8, State* state, const char* path, bool compress);
+
+	// Named slots, as many as you like
+	void SaveSlot(Chip8* chip8, const std::string& name);
+	bool LoadSlot(Chip8* chip8, const std::string& name);
+	bool HasSlot(const std::string& name) const;
+	void DropSlot(const std::string& name);
+
+	size_t SlotCount() const { return slots.size(); }
+	size_t ResidentCount() const { return lru.size(); }
+	void SetMemoryCap(size_t bytes);
+
+	// Metrics
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t spills = 0;
+
+	StateWriter writer;
+
+private:
+	struct Slot {
+		State* state = nullptr; // nullptr once spilled
+		bool dirty = false;     // Resident copy differs from the spill file
+		bool onDisk = false;
+		// A spill was queued and the writer has not confirmed it yet. The
+		// state is kept until then, listed in the LRU or not.
+		bool spilling = false;
+		// Bumped by every save, tells a confirmed spill whether it is current
+		uint64_t version = 0;
+		uint64_t romHash = 0;
+		uint32_t quirks = 0;
+		// lru.end() while the slot is not listed
+		std::list<std::string>::iterator lruPos;
+	};
+	// A spill the writer finished, handed over from its thread
+	struct Spilled {
+		std::string name;
+		uint64_t version;
+		bool ok;
+	};
+
+	// The slot's state, read back from its spill file if it has to be.
+	// nullptr if that file cannot be read.
+	State* Resident(const std::string& name, Slot& slot);
+	// Gives a non-resident slot a pool state, contents unspecified
+	State* Acquire(const std::string& name, Slot& slot);
+	void Unload(Slot& slot);
+	void Touch(const std::string& name, Slot& slot);
+	void Evict();
+	// Settles the spills the writer finished since the last call
+	void Reap();
+	std::string SpillPath(const std::string& name) const;
+
+	size_t maxResident;
+	std::string spillDir;
+	StatePool pool;
+	std::unordered_map<std::string, Slot> slots;
+	// Most recently used first, only resident slots are listed
+	std::list<std::string> lru;
+	std::mutex spilledLock;
+	std::vector<Spilled> spilled;
 };
 
 class Chip8 {
 public:
 	Chip8();
 	// File Functions
-	void LoadRom(const char* filename);
+	bool LoadRom(const char* filename);
+	// Same, from an image already in memory, e.g. a generated ROM
+	bool LoadRom(const std::vector<uint8_t>& image);
+	// Reset and copy the already loaded ROM image back into memory
+	void Boot();
+	// Golden boot snapshot: boots, seeds the RNG, runs warmupFrames frames
+	// and keeps the result, so Restore() can restart from there many times a
+	// second. The same seed always gives the same snapshot.
+	void CaptureBoot(unsigned int warmupFrames = 0, unsigned int ips = 500, uint64_t seed = 0);
+	// Back to the golden snapshot. Only the RAM pages and video rows the
+	// opcodes wrote since the last restore are copied. Returns false without one.
+	bool Restore();
+	bool HasBootSnapshot() const { return !golden.Empty(); }
+	// Call after writing ram or video other than through the opcodes
+	void MarkAllDirty() {
+		dirtyRam = 0xFFFFu;
+		dirtyVideo = ~0u;
+	}
+	// Reseed the RNG, movies record the seed so Cxnn replays identically
+	void Seed(uint64_t seed);
+	// Writes bytes into ram from outside the opcodes, keeping memHash and the
+	// dirty pages in step. Clipped at the end of memory.
+	void Poke(unsigned int addr, const uint8_t* data, size_t size);
 
 	// Interpreter
 	void RunCycle();
 	void RunTimers();
-	// ImGui Windows
-	void RunMenu(int screenWidth, int screenHeight);
+	// Headless stepping: a frame's worth of instructions, then one 60Hz timer tick
+	void RunFrame(unsigned int instructions);
+
+	// Hash of the architectural state (memory, display, registers, timers, RNG)
+	uint64_t StateHash() const;
+	// Hash of the same state in O(1), for deduplication and transposition
+	// tables. RAM and video are kept as a Zobrist hash the opcodes update
+	// on every write, only the few registers are hashed on the spot.
+	// Builds with XCHIP8_CHECK_HASH (Debug) verify it against a full rehash.
+	uint64_t IncrementalHash() const;
+	// Zobrist hash of RAM and video from scratch
+	uint64_t MemoryHash() const;
+	// Call after writing ram or video from outside the opcodes, see also MarkAllDirty
+	void RehashMemory() { memHash = MemoryHash(); }
+
+	// True if the instruction at pc only touches ram, stack, keypad and the
+	// framebuffers within bounds. RunCycle does not check, out of bounds it
+	// reads and writes whatever lies next to them. Builds with
+	// XCHIP8_CHECK_BOUNDS (the fuzz target) do: the instruction is not run,
+	// outOfBounds is set and the core stays at that pc.
+	bool NextInBounds() const;
+
+	// True once the program sits in a jump-to-self loop, the usual way to end
+	bool IsHalted() const {
+		// After 1nnn pc is nnn, so the jump was to itself if nnn holds this opcode
+		return (opcode & 0xF000u) == 0x1000u && (opcode & 0x0FFFu) == pc
+			&& pc + 1u < MEMORY_SIZE && ((ram[pc] << 8u) | ram[pc + 1u]) == opcode;
+	}
 
 	// Reset
 	void Reset();
 
-	// B/W -> Color Conversion
-	uint32_t GetColoredPixel(uint32_t video, ImVec4 fgCol, ImVec4 bgCol);
+#ifndef XCHIP8_HEADLESS
+	// ImGui Windows
+	void RunMenu(int screenWidth, int screenHeight);
+#endif
 
 	// Monochrome B/W Display
 	uint32_t video[VIDEO_WIDTH * VIDEO_HEIGHT];
@@ -47,11 +210,20 @@ public:
 	// 2-Color Display
 	uint32_t display[VIDEO_WIDTH * VIDEO_HEIGHT];
 
+	// Bit-packed copy of video kept in step by the opcodes, one word per row
+	// with the leftmost pixel in bit 63. Cheap to copy and compare, this is
+	// what the RL environment hands out as observations.
+	uint64_t plane[VIDEO_HEIGHT];
+	// Rebuilds plane from video, after video was written from outside
+	void PackVideo();
+
+#ifndef XCHIP8_HEADLESS
 	// Foreground Color
 	ImVec4 foreground = ImVec4(0.05f, 1.0f, 0.05f, 1.0f);
 
 	// Background Color
 	ImVec4 background = ImVec4(0.03f, 0.03f, 0.03f, 1.00f);
+#endif
 
 	int videoScale = 10;
 
@@ -73,15 +245,61 @@ public:
 	uint8_t delayTimer;
 	uint8_t soundTimer;
 	int cycleDelay;
+	// 60Hz ticks raised by the timer thread, applied between instructions
+	std::atomic<uint32_t> pendingTicks{ 0 };
+
+	// Instructions executed since boot, the time base for movies
+	uint64_t cycles = 0;
+	// Counter-based RNG: byte n of a run is Mix64(rngSeed + n * golden ratio),
+	// identical on every platform and fully described by these two words
+	uint64_t rngSeed = 0;
+	uint64_t rngCounter = 0;
+
+	// Quirk profile, see Quirk
+	uint32_t quirks = 0;
+
+	// Zobrist hash of ram and video, see IncrementalHash
+	uint64_t memHash = 0;
+
+	// Hash64 of the loaded ROM image, savestates are tagged with it
+	uint64_t romHash = 0;
+	std::vector<uint8_t> rom;
+
+#ifdef XCHIP8_PROFILE
+	// Executions per handler, counted by RunCycle, see profile.h
+	OpcodeProfile profile;
+	// Fetches per address and data accesses per byte
+	MemoryProfile heatmap;
+	// Subroutine costs from 2nnn/00EE
+	CallProfile calls;
+	// Host hardware counters per frame, fed by the thread running the core
+	// when it could open them
+	PerfFrameStats hostCounters;
+	bool hostCountersOpen = false;
+#endif
+
+	// Instruction trace, RunCycle records into it while set
+	TraceBuffer* trace = nullptr;
+
+	// Input movies
+	Movie movie;
+	MovieRecorder recorder;
+	MoviePlayer player;
 
 	// Booleans
 	bool isLoaded = false;
 	bool isRunning = false;
 	bool updateDrawImage = false;
 	bool shouldBeep = false;
+	// Set by XCHIP8_CHECK_BOUNDS builds, see NextInBounds
+	bool outOfBounds = false;
 
+#ifndef XCHIP8_HEADLESS
 	//OpenGL Texture
 	GLuint TEX;
+	// Timer, instruction and present timing, fed by the GUI's threads
+	PacingStats pacing;
+#endif
 
 private:
 	// Function Pointer Tables
@@ -165,23 +383,92 @@ private:
 	void OP_Fx65();
 	#pragma endregion
 
+#ifndef XCHIP8_HEADLESS
 	bool showMenu = true;
 	bool showDemo = false;
 	char buf[128] = "roms/breakout.ch8";
 	MemoryEditor ramViewer;
 	ImFont* RobotoMono = nullptr;
 	ImFont* OpenSans = nullptr;
-	int whichState = 0;
+	char slotName[64] = "0";
+	// Scratch state for explicit exports to disk
+	State exportState;
+	bool compressStates = true;
 	SaveStates savestates;
+	bool showPacing = false;
+	// Pacing histograms overlay, in the top right corner
+	void DrawPacing(int screenWidth);
+#ifdef XCHIP8_PROFILE
+	bool profileByFamily = false;
+	bool showHeatmap = false;
+	// Heatmap grid in the RAM window
+	void DrawHeatmap();
+	// Subroutine table
+	void DrawCallProfile();
+	// Host counters in the Debugger window
+	void DrawHostCounters();
+#endif
+#ifdef XCHIP8_ZONES
+	bool timelinePaused = false;
+	int timelineMs = 50;
+	// Snapshot per thread, kept while paused
+	std::vector<ZoneThread> timelineThreads;
+	std::vector<std::vector<ZoneEvent>> timelineEvents;
+	uint64_t timelineEnd = 0;
+	// Host zones of every thread, newest on the right
+	void DrawTimeline();
+#endif
+#endif
+
+	friend class PagedState;
+
+	// RAM write that keeps memHash in step
+	void WriteRam(unsigned int addr, uint8_t value) {
+		memHash ^= RamKey(addr, ram[addr]) ^ RamKey(addr, value);
+		ram[addr] = value;
+	}
+	// Packs the registers for hashing, returns the byte count
+	size_t PackRegisters(uint8_t* out) const;
+	// Zobrist hash of the ROM image at START_ADDRESS, so Boot needs no rehash
+	uint64_t romMemHash = 0;
+
+	// Golden boot snapshot
+	PagedState golden;
+	// Copy-on-write tracking, see PagedState: the snapshot page each RAM page
+	// and video row last matched, and which ones were written since
+	uint64_t ramPageIds[PagedState::RAM_PAGES] = {};
+	uint64_t videoPageIds[PagedState::VIDEO_PAGES] = {};
+	uint16_t dirtyRam = 0xFFFFu;
+	uint32_t dirtyVideo = ~0u;
+
+	// Byte range [lo, hi) of ram
+	void MarkRam(unsigned int lo, unsigned int hi) {
+		if (hi > MEMORY_SIZE) {
+			MarkAllDirty();
+			return;
+		}
+		unsigned int first = lo / PagedState::PAGE_SIZE, last = (hi - 1) / PagedState::PAGE_SIZE;
+		dirtyRam |= static_cast<uint16_t>(((2u << last) - 1u) & ~((1u << first) - 1u));
+	}
+	// Pixel range [lo, hi) of video
+	void MarkVideo(unsigned int lo, unsigned int hi) {
+		if (hi > VIDEO_WIDTH * VIDEO_HEIGHT) {
+			MarkAllDirty();
+			return;
+		}
+		unsigned int first = lo / VIDEO_WIDTH, last = (hi - 1) / VIDEO_WIDTH;
+		dirtyVideo |= static_cast<uint32_t>(((2ull << last) - 1ull) & ~((1ull << first) - 1ull));
+	}
 
-	// RNG member vars
-	std::default_random_engine randGen;
-	std::uniform_int_distribution<uint16_t> randByte;
+	uint8_t RandomByte() {
+		return static_cast<uint8_t>(Mix64(rngSeed + ++rngCounter * 0x9E3779B97F4A7C15ull));
+	}
 
 	typedef void (Chip8::* Chip8Func)();
 	Chip8Func table[0xF + 1]{ &Chip8::OP_NULL };
-	Chip8Func table0[0xE + 1]{ &Chip8::OP_NULL };
-	Chip8Func table8[0xE + 1]{ &Chip8::OP_NULL };
-	Chip8Func tableE[0xE + 1]{ &Chip8::OP_NULL };
-	Chip8Func tableF[0x65 + 1]{ &Chip8::OP_NULL };
+	// Sized to the full range of the nibble/byte they are indexed with
+	Chip8Func table0[0xF + 1]{ &Chip8::OP_NULL };
+	Chip8Func table8[0xF + 1]{ &Chip8::OP_NULL };
+	Chip8Func tableE[0xF + 1]{ &Chip8::OP_NULL };
+	Chip8Func tableF[0xFF + 1]{ &Chip8::OP_NULL };
 };
\ No newline at end of file
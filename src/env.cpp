@@ -0,0 +1,220 @@
+#include "env.h"
+#include "hash.h"
+// Error Output
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+#pragma region Hooks
+ScoreFunc RamByteScore(uint16_t addr) {
+	return [addr](const Chip8& c) {
+		return static_cast<int64_t>(c.ram[addr & (MEMORY_SIZE - 1)]);
+	};
+}
+
+ScoreFunc RamBcdScore(uint16_t addr, unsigned int digits) {
+	return [addr, digits](const Chip8& c) {
+		int64_t value = 0;
+		for (unsigned int i = 0; i < digits; i++) {
+			value = value * 10 + c.ram[(addr + i) & (MEMORY_SIZE - 1)];
+		}
+		return value;
+	};
+}
+
+DoneFunc HaltedDone() {
+	return [](const Chip8& c) {
+		return c.IsHalted();
+	};
+}
+
+DoneFunc RamEqualsDone(uint16_t addr, uint8_t value) {
+	return [addr, value](const Chip8& c) {
+		return c.ram[addr & (MEMORY_SIZE - 1)] == value;
+	};
+}
+
+bool ParseScore(const char* text, ScoreFunc& score) {
+	char* end = nullptr;
+	if (!strncmp(text, "byte:", 5)) {
+		unsigned long addr = strtoul(text + 5, &end, 0);
+		if (*end || addr >= MEMORY_SIZE)
+			return false;
+		score = RamByteScore(static_cast<uint16_t>(addr));
+		return true;
+	}
+	if (!strncmp(text, "bcd:", 4)) {
+		unsigned long addr = strtoul(text + 4, &end, 0);
+		unsigned long digits = 3;
+		if (*end == ':')
+			digits = strtoul(end + 1, &end, 0);
+		if (*end || addr >= MEMORY_SIZE || digits == 0 || digits > 18)
+			return false;
+		score = RamBcdScore(static_cast<uint16_t>(addr), static_cast<unsigned int>(digits));
+		return true;
+	}
+	return false;
+}
+
+bool ParseDone(const char* text, DoneFunc& done) {
+	char* end = nullptr;
+	if (!strcmp(text, "halted")) {
+		done = HaltedDone();
+		return true;
+	}
+	if (!strncmp(text, "ram:", 4)) {
+		unsigned long addr = strtoul(text + 4, &end, 0);
+		if (*end != '=' || addr >= MEMORY_SIZE)
+			return false;
+		unsigned long value = strtoul(end + 1, &end, 0);
+		if (*end || value > 0xFF)
+			return false;
+		done = RamEqualsDone(static_cast<uint16_t>(addr), static_cast<uint8_t>(value));
+		return true;
+	}
+	return false;
+}
+#pragma endregion
+
+#pragma region Env
+Env::Env(const EnvConfig& cfg) : config(cfg) {
+	if (config.frameStack == 0)
+		config.frameStack = 1;
+	if (config.frameStack > MAX_FRAME_STACK)
+		config.frameStack = MAX_FRAME_STACK;
+	if (config.frameSkip == 0)
+		config.frameSkip = 1;
+	memset(history, 0, sizeof(history));
+}
+
+bool Env::LoadRom(const char* path) {
+	if (!core.LoadRom(path))
+		return false;
+	core.quirks = config.quirks;
+	core.CaptureBoot(config.warmupFrames, config.ips, config.warmupSeed);
+	return true;
+}
+
+void Env::Reset(uint64_t seed) {
+	core.Restore();
+	core.Seed(seed);
+	frame = 0;
+	head = 0;
+	lastScore = config.score ? config.score(core) : 0;
+	// The first observation repeats the boot frame
+	for (unsigned int i = 0; i < config.frameStack; i++) {
+		memcpy(history[i], core.plane, sizeof(core.plane));
+	}
+}
+
+void Env::Step(uint16_t action, float& reward, bool& done) {
+	// The frame about to be replaced joins the history
+	if (config.frameStack > 1) {
+		head = (head + 1) % (config.frameStack - 1);
+		memcpy(history[head], core.plane, sizeof(core.plane));
+	}
+
+	for (unsigned int k = 0; k < KEY_COUNT; k++) {
+		core.keypad[k] = (action >> k) & 1u;
+	}
+
+	done = false;
+	for (unsigned int f = 0; f < config.frameSkip && !done; f++) {
+		core.RunFrame(FrameInstructions(frame, config.ips));
+		frame++;
+		done = (config.done && config.done(core)) || (config.maxFrames && frame >= config.maxFrames);
+	}
+
+	reward = 0;
+	if (config.score) {
+		int64_t score = config.score(core);
+		reward = static_cast<float>(score - lastScore);
+		lastScore = score;
+	}
+}
+
+Observation Env::Observe() const {
+	Observation obs;
+	obs.count = config.frameStack;
+	obs.frames[0] = core.plane;
+	// Walk the ring backwards from the newest history entry
+	for (unsigned int i = 1; i < config.frameStack; i++) {
+		unsigned int slot = (head + config.frameStack - 1 - (i - 1)) % (config.frameStack - 1);
+		obs.frames[i] = history[slot];
+	}
+	return obs;
+}
+#pragma endregion
+
+#pragma region VecEnv
+VecEnv::VecEnv(unsigned int count, const EnvConfig& config, unsigned int threads) :
+	episodeCount(count, 0) {
+	for (unsigned int i = 0; i < count; i++) {
+		envs.emplace_back(new Env(config));
+	}
+	frameStack = config.frameStack == 0 ? 1 : (config.frameStack > MAX_FRAME_STACK ? MAX_FRAME_STACK : config.frameStack);
+	if (threads > 1)
+		pool.reset(new ThreadPool(threads));
+}
+
+bool VecEnv::LoadRom(const char* path) {
+	for (auto& env : envs) {
+		if (!env->LoadRom(path))
+			return false;
+	}
+	return true;
+}
+
+void VecEnv::Reset(uint64_t seed) {
+	baseSeed = seed;
+	for (unsigned int i = 0; i < envs.size(); i++) {
+		episodeCount[i] = 0;
+		envs[i]->Reset(Mix64(baseSeed ^ (static_cast<uint64_t>(i) << 32)));
+	}
+}
+
+void VecEnv::StepRange(unsigned int begin, unsigned int end, const uint16_t* actions, float* rewards, uint8_t* dones) {
+	for (unsigned int i = begin; i < end; i++) {
+		bool done;
+		envs[i]->Step(actions[i], rewards[i], done);
+		dones[i] = done;
+		if (done) {
+			uint64_t episode = ++episodeCount[i];
+			envs[i]->Reset(Mix64(baseSeed ^ (static_cast<uint64_t>(i) << 32) ^ episode));
+		}
+	}
+}
+
+void VecEnv::Step(const uint16_t* actions, float* rewards, uint8_t* dones) {
+	unsigned int count = static_cast<unsigned int>(envs.size());
+	if (!pool) {
+		StepRange(0, count, actions, rewards, dones);
+	} else {
+		// A few chunks per worker so stealing can even out slow episodes
+		unsigned int chunks = pool->Size() * 4;
+		unsigned int chunkSize = (count + chunks - 1) / chunks;
+		for (unsigned int begin = 0; begin < count; begin += chunkSize) {
+			unsigned int end = begin + chunkSize < count ? begin + chunkSize : count;
+			pool->Submit([this, begin, end, actions, rewards, dones] {
+				StepRange(begin, end, actions, rewards, dones);
+			});
+		}
+		pool->Wait();
+	}
+
+	steps += count;
+	for (unsigned int i = 0; i < count; i++) {
+		episodes += dones[i];
+	}
+}
+
+void VecEnv::CopyObservations(uint64_t* out) const {
+	for (auto& env : envs) {
+		Observation obs = env->Observe();
+		for (unsigned int i = 0; i < frameStack; i++) {
+			memcpy(out, obs.frames[i], VIDEO_HEIGHT * sizeof(uint64_t));
+			out += VIDEO_HEIGHT;
+		}
+	}
+}
+#pragma endregion
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "chip8.h"
+#include "threadpool.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reinforcement-learning environment over the headless core.
+// An action is a keypad mask (bit n holds key n down), held for frameSkip
+// frames per step. The reward is the change in a game-specific score read
+// from guest RAM, and the episode ends when a done hook fires or the frame
+// limit is reached.
+
+// Reads the current score from the guest, reward is the difference per step
+typedef std::function<int64_t(const Chip8& chip8)> ScoreFunc;
+// True once the episode is over
+typedef std::function<bool(const Chip8& chip8)> DoneFunc;
+
+// Score held in one RAM byte
+ScoreFunc RamByteScore(uint16_t addr);
+// Score held as one decimal digit per byte, most significant first, the way Fx33 stores it
+ScoreFunc RamBcdScore(uint16_t addr, unsigned int digits);
+// The program parked itself in a jump-to-self loop
+DoneFunc HaltedDone();
+// A RAM byte (say a lives counter) reached a value
+DoneFunc RamEqualsDone(uint16_t addr, uint8_t value);
+
+// Parses "byte:ADDR" or "bcd:ADDR[:DIGITS]"
+bool ParseScore(const char* text, ScoreFunc& score);
+// Parses "halted" or "ram:ADDR=VALUE"
+bool ParseDone(const char* text, DoneFunc& done);
+
+const unsigned int MAX_FRAME_STACK = 8;
+
+struct EnvConfig {
+	unsigned int frameSkip = 4;
+	unsigned int frameStack = 4;
+	unsigned int ips = 500;
+	// Truncates episodes after this many frames, 0 for no limit
+	uint64_t maxFrames = 0;
+	// Frames run once after boot before the golden snapshot every episode starts from
+	unsigned int warmupFrames = 0;
+	// RNG seed of the warmup, the same for every env of a VecEnv so they all
+	// start their episodes from one golden snapshot
+	uint64_t warmupSeed = 0;
+	uint32_t quirks = 0;
+	ScoreFunc score;
+	DoneFunc done;
+};
+
+// Stacked observation, frames[0] is the newest. Each frame is VIDEO_HEIGHT
+// words of Chip8::plane. frames[0] points at the core's own plane and the
+// rest into the env's history ring, so nothing is copied to build it.
+// Valid until the next Step or Reset of that env.
+struct Observation {
+	const uint64_t* frames[MAX_FRAME_STACK];
+	unsigned int count;
+};
+
+class Env {
+public:
+	Env(const EnvConfig& config);
+
+	bool LoadRom(const char* path);
+	void Reset(uint64_t seed);
+	void Step(uint16_t action, float& reward, bool& done);
+	Observation Observe() const;
+
+	const Chip8& Core() const { return core; }
+	uint64_t EpisodeFrames() const { return frame; }
+
+private:
+	EnvConfig config;
+	Chip8 core;
+	// Older frames of the stack, written round-robin
+	uint64_t history[MAX_FRAME_STACK][VIDEO_HEIGHT];
+	unsigned int head = 0;
+	uint64_t frame = 0;
+	int64_t lastScore = 0;
+};
+
+// A batch of envs stepped together, optionally spread over a thread pool.
+// Envs that finish are reset on the spot with a fresh seed derived from the
+// base seed, the env index and the episode number, so a run is reproducible
+// whatever the thread count.
+class VecEnv {
+public:
+	VecEnv(unsigned int count, const EnvConfig& config, unsigned int threads = 1);
+
+	bool LoadRom(const char* path);
+	void Reset(uint64_t seed);
+	// actions, rewards and dones hold Size() entries each
+	void Step(const uint16_t* actions, float* rewards, uint8_t* dones);
+	Observation Observe(unsigned int index) const { return envs[index]->Observe(); }
+	// Packs every env's stack into out, Size() * frameStack * VIDEO_HEIGHT words
+	void CopyObservations(uint64_t* out) const;
+
+	size_t Size() const { return envs.size(); }
+	const Env& At(unsigned int index) const { return *envs[index]; }
+
+	// Metrics
+	uint64_t steps = 0;
+	uint64_t episodes = 0;
+
+private:
+	void StepRange(unsigned int begin, unsigned int end, const uint16_t* actions, float* rewards, uint8_t* dones);
+
+	std::vector<std::unique_ptr<Env>> envs;
+	std::vector<uint64_t> episodeCount;
+	unsigned int frameStack;
+	uint64_t baseSeed = 0;
+	std::unique_ptr<ThreadPool> pool;
+};
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// splitmix64 finalizer, good avalanche for a handful of ALU ops.
+inline uint64_t Mix64(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return x;
+}
+
+// Non-cryptographic 64-bit hash, consumes 8 bytes per step so hashing a whole
+// savestate stays well under the cost of reading it from disk.
+inline uint64_t Hash64(const void* data, size_t size, uint64_t seed = 0) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ull);
+
+	while (size >= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		h ^= word * 0xC2B2AE3D27D4EB4Full;
+		h = ((h << 31) | (h >> 33)) * 0x9E3779B97F4A7C15ull;
+		p += 8;
+		size -= 8;
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, p, size);
+	h ^= tail * 0xC2B2AE3D27D4EB4Full;
+
+	return Mix64(h);
+}
+
+// Zobrist keys for Chip8's incremental state hash, which XORs one key per
+// non-zero RAM byte and per lit pixel. Zero bytes and dark pixels add
+// nothing, so a cleared screen or zeroed RAM costs no work.
+inline uint64_t RamKey(unsigned int addr, uint8_t value) {
+	return value ? Mix64(0x52414D0000000000ull ^ (static_cast<uint64_t>(addr) << 8 | value)) : 0;
+}
+
+inline uint64_t PixelKey(unsigned int index) {
+	return Mix64(0x5049584500000000ull ^ index);
+}
\ No newline at end of file
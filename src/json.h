@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+// Escapes text for use inside a JSON string literal. ROM paths, movie names
+// and thread names are free text, a quote or backslash in one must not
+// break the report or trace it ends up in.
+inline std::string JsonEscape(const std::string& text) {
+	std::string out;
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+			out += escaped;
+		} else {
+			out += c;
+		}
+	}
+	return out;
+}
\ No newline at end of file
@@ -0,0 +1,491 @@
+#include "lockstep.h"
+#include "hash.h"
+#include <cstring>
+
+// Where the scalar core indexes past the end of an array (pc, I or sp out of
+// range) the lanes wrap instead; in range the two agree bit for bit. A key
+// past F has nothing to wrap to, so a lane about to test one stops there the
+// way Chip8::NextInBounds does.
+
+template <unsigned int LANES>
+Lockstep<LANES>::Lockstep() {
+	memset(ram, 0, sizeof(ram));
+	memset(video, 0, sizeof(video));
+	memset(V, 0, sizeof(V));
+	memset(stack, 0, sizeof(stack));
+	memset(I, 0, sizeof(I));
+	memset(pc, 0, sizeof(pc));
+	memset(sp, 0, sizeof(sp));
+	memset(opcode, 0, sizeof(opcode));
+	memset(delayTimer, 0, sizeof(delayTimer));
+	memset(soundTimer, 0, sizeof(soundTimer));
+	memset(keys, 0, sizeof(keys));
+	memset(active, 0, sizeof(active));
+	memset(outOfBounds, 0, sizeof(outOfBounds));
+	memset(cycles, 0, sizeof(cycles));
+	memset(rngSeed, 0, sizeof(rngSeed));
+	memset(rngCounter, 0, sizeof(rngCounter));
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::Load(unsigned int lane, const Chip8& c) {
+	for (unsigned int a = 0; a < MEMORY_SIZE; a++) {
+		ram[a][lane] = c.ram[a];
+	}
+	for (unsigned int p = 0; p < PIXELS; p++) {
+		video[p][lane] = c.video[p] == 0xFFFFFFFF;
+	}
+	for (unsigned int r = 0; r < REGISTER_COUNT; r++) {
+		V[r][lane] = c.V[r];
+	}
+	for (unsigned int s = 0; s < STACK_LEVELS; s++) {
+		stack[s][lane] = c.stack[s];
+	}
+	I[lane] = c.I;
+	pc[lane] = c.pc;
+	sp[lane] = c.sp;
+	opcode[lane] = c.opcode;
+	delayTimer[lane] = c.delayTimer;
+	soundTimer[lane] = c.soundTimer;
+	keys[lane] = KeypadMask(c.keypad);
+	cycles[lane] = c.cycles;
+	rngSeed[lane] = c.rngSeed;
+	rngCounter[lane] = c.rngCounter;
+	quirks = c.quirks;
+	active[lane] = c.outOfBounds ? 0 : 0xFF;
+	outOfBounds[lane] = c.outOfBounds ? 0xFF : 0;
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::Store(unsigned int lane, Chip8& c) const {
+	for (unsigned int a = 0; a < MEMORY_SIZE; a++) {
+		c.ram[a] = ram[a][lane];
+	}
+	for (unsigned int p = 0; p < PIXELS; p++) {
+		c.video[p] = video[p][lane] ? 0xFFFFFFFF : 0;
+	}
+	c.PackVideo();
+	c.MarkAllDirty();
+	c.RehashMemory();
+	for (unsigned int r = 0; r < REGISTER_COUNT; r++) {
+		c.V[r] = V[r][lane];
+	}
+	for (unsigned int s = 0; s < STACK_LEVELS; s++) {
+		c.stack[s] = stack[s][lane];
+	}
+	for (unsigned int k = 0; k < KEY_COUNT; k++) {
+		c.keypad[k] = (keys[lane] >> k) & 1u;
+	}
+	c.I = I[lane];
+	c.pc = pc[lane];
+	c.sp = sp[lane];
+	c.opcode = opcode[lane];
+	c.delayTimer = delayTimer[lane];
+	c.soundTimer = soundTimer[lane];
+	c.cycles = cycles[lane];
+	c.rngSeed = rngSeed[lane];
+	c.rngCounter = rngCounter[lane];
+	c.outOfBounds = outOfBounds[lane] != 0;
+	c.quirks = quirks;
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::SetActive(unsigned int lane, bool on) {
+	active[lane] = on ? 0xFF : 0;
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::Step() {
+	steps++;
+	if (scalarSteps) {
+		scalarSteps--;
+		StepLanes();
+		return;
+	}
+
+	alignas(64) Mask todo;
+	memcpy(todo, active, sizeof(todo));
+	uint64_t firstGroup = groups;
+
+	for (unsigned int leader = 0; leader < LANES; leader++) {
+		if (!todo[leader])
+			continue;
+
+		// Every lane still to run that sits at the leader's pc with the same
+		// opcode joins its group. Byte p of all lanes is one contiguous row,
+		// so this is a handful of vector compares.
+		uint16_t p = pc[leader] & (MEMORY_SIZE - 1);
+		uint8_t hi = ram[p][leader];
+		uint8_t lo = ram[(p + 1) & (MEMORY_SIZE - 1)][leader];
+		const uint8_t* hiRow = ram[p];
+		const uint8_t* loRow = ram[(p + 1) & (MEMORY_SIZE - 1)];
+
+		alignas(64) Mask m;
+		for (unsigned int l = 0; l < LANES; l++) {
+			m[l] = (todo[l] && pc[l] == pc[leader] && hiRow[l] == hi && loRow[l] == lo) ? 0xFF : 0;
+		}
+		for (unsigned int l = 0; l < LANES; l++) {
+			todo[l] &= ~m[l];
+		}
+
+		// Lanes before the leader are done already, so the group spans
+		// [leader, end) and small groups of a diverged batch stay cheap
+		unsigned int end = LANES;
+		while (!m[end - 1])
+			end--;
+
+		uint16_t op = static_cast<uint16_t>(hi << 8 | lo);
+		if ((op >> 12u) == 0xE) {
+			// Ex9E/ExA1 on a key past F is undefined, those lanes stop before it
+			const uint8_t* key = V[(op & 0x0F00u) >> 8u];
+			for (unsigned int l = leader; l < end; l++) {
+				if (m[l] && key[l] >= KEY_COUNT) {
+					m[l] = 0;
+					active[l] = 0;
+					outOfBounds[l] = 0xFF;
+				}
+			}
+		}
+		unsigned int count = 0;
+		for (unsigned int l = leader; l < end; l++) {
+			opcode[l] = m[l] ? op : opcode[l];
+			pc[l] = m[l] ? static_cast<uint16_t>(pc[l] + 2) : pc[l];
+			cycles[l] += m[l] & 1u;
+			count += m[l] & 1u;
+		}
+		laneInstructions += count;
+		groups++;
+
+		Execute(op, m, leader, end);
+	}
+
+	// Once the lanes have scattered, forming groups costs more than running
+	// them one by one, so do that for a while before looking again
+	if (groups - firstGroup > LANES / DIVERGED_FRACTION)
+		scalarSteps = SCALAR_STEPS;
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::StepLanes() {
+	for (unsigned int l = 0; l < LANES; l++) {
+		if (!active[l])
+			continue;
+
+		uint16_t p = pc[l] & (MEMORY_SIZE - 1);
+		uint16_t op = static_cast<uint16_t>(ram[p][l] << 8 | ram[(p + 1) & (MEMORY_SIZE - 1)][l]);
+		if ((op >> 12u) == 0xE && V[(op & 0x0F00u) >> 8u][l] >= KEY_COUNT) {
+			active[l] = 0;
+			outOfBounds[l] = 0xFF;
+			continue;
+		}
+		opcode[l] = op;
+		pc[l] = static_cast<uint16_t>(pc[l] + 2);
+		cycles[l]++;
+		laneInstructions++;
+		groups++;
+
+		// active doubles as the mask, it selects lane l within [l, l + 1)
+		Execute(op, active, l, l + 1);
+	}
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::RunTimers() {
+	for (unsigned int l = 0; l < LANES; l++) {
+		delayTimer[l] -= (active[l] && delayTimer[l] > 0) ? 1 : 0;
+		soundTimer[l] -= (active[l] && soundTimer[l] > 0) ? 1 : 0;
+	}
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::RunFrame(unsigned int instructions) {
+	for (unsigned int i = 0; i < instructions; ++i) {
+		Step();
+	}
+	RunTimers();
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::Execute(uint16_t op, const Mask m, unsigned int first, unsigned int end) {
+	const uint8_t x = (op & 0x0F00u) >> 8u;
+	const uint8_t y = (op & 0x00F0u) >> 4u;
+	const uint8_t nn = op & 0x00FFu;
+	const uint16_t nnn = op & 0x0FFFu;
+	uint8_t* Vx = V[x];
+	uint8_t* Vy = V[y];
+	uint8_t* VF = V[0xF];
+
+	switch (op >> 12u) {
+	case 0x0:
+		if ((op & 0x000Fu) == 0x0) {
+			// CLS
+			for (unsigned int p = 0; p < PIXELS; p++) {
+				for (unsigned int l = first; l < end; l++) {
+					video[p][l] &= ~m[l];
+				}
+			}
+		} else if ((op & 0x000Fu) == 0xE) {
+			// RET
+			for (unsigned int l = first; l < end; l++) {
+				if (m[l]) {
+					sp[l]--;
+					pc[l] = stack[sp[l] & (STACK_LEVELS - 1)][l];
+				}
+			}
+		}
+		break;
+	case 0x1:
+		for (unsigned int l = first; l < end; l++) {
+			pc[l] = m[l] ? nnn : pc[l];
+		}
+		break;
+	case 0x2:
+		for (unsigned int l = first; l < end; l++) {
+			if (m[l]) {
+				stack[sp[l] & (STACK_LEVELS - 1)][l] = pc[l];
+				sp[l]++;
+				pc[l] = nnn;
+			}
+		}
+		break;
+	case 0x3:
+		for (unsigned int l = first; l < end; l++) {
+			pc[l] += (m[l] && Vx[l] == nn) ? 2 : 0;
+		}
+		break;
+	case 0x4:
+		for (unsigned int l = first; l < end; l++) {
+			pc[l] += (m[l] && Vx[l] != nn) ? 2 : 0;
+		}
+		break;
+	case 0x5:
+		for (unsigned int l = first; l < end; l++) {
+			pc[l] += (m[l] && Vx[l] == Vy[l]) ? 2 : 0;
+		}
+		break;
+	case 0x6:
+		for (unsigned int l = first; l < end; l++) {
+			Vx[l] = m[l] ? nn : Vx[l];
+		}
+		break;
+	case 0x7:
+		for (unsigned int l = first; l < end; l++) {
+			Vx[l] += m[l] & nn;
+		}
+		break;
+	case 0x8:
+		// Same statement order as the scalar core, which matters when x or y is F
+		switch (op & 0x000Fu) {
+		case 0x0:
+			for (unsigned int l = first; l < end; l++) {
+				Vx[l] = m[l] ? Vy[l] : Vx[l];
+			}
+			break;
+		case 0x1:
+		case 0x2:
+		case 0x3:
+			for (unsigned int l = first; l < end; l++) {
+				uint8_t r = (op & 0x000Fu) == 0x1 ? (Vx[l] | Vy[l]) : (op & 0x000Fu) == 0x2 ? (Vx[l] & Vy[l]) : (Vx[l] ^ Vy[l]);
+				Vx[l] = m[l] ? r : Vx[l];
+			}
+			if (quirks & QUIRK_VF_RESET) {
+				for (unsigned int l = first; l < end; l++) {
+					VF[l] &= ~m[l];
+				}
+			}
+			break;
+		case 0x4:
+			for (unsigned int l = first; l < end; l++) {
+				uint16_t sum = Vx[l] + Vy[l];
+				VF[l] = m[l] ? (sum > 255u) : VF[l];
+				Vx[l] = m[l] ? static_cast<uint8_t>(sum) : Vx[l];
+			}
+			break;
+		case 0x5:
+			for (unsigned int l = first; l < end; l++) {
+				VF[l] = m[l] ? (Vx[l] > Vy[l]) : VF[l];
+				Vx[l] = m[l] ? static_cast<uint8_t>(Vx[l] - Vy[l]) : Vx[l];
+			}
+			break;
+		case 0x6:
+			for (unsigned int l = first; l < end; l++) {
+				if (quirks & QUIRK_SHIFT_VY)
+					Vx[l] = m[l] ? Vy[l] : Vx[l];
+				VF[l] = m[l] ? (Vx[l] & 0x1u) : VF[l];
+				Vx[l] = m[l] ? (Vx[l] >> 1) : Vx[l];
+			}
+			break;
+		case 0x7:
+			for (unsigned int l = first; l < end; l++) {
+				VF[l] = m[l] ? (Vy[l] > Vx[l]) : VF[l];
+				Vx[l] = m[l] ? static_cast<uint8_t>(Vy[l] - Vx[l]) : Vx[l];
+			}
+			break;
+		case 0xE:
+			for (unsigned int l = first; l < end; l++) {
+				if (quirks & QUIRK_SHIFT_VY)
+					Vx[l] = m[l] ? Vy[l] : Vx[l];
+				VF[l] = m[l] ? (Vx[l] >> 7u) : VF[l];
+				Vx[l] = m[l] ? static_cast<uint8_t>(Vx[l] << 1) : Vx[l];
+			}
+			break;
+		}
+		break;
+	case 0x9:
+		for (unsigned int l = first; l < end; l++) {
+			pc[l] += (m[l] && Vx[l] != Vy[l]) ? 2 : 0;
+		}
+		break;
+	case 0xA:
+		for (unsigned int l = first; l < end; l++) {
+			I[l] = m[l] ? nnn : I[l];
+		}
+		break;
+	case 0xB: {
+		const uint8_t* base = (quirks & QUIRK_JUMP_VX) ? Vx : V[0];
+		for (unsigned int l = first; l < end; l++) {
+			pc[l] = m[l] ? static_cast<uint16_t>(base[l] + nnn) : pc[l];
+		}
+		break;
+	}
+	case 0xC:
+		for (unsigned int l = first; l < end; l++) {
+			if (m[l]) {
+				uint8_t r = static_cast<uint8_t>(Mix64(rngSeed[l] + ++rngCounter[l] * 0x9E3779B97F4A7C15ull));
+				Vx[l] = r & nn;
+			}
+		}
+		break;
+	case 0xD:
+		Draw(op, m, first, end);
+		break;
+	case 0xE:
+		if ((op & 0x000Fu) == 0x1 || (op & 0x000Fu) == 0xE) {
+			bool skipIfDown = (op & 0x000Fu) == 0xE;
+			for (unsigned int l = first; l < end; l++) {
+				// Lanes with a key past F left the group in Step
+				bool down = (keys[l] >> (Vx[l] & (KEY_COUNT - 1))) & 1u;
+				pc[l] += (m[l] && down == skipIfDown) ? 2 : 0;
+			}
+		}
+		break;
+	case 0xF:
+		switch (nn) {
+		case 0x07:
+			for (unsigned int l = first; l < end; l++) {
+				Vx[l] = m[l] ? delayTimer[l] : Vx[l];
+			}
+			break;
+		case 0x0A:
+			for (unsigned int l = first; l < end; l++) {
+				if (!m[l])
+					continue;
+				if (keys[l]) {
+					uint8_t key = 0;
+					while (!((keys[l] >> key) & 1u))
+						key++;
+					Vx[l] = key;
+				} else {
+					pc[l] -= 2;
+				}
+			}
+			break;
+		case 0x15:
+			for (unsigned int l = first; l < end; l++) {
+				delayTimer[l] = m[l] ? Vx[l] : delayTimer[l];
+			}
+			break;
+		case 0x18:
+			for (unsigned int l = first; l < end; l++) {
+				soundTimer[l] = m[l] ? Vx[l] : soundTimer[l];
+			}
+			break;
+		case 0x1E:
+			for (unsigned int l = first; l < end; l++) {
+				VF[l] = m[l] ? (I[l] + Vx[l] > 0xFFF) : VF[l];
+				I[l] = m[l] ? static_cast<uint16_t>(I[l] + Vx[l]) : I[l];
+			}
+			break;
+		case 0x29:
+			for (unsigned int l = first; l < end; l++) {
+				I[l] = m[l] ? static_cast<uint16_t>(FONTSET_START_ADDRESS + 5 * Vx[l]) : I[l];
+			}
+			break;
+		case 0x33:
+			for (unsigned int l = first; l < end; l++) {
+				if (m[l]) {
+					uint8_t value = Vx[l];
+					ram[(I[l] + 2) & (MEMORY_SIZE - 1)][l] = value % 10;
+					ram[(I[l] + 1) & (MEMORY_SIZE - 1)][l] = (value / 10) % 10;
+					ram[I[l] & (MEMORY_SIZE - 1)][l] = value / 100;
+				}
+			}
+			break;
+		case 0x55:
+			for (unsigned int l = first; l < end; l++) {
+				if (m[l]) {
+					for (unsigned int i = 0; i <= x; ++i) {
+						ram[(I[l] + i) & (MEMORY_SIZE - 1)][l] = V[i][l];
+					}
+				}
+			}
+			if (quirks & QUIRK_LOADSTORE_I) {
+				for (unsigned int l = first; l < end; l++) {
+					I[l] += m[l] ? x + 1 : 0;
+				}
+			}
+			break;
+		case 0x65:
+			for (unsigned int l = first; l < end; l++) {
+				if (m[l]) {
+					for (unsigned int i = 0; i <= x; ++i) {
+						V[i][l] = ram[(I[l] + i) & (MEMORY_SIZE - 1)][l];
+					}
+				}
+			}
+			if (quirks & QUIRK_LOADSTORE_I) {
+				for (unsigned int l = first; l < end; l++) {
+					I[l] += m[l] ? x + 1 : 0;
+				}
+			}
+			break;
+		}
+		break;
+	}
+}
+
+template <unsigned int LANES>
+void Lockstep<LANES>::Draw(uint16_t op, const Mask m, unsigned int first, unsigned int end) {
+	const uint8_t x = (op & 0x0F00u) >> 8u;
+	const uint8_t y = (op & 0x00F0u) >> 4u;
+	const uint8_t height = op & 0x000Fu;
+
+	// Sprite position and source differ per lane, so this one is a gather
+	for (unsigned int l = first; l < end; l++) {
+		if (!m[l])
+			continue;
+		uint8_t xPos = V[x][l] % VIDEO_WIDTH;
+		uint8_t yPos = V[y][l] % VIDEO_HEIGHT;
+		// Clipped at the right and bottom edges like the scalar core
+		unsigned int rows = height < VIDEO_HEIGHT - yPos ? height : VIDEO_HEIGHT - yPos;
+		unsigned int cols = 8 < VIDEO_WIDTH - xPos ? 8 : VIDEO_WIDTH - xPos;
+		uint8_t collision = 0;
+
+		for (unsigned int row = 0; row < rows; ++row) {
+			uint8_t pixel = ram[(I[l] + row) & (MEMORY_SIZE - 1)][l];
+			unsigned int base = (yPos + row) * VIDEO_WIDTH + xPos;
+			for (unsigned int col = 0; col < cols; ++col) {
+				if (pixel & (0x80u >> col)) {
+					uint8_t& screenPixel = video[base + col][l];
+					collision |= screenPixel;
+					screenPixel ^= 1;
+				}
+			}
+		}
+		V[0xF][l] = collision;
+	}
+}
+
+template class Lockstep<8>;
+template class Lockstep<16>;
+template class Lockstep<32>;
\ No newline at end of file
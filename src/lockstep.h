@@ -0,0 +1,96 @@
+#pragma once
+
+#include "chip8.h"
+#include <cstdint>
+
+// Lockstep engine: LANES instances of the same ROM in structure-of-arrays
+// layout, so byte n of every lane's RAM, register Vx of every lane, every
+// lane's pc and so on sit next to each other in memory.
+// Step() runs one instruction on every lane. Lanes that are at the same pc
+// with the same opcode form a group and execute it together as straight
+// loops over the lanes under a mask, which the compiler turns into SSE/AVX2/
+// AVX-512 code (configure with XCHIP8_NATIVE to let it use the host's widest
+// vectors). Divergent lanes simply form further groups within the same step,
+// so each lane still sees exactly the instruction stream the scalar Chip8
+// would run. Once a step splits into many groups the engine stops forming
+// them and runs each lane on its own for a while, then tries again.
+// All lanes share one quirk profile.
+// It only beats one scalar Chip8 per instance while the lanes mostly agree
+// (groups_per_step near 1 in xchip8_lockstep, e.g. ROMs that ignore input or
+// batches fed the same keys). Lanes that go their own way, as with per-lane
+// policies in RL or search, run at roughly 0.6-1x the scalar core, so give
+// such batches scalar cores on a thread pool instead.
+template <unsigned int LANES>
+class Lockstep {
+public:
+	static const unsigned int Lanes = LANES;
+
+	Lockstep();
+
+	// Copies a (booted, seeded) scalar core into a lane and activates it
+	void Load(unsigned int lane, const Chip8& chip8);
+	// Copies a lane back out, e.g. to hash it or to hand it to the GUI
+	void Store(unsigned int lane, Chip8& chip8) const;
+	void SetActive(unsigned int lane, bool active);
+	// Keypad as one bit per key, see KeypadMask
+	void SetKeys(unsigned int lane, uint16_t mask) { keys[lane] = mask; }
+
+	// One instruction on every active lane
+	void Step();
+	void RunTimers();
+	// Headless stepping, same as Chip8::RunFrame
+	void RunFrame(unsigned int instructions);
+
+	uint16_t Pc(unsigned int lane) const { return pc[lane]; }
+	uint64_t Cycles(unsigned int lane) const { return cycles[lane]; }
+	const uint8_t* Register(unsigned int index) const { return V[index]; }
+	uint8_t Ram(unsigned int lane, uint16_t addr) const { return ram[addr & (MEMORY_SIZE - 1)][lane]; }
+	// The lane stopped short of undefined behaviour and is inactive, see
+	// Chip8::outOfBounds
+	bool OutOfBounds(unsigned int lane) const { return outOfBounds[lane] != 0; }
+
+	uint32_t quirks = 0;
+
+	// Metrics: groups / steps is the average divergence, 1 when all lanes agree
+	uint64_t steps = 0;
+	uint64_t groups = 0;
+	uint64_t laneInstructions = 0;
+
+private:
+	typedef uint8_t Mask[LANES];
+
+	// m selects the group, all of whose lanes lie in [first, end)
+	void Execute(uint16_t op, const Mask m, unsigned int first, unsigned int end);
+	void Draw(uint16_t op, const Mask m, unsigned int first, unsigned int end);
+	// One instruction on every active lane, each on its own
+	void StepLanes();
+
+	static const unsigned int PIXELS = VIDEO_WIDTH * VIDEO_HEIGHT;
+	// A step with more than LANES / DIVERGED_FRACTION groups sends the next
+	// SCALAR_STEPS steps through StepLanes
+	static const unsigned int DIVERGED_FRACTION = 4;
+	static const unsigned int SCALAR_STEPS = 64;
+
+	alignas(64) uint8_t ram[MEMORY_SIZE][LANES];
+	alignas(64) uint8_t video[PIXELS][LANES];
+	alignas(64) uint8_t V[REGISTER_COUNT][LANES];
+	alignas(64) uint16_t stack[STACK_LEVELS][LANES];
+	alignas(64) uint16_t I[LANES];
+	alignas(64) uint16_t pc[LANES];
+	alignas(64) uint16_t sp[LANES];
+	alignas(64) uint16_t opcode[LANES];
+	alignas(64) uint8_t delayTimer[LANES];
+	alignas(64) uint8_t soundTimer[LANES];
+	alignas(64) uint16_t keys[LANES];
+	alignas(64) uint8_t active[LANES];
+	alignas(64) uint8_t outOfBounds[LANES];
+	alignas(64) uint64_t cycles[LANES];
+	alignas(64) uint64_t rngSeed[LANES];
+	alignas(64) uint64_t rngCounter[LANES];
+	// Steps left to run lane by lane
+	unsigned int scalarSteps = 0;
+};
+
+extern template class Lockstep<8>;
+extern template class Lockstep<16>;
+extern template class Lockstep<32>;
\ No newline at end of file
@@ -43,6 +43,10 @@ void processInput(GLFWwindow* window, Chip8* c) {
 	if(glfwGetKey(window, GLFW_KEY_ESCAPE) == 1)
 			glfwSetWindowShouldClose(window, true);
 
+	// A playing movie owns the keypad
+	if (c->player.IsPlaying())
+		return;
+
 	// 1 2 3 C -> 1 2 3 4
 	// 4 5 6 D -> Q W E R
 	// 7 8 9 E -> A S D F
@@ -129,20 +133,65 @@ void processInput(GLFWwindow* window, Chip8* c) {
 		c->keypad[0xF] = 0;
 }
 
+typedef std::chrono::steady_clock Clock;
+// 60Hz exactly, schedules count whole ticks from their start
+typedef std::chrono::duration<int64_t, std::ratio<1, 60>> Ticks;
+// A thread this far behind its schedule (a stall, a breakpoint) starts a
+// new one instead of catching up in a burst
+static const auto MAX_LAG = std::chrono::milliseconds(250);
+
 void GameThread(Chip8* c) {
-	// Gets the current time as a high resolution clock
-	auto lastCycle = std::chrono::high_resolution_clock::now();
+	XCHIP8_ZONE_THREAD("game");
+	auto nextCycle = Clock::now();
+	uint64_t tickCycles = c->cycles;
+#ifdef XCHIP8_PROFILE
+	// Counts this thread only, so it has to be opened here
+	PerfCounters counters;
+	c->hostCountersOpen = counters.Open();
+#endif
 
 	while (true) { // Keep Thread Alive
+		// Resuming starts the clock afresh
+		nextCycle = Clock::now();
 		while (c->isLoaded && c->isRunning) {
-			// Gets the current time as a high resolution clock
-			auto currTime = std::chrono::high_resolution_clock::now();
-			// Compares the clock to the clock of the last cycle
-			float deltaTime = std::chrono::duration<float, std::chrono::microseconds::period>(currTime - lastCycle).count();
+			auto currTime = Clock::now();
+
+			// Timer ticks land on instruction boundaries so movies can key them by instruction count
+			while (c->pendingTicks > 0) {
+				--c->pendingTicks;
+				// A ROM load restarts the count
+				c->pacing.Add(PACE_TICK_INSTRUCTIONS, c->cycles >= tickCycles ? c->cycles - tickCycles : c->cycles);
+				tickCycles = c->cycles;
+#ifdef XCHIP8_PROFILE
+				// A frame of the core is a timer tick
+				c->hostCounters.Frame(c->cycles);
+#endif
+				if (c->player.IsPlaying())
+					continue; // the movie carries its own ticks
+				c->RunTimers();
+				if (c->recorder.IsRecording())
+					c->recorder.Tick(c);
+			}
 
-			if (deltaTime > c->cycleDelay) {
-				lastCycle = currTime;
+			if (currTime >= nextCycle) {
+				XCHIP8_ZONE("RunCycle");
+				// Advance the schedule rather than restart it from now, so the
+				// overshoot of this cycle comes off the next one
+				nextCycle += std::chrono::microseconds(c->cycleDelay);
+				if (currTime - nextCycle > MAX_LAG)
+					nextCycle = currTime;
+				if (c->player.IsPlaying())
+					c->player.Apply(c);
+				else if (c->recorder.IsRecording())
+					c->recorder.Sample(c);
+#ifdef XCHIP8_PROFILE
+				// Only the instruction itself, not the spin-wait around it
+				c->hostCounters.Begin(counters);
+#endif
 				c->RunCycle();
+#ifdef XCHIP8_PROFILE
+				c->hostCounters.End(counters);
+#endif
 			}
 		}
 		//std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -150,24 +199,32 @@ void GameThread(Chip8* c) {
 }
 
 void TimerThread(Chip8* c)  {
-	// Gets the current time as a high resolution clock
-	auto lastCycle = std::chrono::high_resolution_clock::now();
-
 	while (true) { // Keep Thread Alive
+		// Resuming starts a new schedule
+		auto start = Clock::now();
+		auto lastTick = start;
+		int64_t ticks = 0;
 		while (c->isLoaded && c->isRunning) {
-			// Gets the current time as a high resolution clock
-			auto currTime = std::chrono::high_resolution_clock::now();
-			// Compares the clock to the clock of the last cycle
-			float deltaTime = std::chrono::duration<float, std::chrono::microseconds::period>(currTime - lastCycle).count();
+			auto currTime = Clock::now();
 			
 			if (c->soundTimer == 1)
 				c->shouldBeep = true;
 			else if (c->soundTimer == 0)
 				c->shouldBeep = false;
 
-			if (deltaTime > 16330) { // 16.33ms
-				lastCycle = currTime;
-				c->RunTimers();
+			// Due times come from the tick count, so lateness never accumulates
+			auto due = start + std::chrono::duration_cast<Clock::duration>(Ticks(ticks + 1));
+			if (currTime >= due) {
+				++ticks;
+				++c->pendingTicks;
+				c->pacing.Add(PACE_TICK_INTERVAL, std::chrono::duration_cast<std::chrono::microseconds>(currTime - lastTick).count());
+				c->pacing.Add(PACE_TICK_LATENESS, std::chrono::duration_cast<std::chrono::microseconds>(currTime - due).count());
+				lastTick = currTime;
+				if (currTime - due > MAX_LAG) {
+					c->pacing.skippedTicks += std::chrono::duration_cast<Ticks>(currTime - due).count();
+					start = currTime;
+					ticks = 0;
+				}
 			}
 		}
 		//std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -254,8 +311,15 @@ int run() {
 	std::thread timers(TimerThread, &chip8);
 	std::thread sound(SoundThread, &chip8);
 
+	// Present intervals are judged against the monitor's refresh
+	const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	const uint64_t refreshUs = 1000000 / (mode && mode->refreshRate > 0 ? mode->refreshRate : 60);
+	auto lastPresent = Clock::now();
+
+	XCHIP8_ZONE_THREAD("render");
 	// Render loop
 	while (!glfwWindowShouldClose(window)) {
+		XCHIP8_ZONE("Frame");
 		// Input - Old, replaced with callback
 		processInput(window, &chip8);
 
@@ -271,13 +335,20 @@ int run() {
 		glfwGetWindowSize(window, &width, &height);
 		chip8.RunMenu(width, height);
 
-		// Render ImGui
-		ImGui::Render();
-		// Render the window
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		{
+			XCHIP8_ZONE("ImGui Render");
+			// Render ImGui
+			ImGui::Render();
+			// Render the window
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		}
 
-		// Swap buffers and poll IO events
+		// Swap buffers and poll IO events, the swap waits for vsync
+		XCHIP8_ZONE("SwapBuffers");
 		glfwSwapBuffers(window);
+		auto present = Clock::now();
+		chip8.pacing.Present(std::chrono::duration_cast<std::chrono::microseconds>(present - lastPresent).count(), refreshUs);
+		lastPresent = present;
 		glfwPollEvents();
 	}
 
@@ -0,0 +1,229 @@
+#include "movie.h"
+#include "chip8.h"
+#include "hash.h"
+#include "statefile.h"
+// Error Output
+#include <iostream>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static const char MOVIE_MAGIC[4] = { 'X', 'C', '8', 'M' };
+
+// Event kinds
+const uint64_t MOVIE_TICK = 0;
+const uint64_t MOVIE_KEYS = 1;
+
+void Movie::Clear() {
+	romHash = 0;
+	seed = 0;
+	quirks = 0;
+	length = 0;
+	events.clear();
+}
+
+bool Movie::Save(const char* path) const {
+	MovieHeader header;
+	memcpy(header.magic, MOVIE_MAGIC, sizeof(header.magic));
+	header.version = MOVIE_VERSION;
+	header.flags = 0;
+	header.quirks = quirks;
+	header.eventBytes = static_cast<uint32_t>(events.size());
+	header.romHash = romHash;
+	header.seed = seed;
+	header.length = length;
+	header.checksum = Hash64(events.data(), events.size());
+
+	std::vector<uint8_t> file(sizeof(header) + events.size());
+	memcpy(file.data(), &header, sizeof(header));
+	if (!events.empty())
+		memcpy(file.data() + sizeof(header), events.data(), events.size());
+	return WriteFileAtomic(path, file.data(), file.size());
+}
+
+bool Movie::Load(const char* path) {
+	std::ifstream is(path, std::ios::in | std::ios::binary);
+	std::vector<char> file(
+		(std::istreambuf_iterator<char>(is)),
+		std::istreambuf_iterator<char>()
+	);
+	is.close();
+
+	MovieHeader header;
+	if (file.size() < sizeof(header)) {
+		std::cout << "Failed to read movie " << path << std::endl;
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, MOVIE_MAGIC, sizeof(header.magic)) != 0 || header.version != MOVIE_VERSION) {
+		std::cout << path << " is not a supported movie" << std::endl;
+		return false;
+	}
+	if (header.eventBytes != file.size() - sizeof(header)
+		|| Hash64(file.data() + sizeof(header), header.eventBytes) != header.checksum) {
+		std::cout << "Movie " << path << " is corrupt" << std::endl;
+		return false;
+	}
+
+	romHash = header.romHash;
+	seed = header.seed;
+	quirks = header.quirks;
+	length = header.length;
+	events.assign(file.begin() + sizeof(header), file.end());
+	return true;
+}
+
+uint16_t KeypadMask(const uint8_t* keypad) {
+	uint16_t mask = 0;
+	for (unsigned int i = 0; i < KEY_COUNT; i++) {
+		mask |= (keypad[i] ? 1u : 0u) << i;
+	}
+	return mask;
+}
+
+#pragma region Recorder
+void MovieRecorder::Start(Chip8* c, Movie* m, uint64_t seed) {
+	c->Boot();
+	c->Seed(seed);
+
+	movie = m;
+	movie->Clear();
+	movie->romHash = c->romHash;
+	movie->seed = seed;
+	movie->quirks = c->quirks;
+	lastEvent = 0;
+	lastKeys = 0;
+}
+
+void MovieRecorder::Sample(const Chip8* c) {
+	uint16_t mask = KeypadMask(c->keypad);
+	if (mask != lastKeys) {
+		Event(c, MOVIE_KEYS);
+		movie->events.push_back(mask & 0xFFu);
+		movie->events.push_back(mask >> 8u);
+		lastKeys = mask;
+	}
+}
+
+void MovieRecorder::Tick(const Chip8* c) {
+	Event(c, MOVIE_TICK);
+}
+
+void MovieRecorder::Event(const Chip8* c, uint64_t kind) {
+	uint64_t value = ((c->cycles - lastEvent) << 1) | kind;
+	lastEvent = c->cycles;
+
+	// LEB128
+	do {
+		uint8_t byte = value & 0x7Fu;
+		value >>= 7;
+		if (value)
+			byte |= 0x80u;
+		movie->events.push_back(byte);
+	} while (value);
+}
+
+void MovieRecorder::Stop(const Chip8* c) {
+	if (movie) {
+		movie->length = c->cycles;
+		movie = nullptr;
+	}
+}
+#pragma endregion
+
+#pragma region Player
+bool MoviePlayer::Start(Chip8* c, const Movie* m) {
+	if (m->romHash != c->romHash) {
+		std::cout << "Movie was recorded with a different ROM" << std::endl;
+		return false;
+	}
+
+	c->quirks = m->quirks;
+	c->Boot();
+	c->Seed(m->seed);
+
+	movie = m;
+	offset = 0;
+	nextAt = 0;
+	hasNext = Decode();
+	return true;
+}
+
+// Reads the event at offset, advancing offset and adding its delta to at
+static bool ReadEvent(const std::vector<uint8_t>& events, size_t& offset, uint64_t& at, uint64_t& kind, uint16_t& keys) {
+	uint64_t value = 0;
+	unsigned int shift = 0;
+	while (true) {
+		if (offset >= events.size() || shift > 63)
+			return false;
+		uint8_t byte = events[offset++];
+		value |= static_cast<uint64_t>(byte & 0x7Fu) << shift;
+		shift += 7;
+		if (!(byte & 0x80u))
+			break;
+	}
+
+	at += value >> 1;
+	kind = value & 1u;
+	if (kind == MOVIE_KEYS) {
+		if (offset + 2 > events.size())
+			return false;
+		keys = events[offset] | (events[offset + 1] << 8u);
+		offset += 2;
+	}
+	return true;
+}
+
+bool Movie::Decode(std::vector<MovieEvent>& out) const {
+	out.clear();
+	size_t offset = 0;
+	uint64_t at = 0, kind = 0;
+	uint16_t keys = 0;
+	while (offset < events.size()) {
+		if (!ReadEvent(events, offset, at, kind, keys))
+			return false;
+		out.push_back({ at, kind == MOVIE_TICK, keys });
+	}
+	return true;
+}
+
+bool MoviePlayer::Decode() {
+	return ReadEvent(movie->events, offset, nextAt, nextKind, nextKeys);
+}
+
+bool MoviePlayer::Apply(Chip8* c) {
+	if (!movie)
+		return false;
+
+	while (hasNext && nextAt <= c->cycles) {
+		if (nextKind == MOVIE_TICK) {
+			c->RunTimers();
+		} else {
+			for (unsigned int i = 0; i < KEY_COUNT; i++) {
+				c->keypad[i] = (nextKeys >> i) & 1u;
+			}
+		}
+		hasNext = Decode();
+	}
+
+	if (!hasNext && c->cycles >= movie->length) {
+		movie = nullptr;
+		return false;
+	}
+	return true;
+}
+
+uint64_t MoviePlayer::Run(Chip8* c, uint64_t limit) {
+	uint64_t start = c->cycles;
+	while (c->cycles < limit && Apply(c)) {
+		// Straight-line run up to the next event
+		uint64_t until = hasNext ? nextAt : movie->length;
+		if (until > limit)
+			until = limit;
+		while (c->cycles < until) {
+			c->RunCycle();
+		}
+	}
+	return c->cycles - start;
+}
+#pragma endregion
\ No newline at end of file
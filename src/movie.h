@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+class Chip8;
+
+const uint16_t MOVIE_VERSION = 2;
+
+// On-disk movie header, followed by eventBytes of encoded events.
+struct MovieHeader {
+	char magic[4];       // "XC8M"
+	uint16_t version;    // MOVIE_VERSION
+	uint16_t flags;
+	uint32_t quirks;     // Quirk profile the movie was recorded under
+	uint32_t eventBytes; // Size of the event stream
+	uint64_t romHash;    // Hash64 of the ROM image
+	uint64_t seed;       // RNG seed set right after boot
+	uint64_t length;     // Instructions executed over the whole recording
+	uint64_t checksum;   // Hash64 of the event stream
+};
+
+static_assert(sizeof(MovieHeader) == 48, "MovieHeader must stay fixed-layout");
+
+// One decoded event
+struct MovieEvent {
+	uint64_t at;   // Instruction count it applies at, before that instruction runs
+	bool tick;     // A timer tick, otherwise a keypad change
+	uint16_t keys; // Key mask of a keypad change
+};
+
+// A recorded session: everything needed to replay it bit-exactly from boot.
+// Events are keyed by instruction count. Each one is a LEB128 varint of
+// (instructions since the previous event << 1 | kind), kind 0 being a timer
+// tick and kind 1 a keypad change followed by the 16-bit key mask.
+class Movie {
+public:
+	uint64_t romHash = 0;
+	uint64_t seed = 0;
+	uint32_t quirks = 0;
+	uint64_t length = 0;
+	std::vector<uint8_t> events;
+
+	void Clear();
+	bool Save(const char* path) const;
+	bool Load(const char* path);
+	// The whole event stream at once, for driving engines other than Chip8
+	bool Decode(std::vector<MovieEvent>& out) const;
+};
+
+// Packs Chip8::keypad into one bit per key
+uint16_t KeypadMask(const uint8_t* keypad);
+
+class MovieRecorder {
+public:
+	// Boots the loaded ROM with the given seed and starts logging into movie
+	void Start(Chip8* chip8, Movie* movie, uint64_t seed);
+	// Call at every instruction boundary, before RunCycle
+	void Sample(const Chip8* chip8);
+	// Call whenever the timers are decremented
+	void Tick(const Chip8* chip8);
+	void Stop(const Chip8* chip8);
+
+	bool IsRecording() const { return movie != nullptr; }
+
+private:
+	void Event(const Chip8* chip8, uint64_t kind);
+
+	Movie* movie = nullptr;
+	uint64_t lastEvent = 0;
+	uint16_t lastKeys = 0;
+};
+
+class MoviePlayer {
+public:
+	// Boots the loaded ROM the way the movie was recorded, fails if the ROM differs
+	bool Start(Chip8* chip8, const Movie* movie);
+	// Applies every event due at the current instruction, call before RunCycle.
+	// Returns false once the movie has ended.
+	bool Apply(Chip8* chip8);
+	// Replays the rest of the movie as fast as the core goes, stopping early
+	// once chip8->cycles reaches limit. Returns the instructions executed.
+	uint64_t Run(Chip8* chip8, uint64_t limit = UINT64_MAX);
+	void Stop() { movie = nullptr; }
+
+	bool IsPlaying() const { return movie != nullptr; }
+
+private:
+	bool Decode();
+
+	const Movie* movie = nullptr;
+	size_t offset = 0;
+	// Next pending event
+	uint64_t nextAt = 0;
+	uint64_t nextKind = 0;
+	uint16_t nextKeys = 0;
+	bool hasNext = false;
+};
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "pacing.h"
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#pragma region PacingHistogram
+// Values below SUB_BUCKETS get a bucket each, above that the four bits
+// below the leading one pick the bucket within its power of two
+unsigned int PacingHistogram::BucketOf(uint64_t value) {
+	if (value < SUB_BUCKETS)
+		return static_cast<unsigned int>(value);
+	unsigned int exponent = static_cast<unsigned int>(std::bit_width(value)) - 1;
+	unsigned int mantissa = static_cast<unsigned int>(value >> (exponent - 4)) & (SUB_BUCKETS - 1);
+	unsigned int bucket = SUB_BUCKETS * (exponent - 3) + mantissa;
+	return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+uint64_t PacingHistogram::BucketLow(unsigned int b) {
+	if (b < SUB_BUCKETS)
+		return b;
+	return static_cast<uint64_t>(SUB_BUCKETS + b % SUB_BUCKETS) << (b / SUB_BUCKETS - 1);
+}
+
+void PacingHistogram::Add(uint64_t value) {
+	buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+	if (value > max.load(std::memory_order_relaxed))
+		max.store(value, std::memory_order_relaxed);
+	double v = static_cast<double>(value);
+	sum.store(sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+	sumSquares.store(sumSquares.load(std::memory_order_relaxed) + v * v, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_release);
+}
+
+void PacingHistogram::Clear() {
+	for (std::atomic<uint64_t>& bucket : buckets) {
+		bucket.store(0, std::memory_order_relaxed);
+	}
+	count.store(0, std::memory_order_relaxed);
+	max.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	sumSquares.store(0, std::memory_order_relaxed);
+}
+
+double PacingHistogram::Mean() const {
+	uint64_t n = Count();
+	return n ? sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+double PacingHistogram::Stddev() const {
+	uint64_t n = Count();
+	if (n < 2)
+		return 0;
+	double mean = sum.load(std::memory_order_relaxed) / n;
+	double variance = sumSquares.load(std::memory_order_relaxed) / n - mean * mean;
+	return variance > 0 ? std::sqrt(variance) : 0;
+}
+
+double PacingHistogram::Percentile(double p) const {
+	uint64_t n = Count();
+	if (!n)
+		return 0;
+	uint64_t rank = static_cast<uint64_t>(std::ceil(p * n));
+	uint64_t seen = 0;
+	for (unsigned int b = 0; b < BUCKETS; b++) {
+		seen += Bucket(b);
+		if (seen >= rank) {
+			// The top bucket has no upper bound but the largest value
+			uint64_t high = b + 1 < BUCKETS ? BucketLow(b + 1) - 1 : Max();
+			return static_cast<double>(high < Max() ? high : Max());
+		}
+	}
+	return static_cast<double>(Max());
+}
+#pragma endregion
+
+#pragma region PacingStats
+static const char* seriesNames[PACE_SERIES_COUNT] = {
+	"tick_interval_us", "tick_lateness_us", "tick_instructions", "present_interval_us"
+};
+
+const char* PacingSeriesName(PacingSeries series) {
+	return series < PACE_SERIES_COUNT ? seriesNames[series] : "?";
+}
+
+void PacingStats::Present(uint64_t intervalUs, uint64_t refreshUs) {
+	Add(PACE_PRESENT_INTERVAL, intervalUs);
+	// Half a refresh of slack for vsync jitter
+	if (refreshUs && intervalUs > refreshUs + refreshUs / 2)
+		droppedFrames.fetch_add((intervalUs + refreshUs / 2) / refreshUs - 1, std::memory_order_relaxed);
+}
+
+void PacingStats::Clear() {
+	for (PacingHistogram& histogram : series) {
+		histogram.Clear();
+	}
+	skippedTicks.store(0, std::memory_order_relaxed);
+	droppedFrames.store(0, std::memory_order_relaxed);
+}
+
+bool PacingStats::WriteCsv(const char* path) const {
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	fprintf(f, "# skipped_ticks=%llu dropped_frames=%llu measured_ips=%.1f\n",
+		static_cast<unsigned long long>(skippedTicks.load()), static_cast<unsigned long long>(droppedFrames.load()), MeasuredIps());
+	fprintf(f, "series,kind,low,high,count,mean,stddev,p50,p99,max\n");
+	for (unsigned int s = 0; s < PACE_SERIES_COUNT; s++) {
+		const PacingHistogram& h = series[s];
+		fprintf(f, "%s,summary,,,%llu,%.3f,%.3f,%.0f,%.0f,%llu\n", seriesNames[s], static_cast<unsigned long long>(h.Count()),
+			h.Mean(), h.Stddev(), h.Percentile(0.5), h.Percentile(0.99), static_cast<unsigned long long>(h.Max()));
+		for (unsigned int b = 0; b < PacingHistogram::BUCKETS; b++) {
+			if (!h.Bucket(b))
+				continue;
+			uint64_t high = b + 1 < PacingHistogram::BUCKETS ? PacingHistogram::BucketLow(b + 1) - 1 : h.Max();
+			fprintf(f, "%s,bucket,%llu,%llu,%llu,,,,,\n", seriesNames[s], static_cast<unsigned long long>(PacingHistogram::BucketLow(b)),
+				static_cast<unsigned long long>(high), static_cast<unsigned long long>(h.Bucket(b)));
+		}
+	}
+	if (fclose(f) != 0) {
+		std::cout << "Failed to write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+#pragma endregion
\ No newline at end of file
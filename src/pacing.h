@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Frame pacing statistics of the GUI: how regularly the timer thread ticks,
+// how many instructions land between ticks and how regularly frames reach
+// the screen. Each series has one writer thread and is read by the overlay
+// without locks.
+
+// Histogram with sixteen buckets per power of two: exact below 32, within
+// 6.25% above, up to 2^23 (about eight seconds in microseconds)
+class PacingHistogram {
+public:
+	static const unsigned int SUB_BUCKETS = 16;
+	static const unsigned int BUCKETS = 20 * SUB_BUCKETS;
+
+	void Add(uint64_t value);
+	void Clear();
+
+	uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+	uint64_t Bucket(unsigned int b) const { return buckets[b].load(std::memory_order_relaxed); }
+	uint64_t Max() const { return max.load(std::memory_order_relaxed); }
+	double Mean() const;
+	double Stddev() const;
+	// Upper bound of the bucket holding the p-th fraction of the values
+	double Percentile(double p) const;
+
+	// Smallest value that lands in bucket b
+	static uint64_t BucketLow(unsigned int b);
+	static unsigned int BucketOf(uint64_t value);
+
+private:
+	std::atomic<uint64_t> buckets[BUCKETS] = {};
+	std::atomic<uint64_t> count{ 0 };
+	std::atomic<uint64_t> max{ 0 };
+	// Written by the single writer only, so plain load/store is enough
+	std::atomic<double> sum{ 0 };
+	std::atomic<double> sumSquares{ 0 };
+};
+
+enum PacingSeries : uint8_t {
+	PACE_TICK_INTERVAL,      // µs between 60Hz timer ticks
+	PACE_TICK_LATENESS,      // µs a tick was raised after it was due
+	PACE_TICK_INSTRUCTIONS,  // Guest instructions between two ticks
+	PACE_PRESENT_INTERVAL,   // µs between buffer swaps
+	PACE_SERIES_COUNT
+};
+
+const char* PacingSeriesName(PacingSeries series);
+
+struct PacingStats {
+	PacingHistogram series[PACE_SERIES_COUNT];
+	// Ticks given up after a stall rather than delivered in a burst
+	std::atomic<uint64_t> skippedTicks{ 0 };
+	// Refreshes a present took longer than one refresh interval to arrive
+	std::atomic<uint64_t> droppedFrames{ 0 };
+
+	void Add(PacingSeries s, uint64_t value) { series[s].Add(value); }
+	// A present interval against the display's refresh interval, both in µs
+	void Present(uint64_t intervalUs, uint64_t refreshUs);
+	void Clear();
+	// Guest instructions per second, from the instructions between ticks
+	double MeasuredIps() const { return series[PACE_TICK_INSTRUCTIONS].Mean() * 60; }
+
+	// One row per non-empty bucket, after a summary row per series
+	bool WriteCsv(const char* path) const;
+};
\ No newline at end of file
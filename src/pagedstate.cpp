@@ -0,0 +1,123 @@
+#include "pagedstate.h"
+#include "chip8.h"
+#include <atomic>
+#include <cstring>
+
+static_assert(PagedState::RAM_PAGES * PagedState::PAGE_SIZE == MEMORY_SIZE, "RAM must split into whole pages");
+static_assert(VIDEO_WIDTH * sizeof(uint32_t) == PagedState::PAGE_SIZE, "A video page is one row");
+static_assert(PagedState::VIDEO_PAGES == VIDEO_HEIGHT, "Video pages cover the screen");
+
+static std::atomic<uint64_t> nextPageId{ 1 };
+
+PagedState::PagePtr PagedState::Share(const uint8_t* bytes, uint64_t& coreId, bool dirty, const PagePtr* parentPage) {
+	if (!dirty && coreId) {
+		// Unchanged since it matched page coreId
+		if (parentPage && *parentPage && (*parentPage)->id == coreId)
+			return *parentPage;
+		// Same content as that page, so it may carry the same id
+		std::shared_ptr<Page> page = std::make_shared<Page>();
+		page->id = coreId;
+		memcpy(page->bytes, bytes, PAGE_SIZE);
+		return page;
+	}
+
+	std::shared_ptr<Page> page = std::make_shared<Page>();
+	page->id = nextPageId.fetch_add(1, std::memory_order_relaxed);
+	memcpy(page->bytes, bytes, PAGE_SIZE);
+	coreId = page->id;
+	return page;
+}
+
+void PagedState::Capture(Chip8& c, const PagedState* parent) {
+	if (parent && parent->Empty())
+		parent = nullptr;
+
+	for (unsigned int i = 0; i < RAM_PAGES; i++) {
+		bool dirty = (c.dirtyRam >> i) & 1u;
+		ram[i] = Share(c.ram + i * PAGE_SIZE, c.ramPageIds[i], dirty, parent ? &parent->ram[i] : nullptr);
+	}
+	for (unsigned int i = 0; i < VIDEO_PAGES; i++) {
+		bool dirty = (c.dirtyVideo >> i) & 1u;
+		video[i] = Share(reinterpret_cast<const uint8_t*>(c.video + i * VIDEO_WIDTH), c.videoPageIds[i], dirty, parent ? &parent->video[i] : nullptr);
+	}
+	c.dirtyRam = 0;
+	c.dirtyVideo = 0;
+
+	memcpy(regs.V, c.V, sizeof(regs.V));
+	memcpy(regs.stack, c.stack, sizeof(regs.stack));
+	memcpy(regs.keypad, c.keypad, sizeof(regs.keypad));
+	memcpy(regs.plane, c.plane, sizeof(regs.plane));
+	regs.opcode = c.opcode;
+	regs.I = c.I;
+	regs.pc = c.pc;
+	regs.sp = c.sp;
+	regs.delayTimer = c.delayTimer;
+	regs.soundTimer = c.soundTimer;
+	regs.cycles = c.cycles;
+	regs.rngSeed = c.rngSeed;
+	regs.rngCounter = c.rngCounter;
+	regs.memHash = c.memHash;
+	regs.outOfBounds = c.outOfBounds;
+}
+
+void PagedState::Restore(Chip8& c) const {
+	if (Empty())
+		return;
+
+	for (unsigned int i = 0; i < RAM_PAGES; i++) {
+		if (((c.dirtyRam >> i) & 1u) || c.ramPageIds[i] != ram[i]->id) {
+			memcpy(c.ram + i * PAGE_SIZE, ram[i]->bytes, PAGE_SIZE);
+			c.ramPageIds[i] = ram[i]->id;
+		}
+	}
+	for (unsigned int i = 0; i < VIDEO_PAGES; i++) {
+		if (((c.dirtyVideo >> i) & 1u) || c.videoPageIds[i] != video[i]->id) {
+			memcpy(c.video + i * VIDEO_WIDTH, video[i]->bytes, PAGE_SIZE);
+			c.videoPageIds[i] = video[i]->id;
+		}
+	}
+	c.dirtyRam = 0;
+	c.dirtyVideo = 0;
+
+	memcpy(c.V, regs.V, sizeof(regs.V));
+	memcpy(c.stack, regs.stack, sizeof(regs.stack));
+	memcpy(c.keypad, regs.keypad, sizeof(regs.keypad));
+	memcpy(c.plane, regs.plane, sizeof(regs.plane));
+	c.opcode = regs.opcode;
+	c.I = regs.I;
+	c.pc = regs.pc;
+	c.sp = regs.sp;
+	c.delayTimer = regs.delayTimer;
+	c.soundTimer = regs.soundTimer;
+	c.cycles = regs.cycles;
+	c.rngSeed = regs.rngSeed;
+	c.rngCounter = regs.rngCounter;
+	c.memHash = regs.memHash;
+	c.outOfBounds = regs.outOfBounds;
+	c.pendingTicks = 0;
+}
+
+void PagedState::Clear() {
+	for (PagePtr& page : ram) {
+		page.reset();
+	}
+	for (PagePtr& page : video) {
+		page.reset();
+	}
+}
+
+unsigned int PagedState::OwnedPages() const {
+	unsigned int owned = 0;
+	for (const PagePtr& page : ram) {
+		owned += page && page.use_count() == 1;
+	}
+	for (const PagePtr& page : video) {
+		owned += page && page.use_count() == 1;
+	}
+	return owned;
+}
+
+size_t PagedState::OwnedBytes() const {
+	// make_shared puts the control block next to each page
+	return sizeof(*this) + OwnedPages() * (sizeof(Page) + 2 * sizeof(void*) + 2 * sizeof(long));
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+class Chip8;
+
+// Copy-on-write snapshot of a core, for forking it thousands of times a
+// second in tree searches.
+// RAM and video are split into 256-byte pages held by
+// reference-counted pointers. Copying a PagedState copies only those
+// pointers, and capturing a child of a snapshot allocates only the pages the
+// core wrote since it was restored from the parent; the rest are shared.
+// The core itself keeps its flat arrays for the interpreter, it only notes
+// which page id each of its pages last matched and which pages the opcodes
+// (Fx33, Fx55, 00E0, Dxyn) have written since.
+class PagedState {
+public:
+	static const unsigned int PAGE_SIZE = 256;
+	// 4096 bytes of RAM
+	static const unsigned int RAM_PAGES = 16;
+	// One 64-pixel row of video each
+	static const unsigned int VIDEO_PAGES = 32;
+
+	struct Page {
+		// Unique per page content, never reused
+		uint64_t id;
+		uint8_t bytes[PAGE_SIZE];
+	};
+	typedef std::shared_ptr<const Page> PagePtr;
+
+	// Snapshots chip8. Pages it has not written since they matched parent's
+	// are shared with parent instead of copied.
+	void Capture(Chip8& chip8, const PagedState* parent = nullptr);
+	// Makes chip8 equal to the snapshot, copying only the pages that differ
+	void Restore(Chip8& chip8) const;
+	void Clear();
+	bool Empty() const { return !ram[0]; }
+
+	// Pages nobody else holds, and the bytes this snapshot adds on top of
+	// the ones it shares
+	unsigned int OwnedPages() const;
+	size_t OwnedBytes() const;
+
+private:
+	struct Registers {
+		uint8_t V[16];
+		uint16_t stack[16];
+		uint8_t keypad[16];
+		uint64_t plane[32];
+		uint16_t opcode;
+		uint16_t I;
+		uint16_t pc;
+		uint16_t sp;
+		uint8_t delayTimer;
+		uint8_t soundTimer;
+		uint64_t cycles;
+		uint64_t rngSeed;
+		uint64_t rngCounter;
+		uint64_t memHash;
+		bool outOfBounds;
+	};
+
+	static PagePtr Share(const uint8_t* bytes, uint64_t& coreId, bool dirty, const PagePtr* parentPage);
+
+	PagePtr ram[RAM_PAGES];
+	PagePtr video[VIDEO_PAGES];
+	Registers regs;
+};
\ No newline at end of file
@@ -0,0 +1,23 @@
+#include "palette.h"
+
+uint32_t GetColoredPixel(uint32_t video, uint32_t fg, uint32_t bg) {
+	uint32_t select = 0;
+	// Video byte 3 - i decides output byte i
+	for (unsigned int i = 0; i < 4; i++) {
+		if (((video >> (24 - 8 * i)) & 0xFFu) == 0xFFu)
+			select |= 0xFFu << (8 * i);
+	}
+	return (fg & select) | (bg & ~select);
+}
+
+void ColorizeVideo(const uint32_t* video, uint32_t* out, size_t count, uint32_t fg, uint32_t bg) {
+	for (size_t i = 0; i < count; i++) {
+		// Pixels are all on or all off, anything else takes the slow path
+		if (video[i] == 0xFFFFFFFFu)
+			out[i] = fg;
+		else if (video[i] == 0)
+			out[i] = bg;
+		else
+			out[i] = GetColoredPixel(video[i], fg, bg);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Colour conversion for the display texture, kept free of ImGui so the
+// headless tools can benchmark it.
+// Colours are packed the way the texture wants them: 0xAABBGGRR, red in the
+// low byte.
+
+// Packs a colour with components in [0, 1], e.g. an ImVec4's x, y, z, w
+inline uint32_t PackColor(float r, float g, float b, float a) {
+	return static_cast<uint32_t>(static_cast<uint8_t>(r * 255))
+		| (static_cast<uint32_t>(static_cast<uint8_t>(g * 255)) << 8)
+		| (static_cast<uint32_t>(static_cast<uint8_t>(b * 255)) << 16)
+		| (static_cast<uint32_t>(static_cast<uint8_t>(a * 255)) << 24);
+}
+
+// B/W -> Color Conversion
+// Each byte of video (0xRRGGBBAA) picks its channel from fg when it is 0xFF
+// and from bg otherwise, flipping the pixel to 0xAABBGGRR along the way.
+uint32_t GetColoredPixel(uint32_t video, uint32_t fg, uint32_t bg);
+
+// Converts a whole framebuffer, the CPU half of preparing the texture
+void ColorizeVideo(const uint32_t* video, uint32_t* out, size_t count, uint32_t fg, uint32_t bg);
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include "perfcounters.h"
+#include <iostream>
+#if defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* counterNames[PERF_COUNTER_COUNT] = {
+	"cycles", "instructions", "branches", "branch-misses", "L1d-misses"
+};
+
+const char* PerfCounterName(PerfCounter counter) {
+	return counter < PERF_COUNTER_COUNT ? counterNames[counter] : "?";
+}
+
+#pragma region PerfSample
+PerfSample PerfSample::Since(const PerfSample& earlier) const {
+	PerfSample delta;
+	delta.valid = valid & earlier.valid;
+	for (unsigned int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		// Scaling for multiplexing can make a total step back slightly
+		delta.values[i] = values[i] > earlier.values[i] ? values[i] - earlier.values[i] : 0;
+	}
+	return delta;
+}
+
+void PerfSample::Add(const PerfSample& delta) {
+	valid = delta.valid;
+	for (unsigned int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		values[i] += delta.values[i];
+	}
+}
+
+double PerfSample::Ipc() const {
+	if (!Has(PERF_CYCLES) || !Has(PERF_INSTRUCTIONS) || !values[PERF_CYCLES])
+		return 0;
+	return static_cast<double>(values[PERF_INSTRUCTIONS]) / values[PERF_CYCLES];
+}
+
+double PerfSample::BranchMissRate() const {
+	if (!Has(PERF_BRANCHES) || !Has(PERF_BRANCH_MISSES) || !values[PERF_BRANCHES])
+		return 0;
+	return static_cast<double>(values[PERF_BRANCH_MISSES]) / values[PERF_BRANCHES];
+}
+#pragma endregion
+
+#pragma region PerfCounters
+PerfCounters::~PerfCounters() {
+	Close();
+}
+
+#if defined(__linux__)
+static int OpenCounter(uint32_t type, uint64_t config, int group) {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	// The group starts disabled and is enabled as a whole once complete
+	attr.disabled = group < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// This thread, any CPU
+	return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+
+bool PerfCounters::Open() {
+	Close();
+	static const struct { uint32_t type; uint64_t config; } events[PERF_COUNTER_COUNT] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	};
+
+	leader = OpenCounter(events[PERF_CYCLES].type, events[PERF_CYCLES].config, -1);
+	if (leader < 0) {
+		std::cout << "Failed to open hardware counters: " << strerror(errno) << std::endl;
+		return false;
+	}
+	fds[PERF_CYCLES] = leader;
+	order[opened++] = PERF_CYCLES;
+	for (unsigned int i = PERF_CYCLES + 1; i < PERF_COUNTER_COUNT; i++) {
+		fds[i] = OpenCounter(events[i].type, events[i].config, leader);
+		if (fds[i] >= 0)
+			order[opened++] = static_cast<PerfCounter>(i);
+		else
+			std::cout << "Hardware counter " << counterNames[i] << " unavailable: " << strerror(errno) << std::endl;
+	}
+
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+}
+
+void PerfCounters::Close() {
+	for (int& fd : fds) {
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+	leader = -1;
+	opened = 0;
+}
+
+bool PerfCounters::Read(PerfSample& sample) const {
+	sample = PerfSample();
+	if (leader < 0)
+		return false;
+	// nr, time enabled, time running, then one value per counter
+	uint64_t data[3 + PERF_COUNTER_COUNT];
+	ssize_t size = read(leader, data, sizeof(data));
+	if (size < static_cast<ssize_t>(3 * sizeof(uint64_t)) || data[0] != opened)
+		return false;
+	uint64_t enabled = data[1], running = data[2];
+	for (unsigned int i = 0; i < opened; i++) {
+		uint64_t value = data[3 + i];
+		if (running && running < enabled)
+			value = static_cast<uint64_t>(static_cast<double>(value) * enabled / running);
+		sample.values[order[i]] = value;
+		sample.valid |= 1u << order[i];
+	}
+	return true;
+}
+#else
+bool PerfCounters::Open() {
+	std::cout << "Hardware counters are only supported on Linux" << std::endl;
+	return false;
+}
+
+void PerfCounters::Close() {
+	leader = -1;
+	opened = 0;
+}
+
+bool PerfCounters::Read(PerfSample& sample) const {
+	sample = PerfSample();
+	return false;
+}
+#endif
+#pragma endregion
+
+#pragma region PerfFrameStats
+void PerfFrameStats::Begin(const PerfCounters& counters) {
+	inSpan = counters.Read(spanStart);
+}
+
+void PerfFrameStats::End(const PerfCounters& counters) {
+	PerfSample now;
+	if (inSpan && counters.Read(now))
+		current.Add(now.Since(spanStart));
+	inSpan = false;
+}
+
+void PerfFrameStats::Frame(uint64_t guestCycles) {
+	// A frame without a single span has nothing to show
+	if (started && current.valid) {
+		last = current;
+		total.Add(last);
+		// The core resets its cycle count on a ROM load
+		guestLast = guestCycles >= previousGuest ? guestCycles - previousGuest : guestCycles;
+		guestTotal += guestLast;
+		frames++;
+	}
+	current = PerfSample();
+	previousGuest = guestCycles;
+	started = true;
+}
+
+void PerfFrameStats::Clear() {
+	last = PerfSample();
+	total = PerfSample();
+	frames = 0;
+	guestLast = 0;
+	guestTotal = 0;
+}
+#pragma endregion
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+
+// Host hardware counters around the emulation loop, through perf_event_open
+// on Linux. The counters belong to the thread that opened them and count
+// user space only, so they work with the default perf_event_paranoid. On
+// other platforms, or where the kernel or the VM offers no PMU, Open fails
+// and everything reads as zero.
+
+enum PerfCounter : uint8_t {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_BRANCHES,
+	PERF_BRANCH_MISSES,
+	PERF_L1D_MISSES, // L1 data cache read misses
+	PERF_COUNTER_COUNT
+};
+
+const char* PerfCounterName(PerfCounter counter);
+
+struct PerfSample {
+	uint64_t values[PERF_COUNTER_COUNT] = {};
+	// Bit per PerfCounter that could be opened
+	uint32_t valid = 0;
+
+	bool Has(PerfCounter counter) const { return (valid >> counter) & 1u; }
+	uint64_t operator[](PerfCounter counter) const { return values[counter]; }
+	// Counts between an earlier sample and this one
+	PerfSample Since(const PerfSample& earlier) const;
+	void Add(const PerfSample& delta);
+
+	// Host instructions per host cycle
+	double Ipc() const;
+	// Share of branches mispredicted
+	double BranchMissRate() const;
+};
+
+class PerfCounters {
+public:
+	PerfCounters() = default;
+	~PerfCounters();
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	// Starts counting on the calling thread. Succeeds if at least the cycle
+	// counter opened, the others are optional.
+	bool Open();
+	void Close();
+	bool IsOpen() const { return leader >= 0; }
+
+	// Running totals since Open, scaled up if the kernel had to multiplex
+	bool Read(PerfSample& sample) const;
+
+private:
+	int leader = -1;
+	int fds[PERF_COUNTER_COUNT] = { -1, -1, -1, -1, -1 };
+	// Opened counters in group read order
+	PerfCounter order[PERF_COUNTER_COUNT] = {};
+	unsigned int opened = 0;
+};
+
+// Per-frame view of a PerfCounters, fed from the thread that owns the
+// counters. Only what runs between Begin and End is counted, so a caller can
+// leave its pacing and waiting out of the numbers.
+struct PerfFrameStats {
+	PerfSample last;         // Counts of the last frame
+	PerfSample total;        // Since the last Clear
+	uint64_t frames = 0;
+	uint64_t guestLast = 0;  // Guest instructions in the last frame
+	uint64_t guestTotal = 0;
+
+	void Begin(const PerfCounters& counters);
+	void End(const PerfCounters& counters);
+	// Closes the frame that started at the previous call
+	void Frame(uint64_t guestCycles);
+	void Clear();
+
+private:
+	PerfSample spanStart;
+	PerfSample current;      // Spans counted since the last Frame
+	bool inSpan = false;
+	uint64_t previousGuest = 0;
+	bool started = false;
+};
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include "png.h"
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+static uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+	static uint32_t table[256];
+	static bool init = [] {
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) {
+				c = (c & 1u) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			table[n] = c;
+		}
+		return true;
+	}();
+	(void)init;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table[(crc ^ data[i]) & 0xFFu] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static void PutBE32(std::vector<uint8_t>& out, uint32_t value) {
+	out.push_back(static_cast<uint8_t>(value >> 24));
+	out.push_back(static_cast<uint8_t>(value >> 16));
+	out.push_back(static_cast<uint8_t>(value >> 8));
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+// Length, type, data, then the CRC of type and data
+static void PutChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+	PutBE32(out, static_cast<uint32_t>(data.size()));
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	PutBE32(out, Crc32(&out[start], out.size() - start));
+}
+
+bool WritePng(const char* path, const uint32_t* pixels, unsigned int width, unsigned int height) {
+	// Filter byte 0 (none) in front of every row of RGBA
+	std::vector<uint8_t> raw;
+	raw.reserve((width * 4 + 1) * height);
+	for (unsigned int y = 0; y < height; y++) {
+		raw.push_back(0);
+		for (unsigned int x = 0; x < width; x++) {
+			uint32_t p = pixels[y * width + x];
+			raw.push_back(static_cast<uint8_t>(p));
+			raw.push_back(static_cast<uint8_t>(p >> 8));
+			raw.push_back(static_cast<uint8_t>(p >> 16));
+			raw.push_back(static_cast<uint8_t>(p >> 24));
+		}
+	}
+
+	// zlib stream of stored blocks, at most 65535 bytes each
+	std::vector<uint8_t> idat = { 0x78, 0x01 };
+	size_t offset = 0;
+	do {
+		size_t size = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+		bool last = offset + size == raw.size();
+		idat.push_back(last ? 1 : 0);
+		idat.push_back(static_cast<uint8_t>(size));
+		idat.push_back(static_cast<uint8_t>(size >> 8));
+		idat.push_back(static_cast<uint8_t>(~size));
+		idat.push_back(static_cast<uint8_t>(~size >> 8));
+		idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + size);
+		offset += size;
+	} while (offset < raw.size());
+	uint32_t a = 1, b = 0;
+	for (uint8_t byte : raw) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	PutBE32(idat, b << 16 | a);
+
+	std::vector<uint8_t> header;
+	PutBE32(header, width);
+	PutBE32(header, height);
+	// 8 bits per channel, RGBA, deflate, adaptive filtering, no interlace
+	header.insert(header.end(), { 8, 6, 0, 0, 0 });
+
+	std::vector<uint8_t> out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	PutChunk(out, "IHDR", header);
+	PutChunk(out, "IDAT", idat);
+	PutChunk(out, "IEND", {});
+
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+	ok = fclose(f) == 0 && ok;
+	if (!ok)
+		std::cout << "Failed to write " << path << std::endl;
+	return ok;
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Minimal PNG writer for diff images and screenshots, no image library
+// needed. The image data goes into stored (uncompressed) deflate blocks, so
+// files are large but the writer stays a few dozen lines.
+// pixels are width * height PackColor words (0xAABBGGRR), row by row.
+bool WritePng(const char* path, const uint32_t* pixels, unsigned int width, unsigned int height);
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include "profile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static const char* handlerNames[OPH_COUNT] = {
+	"NULL", "00E0", "00EE", "1nnn", "2nnn", "3xnn", "4xnn", "5xy0", "6xnn", "7xnn",
+	"8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7", "8xyE", "9xy0",
+	"Annn", "Bnnn", "Cxbb", "Dxyn", "ExA1", "Ex9E",
+	"Fx07", "Fx0A", "Fx15", "Fx18", "Fx1E", "Fx29", "Fx33", "Fx55", "Fx65"
+};
+
+// Top nibble of each handler's opcodes, NULL counted under 0
+static const uint8_t handlerFamilies[OPH_COUNT] = {
+	0x0, 0x0, 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7,
+	0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x9,
+	0xA, 0xB, 0xC, 0xD, 0xE, 0xE,
+	0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF
+};
+
+const char* OpHandlerName(OpHandler handler) {
+	return handler < OPH_COUNT ? handlerNames[handler] : "?";
+}
+
+OpHandler DecodeHandler(uint16_t opcode) {
+	// Mirrors the table set up in the Chip8 constructor
+	static const OpHandler top[16] = {
+		OPH_NULL, OPH_1nnn, OPH_2nnn, OPH_3xnn, OPH_4xnn, OPH_5xy0, OPH_6xnn, OPH_7xnn,
+		OPH_NULL, OPH_9xy0, OPH_Annn, OPH_Bnnn, OPH_Cxbb, OPH_Dxyn, OPH_NULL, OPH_NULL
+	};
+	switch (opcode >> 12u) {
+	case 0x0:
+		switch (opcode & 0x000Fu) {
+		case 0x0: return OPH_00E0;
+		case 0xE: return OPH_00EE;
+		}
+		return OPH_NULL;
+	case 0x8:
+		switch (opcode & 0x000Fu) {
+		case 0x0: return OPH_8xy0;
+		case 0x1: return OPH_8xy1;
+		case 0x2: return OPH_8xy2;
+		case 0x3: return OPH_8xy3;
+		case 0x4: return OPH_8xy4;
+		case 0x5: return OPH_8xy5;
+		case 0x6: return OPH_8xy6;
+		case 0x7: return OPH_8xy7;
+		case 0xE: return OPH_8xyE;
+		}
+		return OPH_NULL;
+	case 0xE:
+		switch (opcode & 0x000Fu) {
+		case 0x1: return OPH_ExA1;
+		case 0xE: return OPH_Ex9E;
+		}
+		return OPH_NULL;
+	case 0xF:
+		switch (opcode & 0x00FFu) {
+		case 0x07: return OPH_Fx07;
+		case 0x0A: return OPH_Fx0A;
+		case 0x15: return OPH_Fx15;
+		case 0x18: return OPH_Fx18;
+		case 0x1E: return OPH_Fx1E;
+		case 0x29: return OPH_Fx29;
+		case 0x33: return OPH_Fx33;
+		case 0x55: return OPH_Fx55;
+		case 0x65: return OPH_Fx65;
+		}
+		return OPH_NULL;
+	}
+	return top[opcode >> 12u];
+}
+
+void OpcodeProfile::Clear() {
+	memset(counts, 0, sizeof(counts));
+	memset(samples, 0, sizeof(samples));
+	memset(sampledCycles, 0, sizeof(sampledCycles));
+	countdown = 1;
+}
+
+uint64_t OpcodeProfile::Total() const {
+	uint64_t total = 0;
+	for (uint64_t n : counts) {
+		total += n;
+	}
+	return total;
+}
+
+uint64_t OpcodeProfile::FamilyCount(unsigned int family) const {
+	uint64_t total = 0;
+	for (unsigned int h = 0; h < OPH_COUNT; h++) {
+		if (handlerFamilies[h] == family)
+			total += counts[h];
+	}
+	return total;
+}
+
+bool OpcodeProfile::WriteCsv(const char* path) const {
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	uint64_t total = Total();
+	fprintf(f, "handler,family,count,share,samples,cycles_per_op\n");
+	for (unsigned int h = 0; h < OPH_COUNT; h++) {
+		fprintf(f, "%s,%X,%llu,%.6f,%llu,%.2f\n", handlerNames[h], handlerFamilies[h],
+			static_cast<unsigned long long>(counts[h]), total ? static_cast<double>(counts[h]) / total : 0.0,
+			static_cast<unsigned long long>(samples[h]), CyclesPerOp(static_cast<OpHandler>(h)));
+	}
+	return fclose(f) == 0;
+}
+
+void MemoryProfile::Clear() {
+	memset(exec, 0, sizeof(exec));
+	memset(reads, 0, sizeof(reads));
+	memset(writes, 0, sizeof(writes));
+}
+
+bool MemoryProfile::Save(const char* path, uint64_t romHash) const {
+	HeatmapHeader header = {};
+	memcpy(header.magic, "XC8H", 4);
+	header.version = HEATMAP_VERSION;
+	header.size = HEATMAP_SIZE;
+	header.romHash = romHash;
+
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(exec, sizeof(exec), 1, f) == 1
+		&& fwrite(reads, sizeof(reads), 1, f) == 1
+		&& fwrite(writes, sizeof(writes), 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+	if (!ok)
+		std::cout << "Failed to write " << path << std::endl;
+	return ok;
+}
+
+bool MemoryProfile::Load(const char* path, uint64_t* romHash) {
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	HeatmapHeader header;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 && !memcmp(header.magic, "XC8H", 4)
+		&& header.version == HEATMAP_VERSION && header.size == HEATMAP_SIZE
+		&& fread(exec, sizeof(exec), 1, f) == 1
+		&& fread(reads, sizeof(reads), 1, f) == 1
+		&& fread(writes, sizeof(writes), 1, f) == 1;
+	fclose(f);
+	if (!ok) {
+		std::cout << "Not a heatmap: " << path << std::endl;
+		Clear();
+		return false;
+	}
+	if (romHash)
+		*romHash = header.romHash;
+	return true;
+}
+
+void CallProfile::Clear() {
+	nodes.clear();
+	frames.clear();
+	sites.clear();
+	memset(onStack, 0, sizeof(onStack));
+	nodes.push_back({ ROOT, NONE, NONE, NONE, 0, 0 });
+	frames.push_back({ 0, last, ReadCycleCounter() });
+	lastHost = frames.back().enteredHost;
+	onStack[ROOT] = 1;
+	sites[ROOT].calls = 1;
+}
+
+void CallProfile::Charge(uint64_t now, uint64_t host) {
+	Node& node = nodes[frames.back().node];
+	CallSite& site = sites[node.addr];
+	node.self += now - last;
+	node.selfHost += host - lastHost;
+	site.exclusive += now - last;
+	site.exclusiveHost += host - lastHost;
+	last = now;
+	lastHost = host;
+}
+
+void CallProfile::Pop(uint64_t now, uint64_t host) {
+	Frame frame = frames.back();
+	frames.pop_back();
+	uint16_t addr = nodes[frame.node].addr;
+	if (--onStack[addr] == 0) {
+		CallSite& site = sites[addr];
+		site.inclusive += now - frame.enteredAt;
+		site.inclusiveHost += host - frame.enteredHost;
+	}
+}
+
+void CallProfile::Call(uint16_t target, unsigned int depth, uint64_t instructions) {
+	uint64_t now = Now(instructions), host = ReadCycleCounter();
+	Charge(now, host);
+	target &= 0x0FFFu;
+	while (frames.size() > 1 && frames.size() - 1 >= depth) {
+		Pop(now, host);
+	}
+
+	uint32_t parent = frames.back().node;
+	uint32_t child = nodes[parent].firstChild;
+	while (child != NONE && nodes[child].addr != target) {
+		child = nodes[child].nextSibling;
+	}
+	if (child == NONE) {
+		child = static_cast<uint32_t>(nodes.size());
+		nodes.push_back({ target, parent, NONE, nodes[parent].firstChild, 0, 0 });
+		nodes[parent].firstChild = child;
+	}
+	frames.push_back({ child, now, host });
+	onStack[target]++;
+	sites[target].calls++;
+}
+
+void CallProfile::Return(unsigned int depth, uint64_t instructions) {
+	uint64_t now = Now(instructions), host = ReadCycleCounter();
+	Charge(now, host);
+	while (frames.size() > 1 && frames.size() - 1 > depth) {
+		Pop(now, host);
+	}
+}
+
+std::vector<std::pair<uint16_t, CallSite>> CallProfile::Sites(uint64_t instructions) const {
+	uint64_t now = instructions + offset < last ? last : instructions + offset;
+	uint64_t host = ReadCycleCounter();
+	std::unordered_map<uint16_t, CallSite> open = sites;
+
+	// The frame on top has run since the last event
+	CallSite& top = open[nodes[frames.back().node].addr];
+	top.exclusive += now - last;
+	top.exclusiveHost += host - lastHost;
+	// Open frames count towards inclusive from their outermost entry
+	bool seen[ROOT + 1] = {};
+	for (const Frame& frame : frames) {
+		uint16_t addr = nodes[frame.node].addr;
+		if (seen[addr])
+			continue;
+		seen[addr] = true;
+		open[addr].inclusive += now - frame.enteredAt;
+		open[addr].inclusiveHost += host - frame.enteredHost;
+	}
+	return std::vector<std::pair<uint16_t, CallSite>>(open.begin(), open.end());
+}
+
+std::string CallProfile::Name(uint16_t addr) const {
+	if (addr == ROOT)
+		return "main";
+	auto it = labels.find(addr);
+	if (it != labels.end())
+		return it->second;
+	char name[16];
+	snprintf(name, sizeof(name), "sub_%03X", addr);
+	return name;
+}
+
+bool CallProfile::LoadLabels(const char* path) {
+	std::ifstream is(path);
+	if (!is) {
+		std::cout << "Failed to open labels " << path << std::endl;
+		return false;
+	}
+	std::string line;
+	while (std::getline(is, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream ls(line);
+		std::vector<std::string> tokens;
+		std::string token;
+		while (ls >> token) {
+			if (token != "=" && token != ":" && token != ":const" && token != ":alias")
+				tokens.push_back(token);
+		}
+		if (tokens.size() != 2)
+			continue;
+		std::string name = tokens[0][0] == ':' ? tokens[0].substr(1) : tokens[0];
+		const std::string& value = tokens[1];
+		char* end = nullptr;
+		unsigned long addr = value[0] == '$' ? strtoul(value.c_str() + 1, &end, 16) : strtoul(value.c_str(), &end, 0);
+		if (name.empty() || *end || addr >= ROOT)
+			continue;
+		labels[static_cast<uint16_t>(addr)] = name;
+	}
+	return true;
+}
+
+bool CallProfile::WriteFolded(const char* path, uint64_t instructions, bool hostCycles) const {
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	uint64_t now = instructions + offset < last ? last : instructions + offset;
+	uint64_t host = ReadCycleCounter();
+	uint32_t top = frames.back().node;
+	std::vector<std::string> names;
+	for (uint32_t n = 0; n < nodes.size(); n++) {
+		uint64_t count = hostCycles ? nodes[n].selfHost : nodes[n].self;
+		if (n == top)
+			count += hostCycles ? host - lastHost : now - last;
+		if (!count)
+			continue;
+		names.clear();
+		for (uint32_t p = n; p != NONE; p = nodes[p].parent) {
+			names.push_back(Name(nodes[p].addr));
+		}
+		std::string stack;
+		for (auto it = names.rbegin(); it != names.rend(); ++it) {
+			if (!stack.empty())
+				stack += ';';
+			stack += *it;
+		}
+		fprintf(f, "%s %llu\n", stack.c_str(), static_cast<unsigned long long>(count));
+	}
+	return fclose(f) == 0;
+}
\ No newline at end of file
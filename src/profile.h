@@ -0,0 +1,244 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Opcode execution profile: how often each handler of the dispatch tables
+// ran, and optionally what it cost in host cycles, plus a heatmap of guest
+// memory. Chip8 only keeps them in builds with XCHIP8_PROFILE, everywhere
+// else the counting compiles away.
+
+// One entry per handler the dispatch tables can reach, in table order
+enum OpHandler : uint8_t {
+	OPH_NULL, // Unassigned opcodes
+	OPH_00E0,
+	OPH_00EE,
+	OPH_1nnn,
+	OPH_2nnn,
+	OPH_3xnn,
+	OPH_4xnn,
+	OPH_5xy0,
+	OPH_6xnn,
+	OPH_7xnn,
+	OPH_8xy0,
+	OPH_8xy1,
+	OPH_8xy2,
+	OPH_8xy3,
+	OPH_8xy4,
+	OPH_8xy5,
+	OPH_8xy6,
+	OPH_8xy7,
+	OPH_8xyE,
+	OPH_9xy0,
+	OPH_Annn,
+	OPH_Bnnn,
+	OPH_Cxbb,
+	OPH_Dxyn,
+	OPH_ExA1,
+	OPH_Ex9E,
+	OPH_Fx07,
+	OPH_Fx0A,
+	OPH_Fx15,
+	OPH_Fx18,
+	OPH_Fx1E,
+	OPH_Fx29,
+	OPH_Fx33,
+	OPH_Fx55,
+	OPH_Fx65,
+	OPH_COUNT
+};
+
+const char* OpHandlerName(OpHandler handler);
+
+// The handler table/table0/table8/tableE/tableF dispatch opcode to
+OpHandler DecodeHandler(uint16_t opcode);
+
+// Host cycle counter: the TSC on x86, nanoseconds elsewhere
+inline uint64_t ReadCycleCounter() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+class OpcodeProfile {
+public:
+	void Count(uint16_t opcode) {
+		counts[DecodeHandler(opcode)]++;
+	}
+	// True when the next instruction should be timed, every samplePeriod-th
+	// one while sampleCycles is on. Timing every instruction would mostly
+	// measure the counter reads.
+	bool SampleNext() {
+		if (!sampleCycles || --countdown != 0)
+			return false;
+		countdown = samplePeriod ? samplePeriod : 1;
+		return true;
+	}
+	void AddSample(uint16_t opcode, uint64_t elapsed) {
+		OpHandler h = DecodeHandler(opcode);
+		samples[h]++;
+		sampledCycles[h] += elapsed;
+	}
+	void Clear();
+
+	uint64_t Total() const;
+	// Executions of the opcodes with this top nibble
+	uint64_t FamilyCount(unsigned int family) const;
+	// Mean host cycles per execution from the samples, 0 without any
+	double CyclesPerOp(OpHandler handler) const {
+		return samples[handler] ? static_cast<double>(sampledCycles[handler]) / samples[handler] : 0.0;
+	}
+
+	// handler,family,count,share,samples,cycles_per_op
+	bool WriteCsv(const char* path) const;
+
+	uint64_t counts[OPH_COUNT] = {};
+	uint64_t samples[OPH_COUNT] = {};
+	uint64_t sampledCycles[OPH_COUNT] = {};
+
+	bool sampleCycles = false;
+	unsigned int samplePeriod = 16;
+
+private:
+	unsigned int countdown = 1;
+};
+
+// Guest memory heatmap: instructions fetched at each address, and the data
+// reads and writes of Dxyn, Fx33, Fx55 and Fx65 per byte. Tells code from
+// data and shows where guest time goes, kept alongside OpcodeProfile.
+const unsigned int HEATMAP_SIZE = 4096;
+const uint16_t HEATMAP_VERSION = 1;
+
+// On-disk heatmap header, followed by the exec, reads and writes arrays,
+// HEATMAP_SIZE little-endian uint64_t each
+struct HeatmapHeader {
+	char magic[4];     // "XC8H"
+	uint16_t version;  // HEATMAP_VERSION
+	uint16_t flags;
+	uint32_t size;     // Entries per array, HEATMAP_SIZE
+	uint32_t reserved;
+	uint64_t romHash;  // Hash64 of the ROM the counts belong to
+};
+static_assert(sizeof(HeatmapHeader) == 24, "HeatmapHeader must stay fixed-layout");
+
+class MemoryProfile {
+public:
+	void Exec(unsigned int addr) {
+		exec[addr % HEATMAP_SIZE]++;
+	}
+	// count bytes from addr, clipped at the end of memory
+	void Read(unsigned int addr, unsigned int count) {
+		Touch(reads, addr, count);
+	}
+	void Write(unsigned int addr, unsigned int count) {
+		Touch(writes, addr, count);
+	}
+	void Clear();
+
+	bool Save(const char* path, uint64_t romHash) const;
+	bool Load(const char* path, uint64_t* romHash = nullptr);
+
+	uint64_t exec[HEATMAP_SIZE] = {};
+	uint64_t reads[HEATMAP_SIZE] = {};
+	uint64_t writes[HEATMAP_SIZE] = {};
+
+private:
+	static void Touch(uint64_t* counters, unsigned int addr, unsigned int count) {
+		for (unsigned int a = addr; a < addr + count && a < HEATMAP_SIZE; a++) {
+			counters[a]++;
+		}
+	}
+};
+
+// Guest call graph: a shadow call stack driven by 2nnn and 00EE, charging
+// guest instructions and host cycles to each subroutine. Exclusive cost is
+// what ran with the subroutine on top of the stack, inclusive also counts
+// its callees, once however deep it recurses. Code outside any subroutine
+// is charged to "main".
+struct CallSite {
+	uint64_t calls = 0;
+	uint64_t inclusive = 0;
+	uint64_t exclusive = 0;
+	uint64_t inclusiveHost = 0;
+	uint64_t exclusiveHost = 0;
+};
+
+class CallProfile {
+public:
+	// Pseudo address of the top level
+	static constexpr uint16_t ROOT = 0x1000;
+
+	CallProfile() { Clear(); }
+
+	// depth is the guest sp after the push or pop. The shadow stack follows
+	// it, so a reset or a savestate load that moves sp under the profile
+	// unwinds it instead of leaving stale frames.
+	// instructions is the guest instruction count, Chip8::cycles.
+	void Call(uint16_t target, unsigned int depth, uint64_t instructions);
+	void Return(unsigned int depth, uint64_t instructions);
+	void Clear();
+
+	// Per subroutine totals up to now, including the frames still open
+	std::vector<std::pair<uint16_t, CallSite>> Sites(uint64_t instructions) const;
+
+	// Octo-style symbols, one per line: "name address", "name = address" or
+	// ":const name address", addresses in decimal, 0x or $ hex; # comments
+	bool LoadLabels(const char* path);
+	std::string Name(uint16_t addr) const;
+
+	// One line per call path: "main;a;b count", for flamegraph.pl and
+	// speedscope. Counts are exclusive instructions, or host cycles.
+	bool WriteFolded(const char* path, uint64_t instructions, bool hostCycles = false) const;
+
+	std::unordered_map<uint16_t, std::string> labels;
+
+private:
+	// Call tree, one node per distinct path from the root
+	struct Node {
+		uint16_t addr;
+		uint32_t parent;
+		uint32_t firstChild;
+		uint32_t nextSibling;
+		uint64_t self;
+		uint64_t selfHost;
+	};
+	struct Frame {
+		uint32_t node;
+		uint64_t enteredAt;
+		uint64_t enteredHost;
+	};
+	static constexpr uint32_t NONE = ~0u;
+
+	// Monotonic instruction time: the core's count goes back on a reset or
+	// a restore, that gap is simply not charged to anyone
+	uint64_t Now(uint64_t instructions) {
+		uint64_t t = instructions + offset;
+		if (t < last) {
+			offset += last - t;
+			t = last;
+		}
+		return t;
+	}
+	// Charges the time since the last event to the frame on top
+	void Charge(uint64_t now, uint64_t host);
+	void Pop(uint64_t now, uint64_t host);
+
+	std::vector<Node> nodes;
+	std::vector<Frame> frames;
+	std::unordered_map<uint16_t, CallSite> sites;
+	// Frames of each subroutine open right now, so recursion counts once
+	uint16_t onStack[ROOT + 1];
+	uint64_t offset = 0;
+	uint64_t last = 0;
+	uint64_t lastHost = 0;
+};
\ No newline at end of file
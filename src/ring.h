@@ -0,0 +1,37 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Lock-free reads of a single producer ring, shared by TraceBuffer and
+// ZoneBuffer. The producer fills ring[h & mask] and only then publishes
+// head = h + 1, so while head reads h the slot also holding record
+// h - ring.size() may be half written.
+
+// Appends up to count of the newest records to out, oldest first, and
+// returns how many were added. Records the producer overwrote or was still
+// overwriting during the copy are left out.
+template<typename T>
+size_t RingRecent(const std::vector<T>& ring, uint64_t mask, const std::atomic<uint64_t>& head,
+	uint64_t count, std::vector<T>& out) {
+	uint64_t end = head.load(std::memory_order_acquire);
+	uint64_t n = std::min<uint64_t>({ count, end, ring.size() });
+	uint64_t start = end - n;
+	size_t first = out.size();
+	out.resize(first + n);
+	for (uint64_t i = 0; i < n; i++) {
+		out[first + i] = ring[(start + i) & mask];
+	}
+
+	// Keep the copy above ahead of the second look at head
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t now = head.load(std::memory_order_relaxed);
+	// With head at now, records up to now - size are gone or being replaced
+	if (now - start >= ring.size()) {
+		uint64_t stale = std::min<uint64_t>(now - start - ring.size() + 1, n);
+		out.erase(out.begin() + first, out.begin() + first + static_cast<size_t>(stale));
+	}
+	return out.size() - first;
+}
\ No newline at end of file
@@ -0,0 +1,516 @@
+#include "romgen.h"
+#include "hash.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+static const char* familyNames[ROM_FAMILY_COUNT] = { "alu", "call", "memory", "draw", "jump" };
+
+const char* RomFamilyName(RomFamily family) {
+	return family < ROM_FAMILY_COUNT ? familyNames[family] : "unknown";
+}
+
+bool ParseRomFamily(const char* text, RomFamily& family) {
+	for (unsigned int f = 0; f < ROM_FAMILY_COUNT; f++) {
+		if (!strcmp(text, familyNames[f])) {
+			family = static_cast<RomFamily>(f);
+			return true;
+		}
+	}
+	return false;
+}
+
+#pragma region Reference interpreter
+// A plain switch over the opcodes with the default quirk profile, written
+// apart from Chip8 on purpose. Behaviour of this interpreter it reproduces:
+// a sprite's position wraps but the sprite clips at the right and bottom
+// edges, only the rows drawn are read from I, and VF is written before the
+// result.
+bool ReferenceRun(const std::vector<uint8_t>& image, RomExpectation& e, uint64_t limit) {
+	uint8_t ram[MEMORY_SIZE] = {};
+	uint8_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT] = {};
+	uint8_t V[REGISTER_COUNT] = {};
+	uint16_t stack[STACK_LEVELS] = {};
+	uint16_t pc = START_ADDRESS, I = 0, sp = 0;
+	if (image.size() > MEMORY_SIZE - START_ADDRESS)
+		return false;
+	memcpy(ram + START_ADDRESS, image.data(), image.size());
+
+	// Reads below START_ADDRESS would need the font, none of the ROMs do
+	auto readable = [](unsigned int lo, unsigned int hi) {
+		return lo >= START_ADDRESS && hi <= MEMORY_SIZE;
+	};
+
+	for (uint64_t n = 1; n <= limit; n++) {
+		if (pc + 1u >= MEMORY_SIZE)
+			return false;
+		uint16_t op = static_cast<uint16_t>(ram[pc] << 8 | ram[pc + 1]);
+		uint16_t at = pc;
+		pc += 2;
+		unsigned int x = (op >> 8) & 0xFu, y = (op >> 4) & 0xFu, nn = op & 0xFFu, nnn = op & 0xFFFu;
+
+		switch (op >> 12) {
+		case 0x0:
+			if ((op & 0xFu) == 0x0) {
+				memset(pixels, 0, sizeof(pixels));
+			} else if ((op & 0xFu) == 0xE) {
+				if (sp == 0)
+					return false;
+				pc = stack[--sp];
+			}
+			break;
+		case 0x1:
+			pc = static_cast<uint16_t>(nnn);
+			if (nnn == at) {
+				e.instructions = n;
+				e.pc = pc;
+				e.I = I;
+				e.sp = sp;
+				memcpy(e.V, V, sizeof(V));
+				e.ramHash = Hash64(ram + START_ADDRESS, MEMORY_SIZE - START_ADDRESS);
+				uint64_t plane[VIDEO_HEIGHT] = {};
+				for (unsigned int i = 0; i < VIDEO_WIDTH * VIDEO_HEIGHT; i++) {
+					if (pixels[i])
+						plane[i / VIDEO_WIDTH] |= 1ull << (63 - i % VIDEO_WIDTH);
+				}
+				e.planeHash = Hash64(plane, sizeof(plane));
+				return true;
+			}
+			break;
+		case 0x2:
+			if (sp >= STACK_LEVELS)
+				return false;
+			stack[sp++] = pc;
+			pc = static_cast<uint16_t>(nnn);
+			break;
+		case 0x3:
+			pc += V[x] == nn ? 2 : 0;
+			break;
+		case 0x4:
+			pc += V[x] != nn ? 2 : 0;
+			break;
+		case 0x5:
+			pc += V[x] == V[y] ? 2 : 0;
+			break;
+		case 0x6:
+			V[x] = static_cast<uint8_t>(nn);
+			break;
+		case 0x7:
+			V[x] = static_cast<uint8_t>(V[x] + nn);
+			break;
+		case 0x8:
+			switch (op & 0xFu) {
+			case 0x0: V[x] = V[y]; break;
+			case 0x1: V[x] |= V[y]; break;
+			case 0x2: V[x] &= V[y]; break;
+			case 0x3: V[x] ^= V[y]; break;
+			case 0x4: {
+				unsigned int sum = V[x] + V[y];
+				V[0xF] = sum > 0xFFu;
+				V[x] = static_cast<uint8_t>(sum);
+				break;
+			}
+			case 0x5:
+				V[0xF] = V[x] > V[y];
+				V[x] = static_cast<uint8_t>(V[x] - V[y]);
+				break;
+			case 0x6:
+				V[0xF] = V[x] & 1u;
+				V[x] = static_cast<uint8_t>(V[x] >> 1);
+				break;
+			case 0x7:
+				V[0xF] = V[y] > V[x];
+				V[x] = static_cast<uint8_t>(V[y] - V[x]);
+				break;
+			case 0xE:
+				V[0xF] = V[x] >> 7;
+				V[x] = static_cast<uint8_t>(V[x] << 1);
+				break;
+			}
+			break;
+		case 0x9:
+			pc += V[x] != V[y] ? 2 : 0;
+			break;
+		case 0xA:
+			I = static_cast<uint16_t>(nnn);
+			break;
+		case 0xB:
+			pc = static_cast<uint16_t>(V[0] + nnn);
+			break;
+		case 0xD: {
+			unsigned int xPos = V[x] % VIDEO_WIDTH, yPos = V[y] % VIDEO_HEIGHT;
+			unsigned int rows = std::min(op & 0xFu, VIDEO_HEIGHT - yPos);
+			unsigned int cols = std::min(8u, VIDEO_WIDTH - xPos);
+			if (rows && !readable(I, I + rows))
+				return false;
+			V[0xF] = 0;
+			for (unsigned int row = 0; row < rows; row++) {
+				for (unsigned int col = 0; col < cols; col++) {
+					if (!(ram[I + row] & (0x80u >> col)))
+						continue;
+					unsigned int index = (yPos + row) * VIDEO_WIDTH + xPos + col;
+					if (pixels[index])
+						V[0xF] = 1;
+					pixels[index] ^= 1u;
+				}
+			}
+			break;
+		}
+		case 0xF:
+			switch (nn) {
+			case 0x1E:
+				V[0xF] = I + V[x] > 0xFFFu;
+				I = static_cast<uint16_t>(I + V[x]);
+				break;
+			case 0x29:
+				I = static_cast<uint16_t>(FONTSET_START_ADDRESS + 5 * V[x]);
+				break;
+			case 0x33:
+				if (!readable(I, I + 3u))
+					return false;
+				ram[I] = V[x] / 100;
+				ram[I + 1] = V[x] / 10 % 10;
+				ram[I + 2] = V[x] % 10;
+				break;
+			case 0x55:
+				if (!readable(I, I + x + 1))
+					return false;
+				memcpy(ram + I, V, x + 1);
+				break;
+			case 0x65:
+				if (!readable(I, I + x + 1))
+					return false;
+				memcpy(V, ram + I, x + 1);
+				break;
+			case 0x07: case 0x0A: case 0x15: case 0x18:
+				return false;
+			}
+			break;
+		default:
+			// Cxnn and the keypad skips are outside the model
+			return false;
+		}
+	}
+	return false;
+}
+#pragma endregion
+
+uint64_t RunToHalt(Chip8& c, uint64_t limit) {
+	uint64_t start = c.cycles;
+	while (c.cycles - start < limit) {
+		c.RunCycle();
+		if (c.IsHalted())
+			break;
+	}
+	return c.cycles - start;
+}
+
+#pragma region Expectation files
+bool RomExpectation::Save(const char* path) const {
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	fprintf(f, "instructions=%llu\n", static_cast<unsigned long long>(instructions));
+	fprintf(f, "pc=0x%03X\n", pc);
+	fprintf(f, "I=0x%03X\n", I);
+	fprintf(f, "sp=%u\n", sp);
+	fprintf(f, "V=");
+	for (unsigned int i = 0; i < REGISTER_COUNT; i++) {
+		fprintf(f, "%02X", V[i]);
+	}
+	fprintf(f, "\n");
+	fprintf(f, "ram_hash=0x%016llX\n", static_cast<unsigned long long>(ramHash));
+	fprintf(f, "plane_hash=0x%016llX\n", static_cast<unsigned long long>(planeHash));
+	fclose(f);
+	return true;
+}
+
+bool RomExpectation::Load(const char* path) {
+	std::ifstream is(path);
+	if (!is) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	std::string line;
+	unsigned int fields = 0;
+	while (std::getline(is, line)) {
+		size_t eq = line.find('=');
+		if (eq == std::string::npos)
+			continue;
+		std::string key = line.substr(0, eq);
+		const char* value = line.c_str() + eq + 1;
+		fields++;
+		if (key == "instructions")
+			instructions = strtoull(value, nullptr, 0);
+		else if (key == "pc")
+			pc = static_cast<uint16_t>(strtoul(value, nullptr, 0));
+		else if (key == "I")
+			I = static_cast<uint16_t>(strtoul(value, nullptr, 0));
+		else if (key == "sp")
+			sp = static_cast<uint16_t>(strtoul(value, nullptr, 0));
+		else if (key == "ram_hash")
+			ramHash = strtoull(value, nullptr, 0);
+		else if (key == "plane_hash")
+			planeHash = strtoull(value, nullptr, 0);
+		else if (key == "V" && strlen(value) == 2 * REGISTER_COUNT) {
+			for (unsigned int i = 0; i < REGISTER_COUNT; i++) {
+				char byte[3] = { value[2 * i], value[2 * i + 1], 0 };
+				V[i] = static_cast<uint8_t>(strtoul(byte, nullptr, 16));
+			}
+		} else
+			fields--;
+	}
+	if (fields != 7) {
+		std::cout << "Incomplete expectation file " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool RomExpectation::Check(const Chip8& c) const {
+	bool ok = true;
+	auto differs = [&ok](const char* what, unsigned long long want, unsigned long long got) {
+		std::cout << what << ": expected 0x" << std::hex << want << ", got 0x" << got << std::dec << std::endl;
+		ok = false;
+	};
+	if (c.cycles != instructions)
+		differs("instructions", instructions, c.cycles);
+	if (c.pc != pc)
+		differs("pc", pc, c.pc);
+	if (c.I != I)
+		differs("I", I, c.I);
+	if (c.sp != sp)
+		differs("sp", sp, c.sp);
+	for (unsigned int i = 0; i < REGISTER_COUNT; i++) {
+		if (c.V[i] != V[i]) {
+			char name[8];
+			snprintf(name, sizeof(name), "V%X", i);
+			differs(name, V[i], c.V[i]);
+		}
+	}
+	uint64_t ram = Hash64(c.ram + START_ADDRESS, MEMORY_SIZE - START_ADDRESS);
+	if (ram != ramHash)
+		differs("ram_hash", ramHash, ram);
+	uint64_t plane = Hash64(c.plane, sizeof(c.plane));
+	if (plane != planeHash)
+		differs("plane_hash", planeHash, plane);
+	return ok;
+}
+#pragma endregion
+
+#pragma region Generator
+namespace {
+// Registers the loop nest counts in, the bodies leave them alone
+const unsigned int INNER = 0xD;
+const unsigned int OUTER = 0xE;
+// Scratch RAM for the memory family, clear of any code
+const uint16_t DATA_ADDRESS = 0xE00;
+
+class Assembler {
+public:
+	uint16_t Here() const { return static_cast<uint16_t>(START_ADDRESS + code.size()); }
+	void Op(uint16_t op) {
+		code.push_back(static_cast<uint8_t>(op >> 8));
+		code.push_back(static_cast<uint8_t>(op));
+	}
+	void Op(unsigned int top, unsigned int x, unsigned int low) {
+		Op(static_cast<uint16_t>(top << 12 | x << 8 | (low & 0xFFu)));
+	}
+	void Byte(uint8_t b) { code.push_back(b); }
+	void Patch(uint16_t addr, uint16_t op) {
+		code[addr - START_ADDRESS] = static_cast<uint8_t>(op >> 8);
+		code[addr - START_ADDRESS + 1] = static_cast<uint8_t>(op);
+	}
+
+	std::vector<uint8_t> code;
+};
+
+// Deterministic operands from the seed
+class Rng {
+public:
+	explicit Rng(uint64_t seed) : state(seed) {}
+	unsigned int Next(unsigned int bound) {
+		return static_cast<unsigned int>(Mix64(state++ * 0x9E3779B97F4A7C15ull + 1) % bound);
+	}
+
+private:
+	uint64_t state;
+};
+
+// outer x inner runs of body, then the halt. Counts are 8-bit registers.
+void LoopNest(Assembler& a, unsigned int outer, unsigned int inner, const std::function<void()>& body) {
+	outer = outer < 255 ? outer : 255;
+	a.Op(0x6, OUTER, 0);
+	uint16_t outerTop = a.Here();
+	a.Op(0x6, INNER, 0);
+	uint16_t innerTop = a.Here();
+	body();
+	a.Op(0x7, INNER, 1);
+	a.Op(0x3, INNER, inner);
+	a.Op(static_cast<uint16_t>(0x1000u | innerTop));
+	a.Op(0x7, OUTER, 1);
+	a.Op(0x3, OUTER, outer);
+	a.Op(static_cast<uint16_t>(0x1000u | outerTop));
+	a.Op(static_cast<uint16_t>(0x1000u | a.Here()));
+}
+
+// Any register but the loop counters
+unsigned int Reg(Rng& rng) {
+	unsigned int r = rng.Next(14);
+	return r == INNER ? 0xF : r;
+}
+
+void GenerateAlu(Assembler& a, Rng& rng, unsigned int scale) {
+	for (unsigned int r = 0; r < INNER; r++) {
+		a.Op(0x6, r, rng.Next(256));
+	}
+	static const unsigned int ops[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+	LoopNest(a, 20 * scale, 250, [&] {
+		for (unsigned int i = 0; i < 96; i++) {
+			if (rng.Next(8) == 0)
+				a.Op(0x7, Reg(rng), rng.Next(256));
+			else
+				a.Op(static_cast<uint16_t>(0x8000u | Reg(rng) << 8 | Reg(rng) << 4 | ops[rng.Next(9)]));
+		}
+	});
+}
+
+void GenerateCall(Assembler& a, Rng& rng, unsigned int scale) {
+	// Eight subroutines, each bumping a register and calling the next, so a
+	// call to the first one nests eight deep
+	const unsigned int depth = 8;
+	uint16_t skip = a.Here();
+	a.Op(0x1000);
+	uint16_t entry[depth];
+	for (unsigned int s = depth; s-- > 0;) {
+		entry[s] = a.Here();
+		a.Op(0x7, s, 1 + rng.Next(255));
+		if (s + 1 < depth)
+			a.Op(static_cast<uint16_t>(0x2000u | entry[s + 1]));
+		a.Op(0x00EE);
+	}
+	a.Patch(skip, static_cast<uint16_t>(0x1000u | a.Here()));
+	LoopNest(a, 8 * scale, 250, [&] {
+		for (unsigned int i = 0; i < 16; i++) {
+			a.Op(static_cast<uint16_t>(0x2000u | entry[rng.Next(depth)]));
+		}
+	});
+}
+
+void GenerateMemory(Assembler& a, Rng& rng, unsigned int scale) {
+	for (unsigned int r = 0; r < INNER; r++) {
+		a.Op(0x6, r, rng.Next(256));
+	}
+	LoopNest(a, 40 * scale, 250, [&] {
+		for (unsigned int i = 0; i < 12; i++) {
+			// I stays within DATA_ADDRESS + 255 + 15, clear of the end of RAM
+			a.Op(static_cast<uint16_t>(0xA000u | (DATA_ADDRESS + rng.Next(64))));
+			unsigned int x = rng.Next(INNER);
+			switch (rng.Next(4)) {
+			case 0:
+				a.Op(0xF, x, 0x55);
+				break;
+			case 1:
+				a.Op(0xF, x, 0x65);
+				break;
+			case 2:
+				a.Op(0xF, x, 0x33);
+				break;
+			default:
+				a.Op(0xF, x, 0x1E);
+				a.Op(0xF, rng.Next(INNER), 0x55);
+				break;
+			}
+			a.Op(0x7, rng.Next(INNER), rng.Next(256));
+		}
+	});
+}
+
+void GenerateDraw(Assembler& a, Rng& rng, unsigned int scale) {
+	// 30 bytes of sprite rows, so every height can start at any of 16 offsets
+	uint16_t skip = a.Here();
+	a.Op(0x1000);
+	uint16_t sprite = a.Here();
+	for (unsigned int i = 0; i < 30; i++) {
+		a.Byte(static_cast<uint8_t>(rng.Next(256)));
+	}
+	a.Patch(skip, static_cast<uint16_t>(0x1000u | a.Here()));
+	// Tall sprites clipped by the bottom right corner, the right edge and
+	// the bottom edge. The loop draws each of its sprites an even number of
+	// times and so leaves these as the end state to check.
+	static const uint8_t edges[3][2] = { { 60, 30 }, { 61, 8 }, { 20, 25 } };
+	a.Op(static_cast<uint16_t>(0xA000u | sprite));
+	for (const uint8_t* edge : edges) {
+		a.Op(0x6, 0, edge[0]);
+		a.Op(0x6, 1, edge[1]);
+		a.Op(0xD01F);
+	}
+	a.Op(0x6, 0, rng.Next(256));
+	a.Op(0x6, 1, rng.Next(256));
+	// Steps coprime to 64 and 32 walk V0 % 64 and V1 % 32 through every
+	// column and row, so sprites hit every alignment and get clipped at the
+	// right edge, the bottom edge and the corner between them
+	LoopNest(a, 16 * scale, 250, [&] {
+		for (unsigned int n = 0; n < 16; n++) {
+			a.Op(0x7, 0, 7);
+			a.Op(0x7, 1, 5);
+			a.Op(static_cast<uint16_t>(0xA000u | (sprite + rng.Next(16))));
+			a.Op(static_cast<uint16_t>(0xD010u | n));
+		}
+	});
+}
+
+void GenerateJump(Assembler& a, Rng& rng, unsigned int scale) {
+	// A 16-entry table of 4-byte cases reached through Bnnn, from a
+	// subroutine so every case can return with 00EE
+	uint16_t skip = a.Here();
+	a.Op(0x1000);
+	uint16_t dispatch = a.Here();
+	a.Op(0xB000);
+	uint16_t table = a.Here();
+	for (unsigned int i = 0; i < 16; i++) {
+		a.Op(0x7, 2 + rng.Next(11), 1 + rng.Next(255));
+		a.Op(0x00EE);
+	}
+	a.Patch(dispatch, static_cast<uint16_t>(0xB000u | table));
+	a.Patch(skip, static_cast<uint16_t>(0x1000u | a.Here()));
+	a.Op(0x6, 1, 0x3C);
+	LoopNest(a, 16 * scale, 250, [&] {
+		for (unsigned int i = 0; i < 16; i++) {
+			// V0 = (V0 + 4k) & 0x3C, one of the 16 cases
+			a.Op(0x7, 0, 4 * (1 + rng.Next(15)));
+			a.Op(0x8012);
+			a.Op(static_cast<uint16_t>(0x2000u | dispatch));
+		}
+	});
+}
+}
+
+bool GenerateRom(RomFamily family, unsigned int scale, uint64_t seed, GeneratedRom& rom) {
+	Assembler a;
+	Rng rng(Mix64(seed ^ (static_cast<uint64_t>(family) << 56)));
+	scale = scale ? scale : 1;
+	switch (family) {
+	case ROM_ALU: GenerateAlu(a, rng, scale); break;
+	case ROM_CALL: GenerateCall(a, rng, scale); break;
+	case ROM_MEMORY: GenerateMemory(a, rng, scale); break;
+	case ROM_DRAW: GenerateDraw(a, rng, scale); break;
+	case ROM_JUMP: GenerateJump(a, rng, scale); break;
+	default: return false;
+	}
+
+	rom.name = RomFamilyName(family);
+	rom.image = std::move(a.code);
+	if (!ReferenceRun(rom.image, rom.expected)) {
+		std::cout << "Reference run of generated ROM " << rom.name << " did not halt" << std::endl;
+		return false;
+	}
+	return true;
+}
+#pragma endregion
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "chip8.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Synthetic ROMs that each stress one instruction family, for attributing
+// benchmark changes to single opcode handlers.
+// Every ROM runs a fixed loop nest around a body of the family's opcodes and
+// then halts in a jump-to-self, and comes with the state it must halt in.
+// That state is worked out by a small reference interpreter here rather
+// than by Chip8 itself, so the two check each other. Only the default quirk
+// profile is modelled, and none of the ROMs touch timers, keys or Cxnn.
+enum RomFamily {
+	ROM_ALU,    // 8xyN and 7xnn chains
+	ROM_CALL,   // 2nnn/00EE nested subroutines
+	ROM_MEMORY, // Fx55/Fx65/Fx33/Fx1E traffic
+	ROM_DRAW,   // Dxyn of every height and alignment, including the clipped edges
+	ROM_JUMP,   // Bnnn jump tables
+	ROM_FAMILY_COUNT
+};
+
+const char* RomFamilyName(RomFamily family);
+bool ParseRomFamily(const char* text, RomFamily& family);
+
+// The state a generated ROM halts in
+struct RomExpectation {
+	// Instructions up to and including the first run of the halt jump
+	uint64_t instructions = 0;
+	uint16_t pc = 0;
+	uint16_t I = 0;
+	uint16_t sp = 0;
+	uint8_t V[REGISTER_COUNT] = {};
+	// Hash64 of ram from START_ADDRESS up, and of Chip8::plane
+	uint64_t ramHash = 0;
+	uint64_t planeHash = 0;
+
+	// key=value text, one per line
+	bool Save(const char* path) const;
+	bool Load(const char* path);
+	// Compares a core stopped at the halt, printing whatever differs
+	bool Check(const Chip8& chip8) const;
+};
+
+struct GeneratedRom {
+	std::string name;
+	std::vector<uint8_t> image;
+	RomExpectation expected;
+};
+
+// Builds a ROM of the family. scale multiplies the outer loop count, up to
+// its 8-bit limit, seed varies registers and operands. Fails only if the
+// reference run does.
+bool GenerateRom(RomFamily family, unsigned int scale, uint64_t seed, GeneratedRom& rom);
+
+// Runs image on the reference interpreter until it halts, at most limit
+// instructions. Fails on opcodes outside the modelled set or on no halt.
+bool ReferenceRun(const std::vector<uint8_t>& image, RomExpectation& expected, uint64_t limit = 1ull << 32);
+
+// Steps chip8 until it sits in a jump-to-self, returns the instructions run
+uint64_t RunToHalt(Chip8& chip8, uint64_t limit = 1ull << 32);
\ No newline at end of file
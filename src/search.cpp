@@ -0,0 +1,295 @@
+#include "search.h"
+#include "hash.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Search::MctsNode {
+	Candidate candidate;
+	uint32_t parent = 0;
+	std::vector<uint32_t> children;
+	// Next action to try, all tried once it reaches actions.size()
+	unsigned int nextAction = 0;
+	double value = 0;
+	uint64_t visits = 0;
+};
+
+Search::Search(const SearchConfig& cfg) : config(cfg) {
+	if (config.actions.empty())
+		config.actions.push_back(0);
+	if (config.frameSkip == 0)
+		config.frameSkip = 1;
+	unsigned int threads = config.threads ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+	pool.reset(new ThreadPool(threads));
+	// One core per worker plus one for the calling thread
+	for (unsigned int i = 0; i <= pool->Size(); i++) {
+		cores.emplace_back(new Chip8());
+	}
+}
+
+bool Search::LoadRom(const char* path) {
+	for (auto& core : cores) {
+		if (!core->LoadRom(path))
+			return false;
+		core->quirks = config.quirks;
+	}
+	romPath = path;
+	return true;
+}
+
+Chip8& Search::Core() {
+	int index = pool->WorkerIndex();
+	return index < 0 ? *cores.back() : *cores[index];
+}
+
+bool Search::Step(Chip8& c, uint16_t action, uint64_t& frame) {
+	for (unsigned int k = 0; k < KEY_COUNT; k++) {
+		c.keypad[k] = (action >> k) & 1u;
+	}
+	for (unsigned int f = 0; f < config.frameSkip; f++) {
+		c.RunFrame(FrameInstructions(frame, config.ips));
+		frame++;
+	}
+	steps.fetch_add(1, std::memory_order_relaxed);
+	return config.done && config.done(c);
+}
+
+void Search::Boot(Candidate& root) {
+	Chip8& c = Core();
+	c.Boot();
+	c.Seed(config.seed);
+	root.state.Capture(c);
+	root.hash = c.IncrementalHash();
+	root.frame = 0;
+	root.score = config.score ? config.score(c) : 0;
+	root.terminal = false;
+	paths.clear();
+	paths.push_back({ 0, 0 });
+	root.path = 0;
+}
+
+void Search::Expand(const Candidate& parent, uint16_t action, Candidate& child) {
+	Chip8& c = Core();
+	parent.state.Restore(c);
+	child.frame = parent.frame;
+	child.terminal = Step(c, action, child.frame);
+	child.state.Capture(c, &parent.state);
+	child.hash = c.IncrementalHash();
+	child.score = config.score ? config.score(c) : 0;
+}
+
+uint32_t Search::AddPath(uint32_t parent, uint16_t action) {
+	paths.push_back({ parent, action });
+	return static_cast<uint32_t>(paths.size() - 1);
+}
+
+std::vector<uint16_t> Search::Inputs(uint32_t path) const {
+	std::vector<uint16_t> inputs;
+	// Entry 0 is the root
+	for (uint32_t p = path; p != 0; p = paths[p].parent) {
+		inputs.push_back(paths[p].action);
+	}
+	std::reverse(inputs.begin(), inputs.end());
+	return inputs;
+}
+
+#pragma region Beam
+SearchResult Search::Beam() {
+	SearchResult result;
+	Clock::time_point start = Clock::now();
+	steps = 0;
+
+	std::vector<Candidate> frontier(1);
+	Boot(frontier[0]);
+	std::unordered_set<uint64_t> seen{ frontier[0].hash };
+	int64_t bestScore = frontier[0].score;
+	uint32_t bestPath = 0;
+
+	const unsigned int actionCount = static_cast<unsigned int>(config.actions.size());
+	for (unsigned int d = 0; d < config.depth && !frontier.empty(); d++) {
+		std::vector<Candidate> children(frontier.size() * actionCount);
+
+		// Expand every (candidate, action) pair, a few chunks per worker
+		size_t total = children.size();
+		size_t chunk = std::max<size_t>(1, total / (pool->Size() * 4));
+		for (size_t begin = 0; begin < total; begin += chunk) {
+			size_t end = std::min(total, begin + chunk);
+			pool->Submit([this, &frontier, &children, begin, end, actionCount] {
+				for (size_t i = begin; i < end; i++) {
+					Expand(frontier[i / actionCount], config.actions[i % actionCount], children[i]);
+				}
+			});
+		}
+		pool->Wait();
+
+		// Drop transpositions, then keep the best scoring ones
+		std::vector<uint32_t> order;
+		for (uint32_t i = 0; i < children.size(); i++) {
+			if (seen.insert(children[i].hash).second)
+				order.push_back(i);
+			else
+				result.transpositions++;
+		}
+		std::stable_sort(order.begin(), order.end(), [&children](uint32_t a, uint32_t b) {
+			return children[a].score > children[b].score;
+		});
+
+		std::vector<Candidate> next;
+		for (uint32_t i : order) {
+			Candidate& child = children[i];
+			child.path = AddPath(frontier[i / actionCount].path, config.actions[i % actionCount]);
+			result.nodes++;
+			if (child.score > bestScore) {
+				bestScore = child.score;
+				bestPath = child.path;
+			}
+			if (!child.terminal && next.size() < config.width)
+				next.push_back(std::move(child));
+		}
+		frontier = std::move(next);
+	}
+
+	result.inputs = Inputs(bestPath);
+	result.score = bestScore;
+	result.steps = steps;
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	return result;
+}
+#pragma endregion
+
+#pragma region MCTS
+SearchResult Search::Mcts() {
+	SearchResult result;
+	Clock::time_point start = Clock::now();
+	steps = 0;
+
+	std::vector<MctsNode> tree(1);
+	Boot(tree[0].candidate);
+	std::unordered_set<uint64_t> seen{ tree[0].candidate.hash };
+	const int64_t rootScore = tree[0].candidate.score;
+	int64_t bestScore = rootScore;
+	std::vector<uint16_t> bestInputs;
+	// Rewards are normalised by the largest gain seen so UCT stays in scale
+	double scale = 1;
+
+	const unsigned int actionCount = static_cast<unsigned int>(config.actions.size());
+	const unsigned int rolloutCount = std::max(1u, config.rollouts);
+	std::vector<int64_t> rolloutScores(rolloutCount);
+	std::vector<std::vector<uint16_t>> rolloutInputs(rolloutCount);
+
+	for (unsigned int it = 0; it < config.iterations; it++) {
+		// Selection
+		uint32_t node = 0;
+		while (tree[node].nextAction >= actionCount && !tree[node].children.empty()) {
+			double logVisits = std::log(static_cast<double>(tree[node].visits));
+			uint32_t best = tree[node].children[0];
+			double bestUct = -1e300;
+			for (uint32_t child : tree[node].children) {
+				const MctsNode& n = tree[child];
+				double uct = n.visits ? (n.value / n.visits) / scale + config.exploration * std::sqrt(logVisits / n.visits) : 1e300;
+				if (uct > bestUct) {
+					bestUct = uct;
+					best = child;
+				}
+			}
+			node = best;
+		}
+
+		// Expansion: the next untried action that reaches a new state
+		while (!tree[node].candidate.terminal && tree[node].nextAction < actionCount) {
+			uint16_t action = config.actions[tree[node].nextAction++];
+			MctsNode child;
+			Expand(tree[node].candidate, action, child.candidate);
+			if (!seen.insert(child.candidate.hash).second) {
+				result.transpositions++;
+				continue;
+			}
+			child.parent = node;
+			child.candidate.path = AddPath(tree[node].candidate.path, action);
+			tree.push_back(std::move(child));
+			uint32_t index = static_cast<uint32_t>(tree.size() - 1);
+			tree[node].children.push_back(index);
+			node = index;
+			result.nodes++;
+			break;
+		}
+
+		// Simulation: random rollouts from the leaf in parallel
+		const Candidate& leaf = tree[node].candidate;
+		for (unsigned int r = 0; r < rolloutCount; r++) {
+			pool->Submit([this, &leaf, &rolloutScores, &rolloutInputs, it, r] {
+				Chip8& c = Core();
+				leaf.state.Restore(c);
+				uint64_t frame = leaf.frame;
+				std::vector<uint16_t>& inputs = rolloutInputs[r];
+				inputs.clear();
+				bool done = leaf.terminal;
+				for (unsigned int d = 0; d < config.rolloutDepth && !done; d++) {
+					uint64_t rnd = Mix64(config.seed ^ (static_cast<uint64_t>(it) << 24) ^ (static_cast<uint64_t>(r) << 12) ^ d);
+					uint16_t action = config.actions[rnd % config.actions.size()];
+					inputs.push_back(action);
+					done = Step(c, action, frame);
+				}
+				rolloutScores[r] = config.score ? config.score(c) : 0;
+			});
+		}
+		pool->Wait();
+
+		double total = 0;
+		for (unsigned int r = 0; r < rolloutCount; r++) {
+			double gain = static_cast<double>(rolloutScores[r] - rootScore);
+			scale = std::max(scale, std::fabs(gain));
+			total += gain;
+			if (rolloutScores[r] > bestScore) {
+				bestScore = rolloutScores[r];
+				bestInputs = Inputs(leaf.path);
+				bestInputs.insert(bestInputs.end(), rolloutInputs[r].begin(), rolloutInputs[r].end());
+			}
+		}
+
+		// Backpropagation
+		for (uint32_t n = node;; n = tree[n].parent) {
+			tree[n].visits += rolloutCount;
+			tree[n].value += total;
+			if (n == 0)
+				break;
+		}
+	}
+
+	result.inputs = bestInputs;
+	result.score = bestScore;
+	result.steps = steps;
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	return result;
+}
+#pragma endregion
+
+int64_t Search::Record(const std::vector<uint16_t>& inputs, Movie& movie) {
+	Chip8& c = *cores.back();
+	MovieRecorder recorder;
+	recorder.Start(&c, &movie, config.seed);
+
+	// The same frames Step runs, one instruction at a time so every key
+	// change lands in the movie at the instruction it took effect
+	uint64_t frame = 0;
+	for (uint16_t action : inputs) {
+		for (unsigned int k = 0; k < KEY_COUNT; k++) {
+			c.keypad[k] = (action >> k) & 1u;
+		}
+		for (unsigned int f = 0; f < config.frameSkip; f++) {
+			unsigned int n = FrameInstructions(frame, config.ips);
+			for (unsigned int i = 0; i < n; i++) {
+				recorder.Sample(&c);
+				c.RunCycle();
+			}
+			c.RunTimers();
+			recorder.Tick(&c);
+			frame++;
+		}
+	}
+	recorder.Stop(&c);
+	return config.score ? config.score(c) : 0;
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "chip8.h"
+#include "env.h"
+#include "movie.h"
+#include "pagedstate.h"
+#include "threadpool.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Input search over a ROM: finds a sequence of keypad masks that drives a
+// RAM score as high as possible, then records it as a movie.
+// Every candidate lives in a copy-on-write PagedState, so branching from it
+// is a restore of the pages that differ, and states reached along more than
+// one path are dropped via a transposition table keyed by
+// Chip8::IncrementalHash. Expansion and rollouts run on a thread pool with
+// one core per worker.
+struct SearchConfig {
+	// Key masks an action can be, e.g. none, left, right
+	std::vector<uint16_t> actions;
+	// Frames each action is held for
+	unsigned int frameSkip = 4;
+	unsigned int ips = 500;
+	uint32_t quirks = 0;
+	uint64_t seed = 0;
+	ScoreFunc score;
+	// Terminal states are scored but never expanded, e.g. a lost life
+	DoneFunc done;
+	unsigned int threads = 0;
+
+	// Beam search: actions per sequence and candidates kept per depth
+	unsigned int depth = 200;
+	unsigned int width = 64;
+
+	// MCTS: tree iterations, random actions per rollout, rollouts per
+	// expanded leaf and the UCT exploration constant
+	unsigned int iterations = 2000;
+	unsigned int rolloutDepth = 50;
+	unsigned int rollouts = 8;
+	double exploration = 1.4;
+};
+
+struct SearchResult {
+	std::vector<uint16_t> inputs;
+	int64_t score = 0;
+	// Actions simulated, each frameSkip frames of emulation
+	uint64_t steps = 0;
+	uint64_t nodes = 0;
+	uint64_t transpositions = 0;
+	double seconds = 0;
+};
+
+class Search {
+public:
+	Search(const SearchConfig& config);
+
+	bool LoadRom(const char* path);
+	SearchResult Beam();
+	SearchResult Mcts();
+	// Replays inputs from boot under a MovieRecorder and returns the final score
+	int64_t Record(const std::vector<uint16_t>& inputs, Movie& movie);
+
+private:
+	struct Candidate {
+		PagedState state;
+		uint64_t hash = 0;
+		uint64_t frame = 0;
+		int64_t score = 0;
+		bool terminal = false;
+		// Index into the path arena
+		uint32_t path = 0;
+	};
+	// Action history shared between candidates, walked back to rebuild inputs
+	struct PathEntry {
+		uint32_t parent;
+		uint16_t action;
+	};
+	struct MctsNode;
+
+	// The calling worker's core
+	Chip8& Core();
+	void Boot(Candidate& root);
+	// Holds action for frameSkip frames, advancing frame
+	bool Step(Chip8& chip8, uint16_t action, uint64_t& frame);
+	// Restores parent, plays action and captures the result into child
+	void Expand(const Candidate& parent, uint16_t action, Candidate& child);
+	std::vector<uint16_t> Inputs(uint32_t path) const;
+	uint32_t AddPath(uint32_t parent, uint16_t action);
+
+	SearchConfig config;
+	std::string romPath;
+	std::unique_ptr<ThreadPool> pool;
+	std::vector<std::unique_ptr<Chip8>> cores;
+	std::vector<PathEntry> paths;
+	std::atomic<uint64_t> steps{ 0 };
+};
\ No newline at end of file
@@ -15,4 +15,34 @@ State::State() {
 	sp = 0;
 	delayTimer = 0;
 	soundTimer = 0;
+	cycleDelay = 0;
+	cycles = 0;
+	rngSeed = 0;
+	rngCounter = 0;
+}
+
+StatePool::StatePool(size_t blockSize) : blockSize(blockSize ? blockSize : 1) {
+}
+
+StatePool::~StatePool() {
+	for (State* block : blocks) {
+		delete[] block;
+	}
+}
+
+State* StatePool::Acquire() {
+	if (freeList.empty()) {
+		State* block = new State[blockSize];
+		blocks.push_back(block);
+		for (size_t i = blockSize; i > 0; i--) {
+			freeList.push_back(&block[i - 1]);
+		}
+	}
+	State* state = freeList.back();
+	freeList.pop_back();
+	return state;
+}
+
+void StatePool::Release(State* state) {
+	freeList.push_back(state);
 }
\ No newline at end of file
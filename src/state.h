@@ -1,4 +1,8 @@
+#pragma once
+
 #include <cstdint>
+#include <cstddef>
+#include <vector>
 
 class State {
 public:
@@ -28,4 +32,30 @@ public:
 	uint8_t delayTimer;
 	uint8_t soundTimer;
 	int cycleDelay;
+
+	// Instruction count and RNG position
+	uint64_t cycles;
+	uint64_t rngSeed;
+	uint64_t rngCounter;
+};
+
+// Hands out States from fixed-size blocks, so hundreds of checkpoints cost a
+// handful of allocations and released states are recycled instead of freed.
+class StatePool {
+public:
+	StatePool(size_t blockSize = 16);
+	~StatePool();
+	StatePool(const StatePool&) = delete;
+	StatePool& operator=(const StatePool&) = delete;
+
+	State* Acquire();
+	void Release(State* state);
+
+	// States allocated so far, in use or not
+	size_t Capacity() const { return blocks.size() * blockSize; }
+
+private:
+	size_t blockSize;
+	std::vector<State*> blocks;
+	std::vector<State*> freeList;
 };
\ No newline at end of file
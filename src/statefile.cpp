@@ -0,0 +1,388 @@
+#include "statefile.h"
+#include "hash.h"
+// Error Output
+#include <iostream>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN64) or defined(_WIN32)
+#include <Windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char STATEFILE_MAGIC[4] = { 'X', 'C', '8', 'S' };
+
+#pragma region Layout
+// Fixed little-endian layout, see statefile.h. Each field is written and read
+// by value, so struct padding and host byte order never reach the disk.
+class LayoutWriter {
+public:
+	LayoutWriter(uint8_t* out) : p(out) {}
+	template <typename T>
+	void Put(T value) {
+		for (size_t i = 0; i < sizeof(T); i++) {
+			*p++ = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i));
+		}
+	}
+	template <typename T, size_t N>
+	void Put(const T (&values)[N]) {
+		// Already in file order on little-endian hosts, arrays go as a block
+		if constexpr (std::endian::native == std::endian::little) {
+			memcpy(p, values, sizeof(values));
+			p += sizeof(values);
+		} else {
+			for (size_t i = 0; i < N; i++) {
+				Put(values[i]);
+			}
+		}
+	}
+	uint8_t* p;
+};
+
+class LayoutReader {
+public:
+	LayoutReader(const uint8_t* in) : p(in) {}
+	template <typename T>
+	void Get(T& value) {
+		uint64_t v = 0;
+		for (size_t i = 0; i < sizeof(T); i++) {
+			v |= static_cast<uint64_t>(*p++) << (8 * i);
+		}
+		value = static_cast<T>(v);
+	}
+	template <typename T, size_t N>
+	void Get(T (&values)[N]) {
+		if constexpr (std::endian::native == std::endian::little) {
+			memcpy(values, p, sizeof(values));
+			p += sizeof(values);
+		} else {
+			for (size_t i = 0; i < N; i++) {
+				Get(values[i]);
+			}
+		}
+	}
+	const uint8_t* p;
+};
+
+static void WriteHeader(const StateFileHeader& h, uint8_t* out) {
+	LayoutWriter w(out);
+	w.Put(h.magic);
+	w.Put(h.version);
+	w.Put(h.flags);
+	w.Put(h.quirks);
+	w.Put(h.payloadSize);
+	w.Put(h.romHash);
+	w.Put(h.checksum);
+}
+
+static void ReadHeader(const uint8_t* in, StateFileHeader& h) {
+	LayoutReader r(in);
+	r.Get(h.magic);
+	r.Get(h.version);
+	r.Get(h.flags);
+	r.Get(h.quirks);
+	r.Get(h.payloadSize);
+	r.Get(h.romHash);
+	r.Get(h.checksum);
+}
+
+static void WritePayload(const State& s, uint8_t* out) {
+	LayoutWriter w(out);
+	w.Put(s.video);
+	w.Put(s.display);
+	w.Put(s.keypad);
+	w.Put(s.ram);
+	w.Put(s.opcode);
+	w.Put(s.V);
+	w.Put(s.I);
+	w.Put(s.pc);
+	w.Put(s.sp);
+	w.Put(s.stack);
+	w.Put(s.delayTimer);
+	w.Put(s.soundTimer);
+	w.Put(static_cast<int32_t>(s.cycleDelay));
+	w.Put(s.cycles);
+	w.Put(s.rngSeed);
+	w.Put(s.rngCounter);
+}
+
+static void ReadPayload(const uint8_t* in, State& s) {
+	LayoutReader r(in);
+	r.Get(s.video);
+	r.Get(s.display);
+	r.Get(s.keypad);
+	r.Get(s.ram);
+	r.Get(s.opcode);
+	r.Get(s.V);
+	r.Get(s.I);
+	r.Get(s.pc);
+	r.Get(s.sp);
+	r.Get(s.stack);
+	r.Get(s.delayTimer);
+	r.Get(s.soundTimer);
+	int32_t cycleDelay;
+	r.Get(cycleDelay);
+	s.cycleDelay = cycleDelay;
+	r.Get(s.cycles);
+	r.Get(s.rngSeed);
+	r.Get(s.rngCounter);
+}
+#pragma endregion
+
+#pragma region PackBits
+// Classic PackBits RLE. The framebuffers are runs of 0x00/0xFF and most of ram
+// is zero, so a state shrinks to a few KB at memcpy-like speed.
+static void PackBits(const uint8_t* src, size_t size, std::vector<uint8_t>& out) {
+	size_t i = 0;
+	while (i < size) {
+		// Measure the run starting at i
+		size_t run = 1;
+		while (i + run < size && run < 128 && src[i + run] == src[i]) {
+			++run;
+		}
+
+		if (run >= 3) {
+			out.push_back(static_cast<uint8_t>(257 - run));
+			out.push_back(src[i]);
+			i += run;
+			continue;
+		}
+
+		// Gather literals until the next run of 3 or more
+		size_t start = i;
+		while (i < size && i - start < 128) {
+			if (i + 2 < size && src[i] == src[i + 1] && src[i] == src[i + 2]) {
+				break;
+			}
+			++i;
+		}
+		out.push_back(static_cast<uint8_t>(i - start - 1));
+		out.insert(out.end(), src + start, src + i);
+	}
+}
+
+static bool UnpackBits(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize) {
+	size_t i = 0, o = 0;
+	while (i < size) {
+		uint8_t n = src[i++];
+		if (n < 128) {
+			size_t count = n + 1u;
+			if (i + count > size || o + count > dstSize) {
+				return false;
+			}
+			memcpy(dst + o, src + i, count);
+			i += count;
+			o += count;
+		} else if (n > 128) {
+			size_t count = 257u - n;
+			if (i >= size || o + count > dstSize) {
+				return false;
+			}
+			memset(dst + o, src[i++], count);
+			o += count;
+		}
+	}
+	return o == dstSize;
+}
+#pragma endregion
+
+#pragma region MappedFile
+// Read-only view of a whole file.
+class MappedFile {
+public:
+	MappedFile(const char* path) {
+#if defined(_WIN64) or defined(_WIN32)
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			return;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+			return;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			return;
+		}
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (data) {
+			size = static_cast<size_t>(fileSize.QuadPart);
+		}
+#else
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				data = static_cast<const uint8_t*>(p);
+				size = static_cast<size_t>(st.st_size);
+			}
+		}
+		// The mapping keeps the file alive
+		close(fd);
+#endif
+	}
+
+	~MappedFile() {
+#if defined(_WIN64) or defined(_WIN32)
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (data)
+			munmap(const_cast<uint8_t*>(data), size);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+private:
+#if defined(_WIN64) or defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#endif
+};
+#pragma endregion
+
+void EncodeStateFile(const State& state, uint64_t romHash, uint32_t quirks, bool compress, std::vector<uint8_t>& out) {
+	out.clear();
+	if (compress) {
+		out.resize(sizeof(StateFileHeader));
+		uint8_t payload[STATEFILE_PAYLOAD_SIZE];
+		WritePayload(state, payload);
+		PackBits(payload, sizeof(payload), out);
+	} else {
+		out.resize(sizeof(StateFileHeader) + STATEFILE_PAYLOAD_SIZE);
+		WritePayload(state, out.data() + sizeof(StateFileHeader));
+	}
+
+	StateFileHeader header;
+	memcpy(header.magic, STATEFILE_MAGIC, sizeof(header.magic));
+	header.version = STATEFILE_VERSION;
+	header.flags = compress ? STATEFILE_COMPRESSED : 0;
+	header.quirks = quirks;
+	header.payloadSize = static_cast<uint32_t>(out.size() - sizeof(StateFileHeader));
+	header.romHash = romHash;
+	header.checksum = Hash64(out.data() + sizeof(StateFileHeader), header.payloadSize);
+	WriteHeader(header, out.data());
+}
+
+bool DecodeStateFile(const uint8_t* data, size_t size, State& state, StateFileHeader* header) {
+	StateFileHeader h;
+	if (size < sizeof(h)) {
+		std::cout << "Savestate is truncated" << std::endl;
+		return false;
+	}
+	ReadHeader(data, h);
+
+	if (memcmp(h.magic, STATEFILE_MAGIC, sizeof(h.magic)) != 0) {
+		std::cout << "Not a savestate file" << std::endl;
+		return false;
+	}
+	if (h.version != STATEFILE_VERSION) {
+		std::cout << "Unsupported savestate version " << h.version << std::endl;
+		return false;
+	}
+	if (h.payloadSize != size - sizeof(h)) {
+		std::cout << "Savestate payload size mismatch" << std::endl;
+		return false;
+	}
+
+	const uint8_t* payload = data + sizeof(h);
+	if (Hash64(payload, h.payloadSize) != h.checksum) {
+		std::cout << "Savestate checksum mismatch" << std::endl;
+		return false;
+	}
+
+	if (h.flags & STATEFILE_COMPRESSED) {
+		uint8_t unpacked[STATEFILE_PAYLOAD_SIZE];
+		if (!UnpackBits(payload, h.payloadSize, unpacked, sizeof(unpacked))) {
+			std::cout << "Savestate payload is corrupt" << std::endl;
+			return false;
+		}
+		ReadPayload(unpacked, state);
+	} else {
+		if (h.payloadSize != STATEFILE_PAYLOAD_SIZE) {
+			std::cout << "Savestate payload size mismatch" << std::endl;
+			return false;
+		}
+		ReadPayload(payload, state);
+	}
+
+	if (header)
+		*header = h;
+	return true;
+}
+
+std::string TempPathFor(const char* path) {
+	// Unique per call so concurrent writers of one path never share a temp file
+	static std::atomic<uint32_t> sequence{ 0 };
+	return std::string(path) + ".tmp" + std::to_string(sequence++);
+}
+
+bool WriteFileAtomic(const char* path, const void* data, size_t size) {
+	std::string tmpPath = TempPathFor(path);
+
+	FILE* f = fopen(tmpPath.c_str(), "wb");
+	if (!f) {
+		std::cout << "Failed to open " << tmpPath << " for writing" << std::endl;
+		return false;
+	}
+	bool ok = fwrite(data, 1, size, f) == size && fflush(f) == 0;
+#if defined(_WIN64) or defined(_WIN32)
+	ok = ok && _commit(_fileno(f)) == 0;
+#else
+	ok = ok && fsync(fileno(f)) == 0;
+#endif
+	ok = (fclose(f) == 0) && ok;
+
+	if (!ok) {
+		std::cout << "Failed to write " << tmpPath << std::endl;
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+#if defined(_WIN64) or defined(_WIN32)
+	ok = MoveFileExA(tmpPath.c_str(), path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	ok = rename(tmpPath.c_str(), path) == 0;
+#endif
+	if (!ok) {
+		std::cout << "Failed to rename " << tmpPath << " to " << path << std::endl;
+		remove(tmpPath.c_str());
+	}
+	return ok;
+}
+
+bool WriteStateFile(const char* path, const State& state, uint64_t romHash, uint32_t quirks, bool compress) {
+	std::vector<uint8_t> buffer;
+	EncodeStateFile(state, romHash, quirks, compress, buffer);
+	return WriteFileAtomic(path, buffer.data(), buffer.size());
+}
+
+bool ReadStateFile(const char* path, State& state, StateFileHeader* header) {
+	MappedFile file(path);
+	if (!file.data) {
+		std::cout << "Failed to map savestate " << path << std::endl;
+		return false;
+	}
+	return DecodeStateFile(file.data, file.size, state, header);
+}
\ No newline at end of file
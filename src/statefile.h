@@ -0,0 +1,48 @@
+#pragma once
+
+#include "state.h"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+const uint16_t STATEFILE_VERSION = 3;
+
+// Header flags
+const uint16_t STATEFILE_COMPRESSED = 1u << 0;
+
+// On-disk savestate header, immediately followed by the payload.
+// The header and the payload are little-endian whatever the host. The
+// payload holds the State fields in declaration order with no padding,
+// STATEFILE_PAYLOAD_SIZE bytes (PackBits RLE encoded when compressed), so a
+// file moves between compilers and machines.
+struct StateFileHeader {
+	char magic[4];        // "XC8S"
+	uint16_t version;     // STATEFILE_VERSION
+	uint16_t flags;       // STATEFILE_* flags
+	uint32_t quirks;      // Quirk profile the state was taken under
+	uint32_t payloadSize; // Payload bytes on disk
+	uint64_t romHash;     // Hash64 of the loaded ROM image
+	uint64_t checksum;    // Hash64 of the on-disk payload
+};
+
+static_assert(sizeof(StateFileHeader) == 32, "StateFileHeader must stay fixed-layout");
+
+const size_t STATEFILE_PAYLOAD_SIZE =
+	sizeof(State::video) + sizeof(State::display) + sizeof(State::keypad) + sizeof(State::ram) +
+	2 + sizeof(State::V) + 2 + 2 + 2 + sizeof(State::stack) + 1 + 1 + 4 + 8 + 8 + 8;
+static_assert(STATEFILE_PAYLOAD_SIZE == 20582, "Changing the payload layout needs a new STATEFILE_VERSION");
+
+// Serializes a state (header + payload) into out, reusing its capacity.
+void EncodeStateFile(const State& state, uint64_t romHash, uint32_t quirks, bool compress, std::vector<uint8_t>& out);
+// Validates an in-memory state file and copies the payload into state.
+bool DecodeStateFile(const uint8_t* data, size_t size, State& state, StateFileHeader* header = nullptr);
+
+// Writes to a "<path>.tmpN" file, flushes it to disk and renames it over path,
+// so a crash never leaves a torn savestate behind.
+std::string TempPathFor(const char* path);
+bool WriteFileAtomic(const char* path, const void* data, size_t size);
+
+bool WriteStateFile(const char* path, const State& state, uint64_t romHash, uint32_t quirks, bool compress);
+// Memory-maps the file and decodes it straight out of the page cache.
+bool ReadStateFile(const char* path, State& state, StateFileHeader* header = nullptr);
\ No newline at end of file
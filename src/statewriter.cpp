@@ -0,0 +1,408 @@
+#include "statewriter.h"
+#include "statefile.h"
+// Error Output
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Max jobs handed to the kernel in one io_uring submission
+const unsigned int URING_BATCH = 64;
+
+#pragma region io_uring
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+// Bare-bones io_uring, just enough to queue linked write+fsync pairs and reap
+// their completions without pulling in liburing.
+struct StateWriter::Ring {
+	int fd = -1;
+	// Submission queue
+	void* sqMap = nullptr;
+	size_t sqMapSize = 0;
+	std::atomic<unsigned>* sqHead = nullptr;
+	std::atomic<unsigned>* sqTail = nullptr;
+	unsigned* sqMask = nullptr;
+	unsigned* sqArray = nullptr;
+	io_uring_sqe* sqes = nullptr;
+	size_t sqesSize = 0;
+	// Completion queue
+	void* cqMap = nullptr;
+	size_t cqMapSize = 0;
+	std::atomic<unsigned>* cqHead = nullptr;
+	std::atomic<unsigned>* cqTail = nullptr;
+	unsigned* cqMask = nullptr;
+	io_uring_cqe* cqes = nullptr;
+
+	bool Init(unsigned entries) {
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+		if (fd < 0) {
+			return false;
+		}
+
+		sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single) {
+			sqMapSize = cqMapSize = (sqMapSize > cqMapSize) ? sqMapSize : cqMapSize;
+		}
+
+		sqMap = mmap(NULL, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sqMap == MAP_FAILED) {
+			sqMap = nullptr;
+			return false;
+		}
+		if (single) {
+			cqMap = sqMap;
+		} else {
+			cqMap = mmap(NULL, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (cqMap == MAP_FAILED) {
+				cqMap = nullptr;
+				return false;
+			}
+		}
+		sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		void* s = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (s == MAP_FAILED) {
+			return false;
+		}
+		sqes = static_cast<io_uring_sqe*>(s);
+
+		char* sq = static_cast<char*>(sqMap);
+		sqHead = reinterpret_cast<std::atomic<unsigned>*>(sq + p.sq_off.head);
+		sqTail = reinterpret_cast<std::atomic<unsigned>*>(sq + p.sq_off.tail);
+		sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+		char* cq = static_cast<char*>(cqMap);
+		cqHead = reinterpret_cast<std::atomic<unsigned>*>(cq + p.cq_off.head);
+		cqTail = reinterpret_cast<std::atomic<unsigned>*>(cq + p.cq_off.tail);
+		cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+		return true;
+	}
+
+	~Ring() {
+		if (sqes)
+			munmap(sqes, sqesSize);
+		if (cqMap && cqMap != sqMap)
+			munmap(cqMap, cqMapSize);
+		if (sqMap)
+			munmap(sqMap, sqMapSize);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	// The next free entry, zeroed. The kernel does not see it until Submit().
+	io_uring_sqe* NextSqe() {
+		unsigned tail = sqTail->load(std::memory_order_relaxed) + unpublished++;
+		unsigned index = tail & *sqMask;
+		io_uring_sqe* sqe = &sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqArray[index] = index;
+		return sqe;
+	}
+
+	// Hands every entry from NextSqe() to the kernel. The release store
+	// orders the tail after the entries were filled in.
+	void Submit() {
+		unsigned tail = sqTail->load(std::memory_order_relaxed);
+		sqTail->store(tail + unpublished, std::memory_order_release);
+		unpublished = 0;
+	}
+
+	// Submits up to `count` queued entries and waits for `wait` completions,
+	// returns how many entries the kernel consumed or -1 on error
+	int Enter(unsigned count, unsigned wait) {
+		while (true) {
+			int ret = static_cast<int>(syscall(__NR_io_uring_enter, fd, count, wait, IORING_ENTER_GETEVENTS, NULL, 0));
+			if (ret >= 0)
+				return ret;
+			if (errno != EINTR) {
+				broken = true;
+				return -1;
+			}
+		}
+	}
+
+	bool broken = false;
+	// Entries handed out by NextSqe() since the last Submit()
+	unsigned unpublished = 0;
+};
+#else
+struct StateWriter::Ring {
+	bool Init(unsigned) { return false; }
+};
+#endif
+#pragma endregion
+
+StateWriter::StateWriter(unsigned int threads, bool useUring) {
+	if (threads == 0)
+		threads = 1;
+
+	if (useUring) {
+		ring = new Ring();
+		if (!ring->Init(URING_BATCH * 2)) {
+			// Seccomp'd containers and old kernels land here
+			delete ring;
+			ring = nullptr;
+		}
+	}
+
+	if (ring) {
+		workers.emplace_back(&StateWriter::UringWorker, this);
+	} else {
+		for (unsigned int i = 0; i < threads; i++) {
+			workers.emplace_back(&StateWriter::Worker, this);
+		}
+	}
+}
+
+StateWriter::~StateWriter() {
+	Flush();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& t : workers) {
+		t.join();
+	}
+	delete ring;
+	for (Job* job : pool) {
+		delete job;
+	}
+}
+
+StateWriter::Job* StateWriter::Acquire() {
+	std::lock_guard<std::mutex> guard(lock);
+	if (pool.empty()) {
+		return new Job();
+	}
+	Job* job = pool.back();
+	pool.pop_back();
+	return job;
+}
+
+void StateWriter::Release(Job* job) {
+	job->callback = nullptr;
+	std::lock_guard<std::mutex> guard(lock);
+	pool.push_back(job);
+}
+
+void StateWriter::Submit(const State& state, uint64_t romHash, uint32_t quirks, bool compress,
+	const std::string& path, Callback callback) {
+	Job* job = Acquire();
+	job->state = state;
+	job->romHash = romHash;
+	job->quirks = quirks;
+	job->compress = compress;
+	job->path = path;
+	job->callback = std::move(callback);
+
+	size_t depth = queued.fetch_add(1, std::memory_order_relaxed) + 1;
+	size_t peak = peakDepth.load(std::memory_order_relaxed);
+	while (depth > peak && !peakDepth.compare_exchange_weak(peak, depth)) {
+	}
+	++submitted;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queue.push_back(job);
+	}
+	wake.notify_one();
+}
+
+void StateWriter::Flush() {
+	std::unique_lock<std::mutex> guard(lock);
+	idle.wait(guard, [this] { return queue.empty() && inFlight == 0; });
+}
+
+void StateWriter::Finish(Job* job, bool ok) {
+	if (ok) {
+		++completed;
+		bytesWritten += job->encoded.size();
+	} else {
+		++failed;
+	}
+	if (job->callback) {
+		job->callback(job->path, ok);
+	}
+	queued.fetch_sub(1, std::memory_order_relaxed);
+	Release(job);
+}
+
+void StateWriter::Worker() {
+	while (true) {
+		Job* job;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !queue.empty(); });
+			if (queue.empty())
+				return;
+			job = queue.front();
+			queue.pop_front();
+			++inFlight;
+		}
+
+		EncodeStateFile(job->state, job->romHash, job->quirks, job->compress, job->encoded);
+		bool ok = WriteFileAtomic(job->path.c_str(), job->encoded.data(), job->encoded.size());
+		++batches;
+		Finish(job, ok);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			--inFlight;
+		}
+		idle.notify_all();
+	}
+}
+
+void StateWriter::UringWorker() {
+	std::vector<Job*> batch;
+	batch.reserve(URING_BATCH);
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !queue.empty(); });
+			if (queue.empty())
+				return;
+			// Take everything that piled up, slots and sessions alike
+			while (!queue.empty() && batch.size() < URING_BATCH) {
+				batch.push_back(queue.front());
+				queue.pop_front();
+			}
+			inFlight += batch.size();
+		}
+
+		for (Job* job : batch) {
+			EncodeStateFile(job->state, job->romHash, job->quirks, job->compress, job->encoded);
+		}
+		WriteBatchUring(batch);
+		++batches;
+
+		size_t count = batch.size();
+		for (Job* job : batch) {
+			Finish(job, job->ok);
+		}
+		batch.clear();
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			inFlight -= count;
+		}
+		idle.notify_all();
+	}
+}
+
+bool StateWriter::WriteBatchUring(std::vector<Job*>& batch) {
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+	if (ring->broken) {
+		for (Job* job : batch) {
+			job->ok = WriteFileAtomic(job->path.c_str(), job->encoded.data(), job->encoded.size());
+		}
+		return false;
+	}
+
+	// Temp files are opened synchronously, the data writes and fsyncs of the
+	// whole batch go to the kernel in one io_uring_enter.
+	unsigned pending = 0;
+	for (size_t i = 0; i < batch.size(); i++) {
+		Job* job = batch[i];
+		job->ok = false;
+		job->tmpPath = TempPathFor(job->path.c_str());
+		job->fd = open(job->tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (job->fd < 0) {
+			std::cout << "Failed to open " << job->tmpPath << " for writing" << std::endl;
+			continue;
+		}
+
+		io_uring_sqe* sqe = ring->NextSqe();
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = job->fd;
+		sqe->addr = reinterpret_cast<uint64_t>(job->encoded.data());
+		sqe->len = static_cast<uint32_t>(job->encoded.size());
+		sqe->off = 0;
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = i * 2;
+
+		sqe = ring->NextSqe();
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fd = job->fd;
+		sqe->user_data = i * 2 + 1;
+		pending += 2;
+	}
+
+	// Assume success until a completion says otherwise
+	for (Job* job : batch) {
+		job->ok = job->fd >= 0;
+	}
+
+	ring->Submit();
+	int consumed = ring->Enter(pending, pending);
+	bool ringOk = consumed >= 0;
+	unsigned unsubmitted = ringOk ? pending - static_cast<unsigned>(consumed) : 0;
+	unsigned reaped = 0;
+	while (ringOk && reaped < pending - unsubmitted) {
+		unsigned head = ring->cqHead->load(std::memory_order_relaxed);
+		unsigned tail = ring->cqTail->load(std::memory_order_acquire);
+		if (head == tail) {
+			consumed = ring->Enter(unsubmitted, 1);
+			ringOk = consumed >= 0;
+			unsubmitted -= ringOk ? static_cast<unsigned>(consumed) : 0;
+			continue;
+		}
+		for (; head != tail; ++head, ++reaped) {
+			const io_uring_cqe& cqe = ring->cqes[head & *ring->cqMask];
+			Job* job = batch[cqe.user_data / 2];
+			bool isWrite = (cqe.user_data % 2) == 0;
+			if (cqe.res < 0 || (isWrite && static_cast<size_t>(cqe.res) != job->encoded.size())) {
+				job->ok = false;
+			}
+		}
+		ring->cqHead->store(head, std::memory_order_release);
+	}
+	if (ringOk && unsubmitted > 0) {
+		// The kernel refused part of the batch; redo it the slow way
+		ring->broken = true;
+		ringOk = false;
+	}
+
+	for (Job* job : batch) {
+		if (job->fd < 0)
+			continue;
+		close(job->fd);
+		job->fd = -1;
+
+		const char* tmpPath = job->tmpPath.c_str();
+		if (!ringOk) {
+			// The ring broke mid-batch, fall back to a plain write, which uses
+			// a temp file of its own
+			remove(tmpPath);
+			job->ok = WriteFileAtomic(job->path.c_str(), job->encoded.data(), job->encoded.size());
+		} else if (job->ok && rename(tmpPath, job->path.c_str()) != 0) {
+			job->ok = false;
+		}
+		if (!job->ok) {
+			std::cout << "Failed to write " << job->path << std::endl;
+			if (ringOk)
+				remove(tmpPath);
+		}
+	}
+	return ringOk;
+#else
+	for (Job* job : batch) {
+		job->ok = WriteFileAtomic(job->path.c_str(), job->encoded.data(), job->encoded.size());
+	}
+	return true;
+#endif
+}
\ No newline at end of file
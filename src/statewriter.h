@@ -0,0 +1,80 @@
+#pragma once
+
+#include "state.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Persists savestates off the emulation thread.
+// Submit() only copies the State into a pooled job and returns; encoding,
+// checksumming and the atomic write-rename happen on background threads.
+// On Linux whole batches of writes and fsyncs go through a single io_uring
+// submission, elsewhere (or if the kernel refuses io_uring) a small pool of
+// threads performs blocking writes instead.
+class StateWriter {
+public:
+	// Called on a writer thread once the file is durable (or failed)
+	typedef std::function<void(const std::string& path, bool ok)> Callback;
+
+	StateWriter(unsigned int threads = 2, bool useUring = true);
+	~StateWriter();
+
+	StateWriter(const StateWriter&) = delete;
+	StateWriter& operator=(const StateWriter&) = delete;
+
+	void Submit(const State& state, uint64_t romHash, uint32_t quirks, bool compress,
+		const std::string& path, Callback callback = nullptr);
+	// Blocks until every submitted state has been written
+	void Flush();
+
+	bool UsingUring() const { return ring != nullptr; }
+	size_t QueueDepth() const { return queued.load(std::memory_order_relaxed); }
+
+	// Metrics
+	std::atomic<uint64_t> submitted{ 0 };
+	std::atomic<uint64_t> completed{ 0 };
+	std::atomic<uint64_t> failed{ 0 };
+	std::atomic<uint64_t> bytesWritten{ 0 };
+	std::atomic<uint64_t> batches{ 0 };
+	std::atomic<size_t> peakDepth{ 0 };
+
+private:
+	struct Job {
+		State state;
+		uint64_t romHash = 0;
+		uint32_t quirks = 0;
+		bool compress = false;
+		std::string path;
+		Callback callback;
+		std::vector<uint8_t> encoded;
+		// io_uring bookkeeping
+		std::string tmpPath;
+		int fd = -1;
+		bool ok = false;
+	};
+	struct Ring;
+
+	Job* Acquire();
+	void Release(Job* job);
+	void Finish(Job* job, bool ok);
+	void Worker();
+	void UringWorker();
+	bool WriteBatchUring(std::vector<Job*>& batch);
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::deque<Job*> queue;
+	std::vector<Job*> pool;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> queued{ 0 };
+	size_t inFlight = 0;
+	bool stopping = false;
+	Ring* ring = nullptr;
+};
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "threadpool.h"
+
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local int currentIndex = -1;
+
+ThreadPool::ThreadPool(unsigned int count) {
+	if (count == 0)
+		count = std::thread::hardware_concurrency();
+	if (count == 0)
+		count = 1;
+
+	for (unsigned int i = 0; i < count; i++) {
+		workers.emplace_back(new Worker());
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		threads.emplace_back(&ThreadPool::Run, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	Wait();
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		stopping = true;
+	}
+	sleep.notify_all();
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+int ThreadPool::WorkerIndex() const {
+	return currentPool == this ? currentIndex : -1;
+}
+
+void ThreadPool::Submit(Task task) {
+	int self = WorkerIndex();
+	unsigned int index = self >= 0 ? static_cast<unsigned int>(self)
+		: nextWorker.fetch_add(1, std::memory_order_relaxed) % Size();
+
+	pending.fetch_add(1);
+	queued.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> guard(workers[index]->lock);
+		workers[index]->tasks.push_back(std::move(task));
+	}
+	{
+		// Taking the lock orders this against a worker about to sleep
+		std::lock_guard<std::mutex> guard(sleepLock);
+	}
+	sleep.notify_one();
+}
+
+void ThreadPool::Wait() {
+	std::unique_lock<std::mutex> guard(sleepLock);
+	done.wait(guard, [this] { return pending.load() == 0; });
+}
+
+bool ThreadPool::Pop(unsigned int index, Task& task) {
+	Worker& w = *workers[index];
+	std::lock_guard<std::mutex> guard(w.lock);
+	if (w.tasks.empty())
+		return false;
+	task = std::move(w.tasks.back());
+	w.tasks.pop_back();
+	return true;
+}
+
+bool ThreadPool::Steal(unsigned int index, Task& task) {
+	unsigned int count = Size();
+	for (unsigned int i = 1; i < count; i++) {
+		Worker& victim = *workers[(index + i) % count];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			++steals;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::Run(unsigned int index) {
+	currentPool = this;
+	currentIndex = static_cast<int>(index);
+
+	Task task;
+	while (true) {
+		if (Pop(index, task) || Steal(index, task)) {
+			queued.fetch_sub(1);
+			task();
+			task = nullptr;
+			++executed;
+			if (pending.fetch_sub(1) == 1) {
+				std::lock_guard<std::mutex> guard(sleepLock);
+				done.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(sleepLock);
+		sleep.wait(guard, [this] { return stopping || queued.load() > 0; });
+		if (stopping && queued.load() == 0)
+			return;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Each worker owns a deque: it pushes and pops its own tasks at the back
+// (LIFO, so a task that re-submits itself stays hot in that core's cache)
+// and, when empty, steals the oldest task from the front of another worker.
+// The deques are mutex-guarded; tasks here are frame-sized slices, so the
+// lock is noise next to the work.
+class ThreadPool {
+public:
+	typedef std::function<void()> Task;
+
+	ThreadPool(unsigned int threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// From a worker the task goes to that worker's deque, otherwise round-robin
+	void Submit(Task task);
+	// Blocks until every submitted task, including re-submitted ones, has run.
+	// Not to be called from inside a task.
+	void Wait();
+
+	unsigned int Size() const { return static_cast<unsigned int>(workers.size()); }
+	// Index of the calling worker, or -1 outside the pool
+	int WorkerIndex() const;
+
+	// Metrics
+	std::atomic<uint64_t> executed{ 0 };
+	std::atomic<uint64_t> steals{ 0 };
+
+private:
+	struct Worker {
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	void Run(unsigned int index);
+	bool Pop(unsigned int index, Task& task);
+	bool Steal(unsigned int index, Task& task);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::atomic<uint32_t> nextWorker{ 0 };
+
+	std::mutex sleepLock;
+	std::condition_variable sleep;
+	std::condition_variable done;
+	// Tasks sitting in a deque
+	std::atomic<uint64_t> queued{ 0 };
+	// Tasks submitted but not finished
+	std::atomic<uint64_t> pending{ 0 };
+	bool stopping = false;
+};
\ No newline at end of file
@@ -0,0 +1,529 @@
+// Benchmark suite: every ROM in a directory and the generated opcode-family
+// ROMs under each execution engine, plus the draw opcode, colour conversion
+// and savestates. Reports ns/op, MIPS and heap allocations per op as JSON,
+// one benchmark per line, and compares against an earlier run so
+// regressions fail the run. With --counters it adds host cycles, IPC,
+// branch misses and L1d misses per op from the hardware counters (Linux).
+#include "chip8.h"
+#include "lockstep.h"
+#include "pagedstate.h"
+#include "palette.h"
+#include "perfcounters.h"
+#include "romgen.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#if defined(_WIN64) or defined(_WIN32)
+#include <malloc.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+#pragma region Allocation counting
+static std::atomic<uint64_t> allocations{ 0 };
+
+// Every replaced new allocates through Allocate and every delete frees
+// through Release, so GCC sees one matched pair (-Wmismatched-new-delete)
+// and over-aligned blocks go back to the allocator that made them
+static void* Allocate(size_t size, size_t alignment) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (!size)
+		size = 1;
+	void* p;
+	if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+		p = malloc(size);
+	} else {
+#if defined(_WIN64) or defined(_WIN32)
+		p = _aligned_malloc(size, alignment);
+#else
+		// aligned_alloc wants a whole number of alignments
+		p = aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+	}
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+static void Release(void* p, size_t alignment) {
+	if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+		free(p);
+	} else {
+#if defined(_WIN64) or defined(_WIN32)
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+}
+
+void* operator new(size_t size) {
+	return Allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new[](size_t size) {
+	return Allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	return Allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+	return Allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* p) noexcept {
+	Release(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void* p) noexcept {
+	Release(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	Release(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	Release(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void* p, std::align_val_t alignment) noexcept {
+	Release(p, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+	Release(p, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+	Release(p, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept {
+	Release(p, static_cast<size_t>(alignment));
+}
+#pragma endregion
+
+struct Options {
+	const char* romDir = "roms";
+	uint64_t instructions = 20000000;
+	unsigned int ips = 500;
+	unsigned int reps = 5;
+	// Outer loop multiplier of the generated opcode-family ROMs
+	unsigned int scale = 2;
+	const char* filter = nullptr;
+	const char* jsonPath = nullptr;
+	const char* baselinePath = nullptr;
+	// Allowed slowdown against the baseline before it counts as a regression
+	double threshold = 0.10;
+	bool counters = false;
+};
+
+// Counters of the benchmark thread, open with --counters
+static PerfCounters perf;
+
+struct Result {
+	std::string name;
+	uint64_t ops = 0;
+	// Fastest repetition
+	double seconds = 0;
+	double allocsPerOp = 0;
+	// Each op is one guest instruction
+	bool instructions = false;
+	double baseline = 0;
+	bool regression = false;
+	// Hardware counts of the fastest repetition
+	PerfSample counters;
+
+	double NsPerOp() const { return ops ? seconds / ops * 1e9 : 0; }
+};
+
+static void Usage() {
+	std::cout <<
+		"usage: chip8_bench [options]\n"
+		"  --roms <dir>          ROMs to run (default roms)\n"
+		"  --instructions <n>    guest instructions per ROM and engine (default 20000000)\n"
+		"  --ips <n>             guest instructions per second (default 500)\n"
+		"  --reps <n>            repetitions, the fastest counts (default 5)\n"
+		"  --scale <n>           length of the generated opcode-family ROMs (default 2)\n"
+		"  --filter <text>       only benchmarks whose name contains text\n"
+		"  --json <file>         write the results there instead of stdout\n"
+		"  --baseline <file>     earlier --json output to compare against\n"
+		"  --threshold <pct>     slowdown that counts as a regression (default 10)\n"
+		"  --counters            add hardware counters per op (Linux perf_event)\n";
+}
+
+// Runs body reps times. body returns the ops it did, and the fastest
+// repetition's time per op is kept.
+static Result Measure(const Options& o, const std::string& name, bool instructions, const std::function<uint64_t()>& body) {
+	Result result;
+	result.name = name;
+	result.instructions = instructions;
+	uint64_t totalOps = 0;
+	uint64_t before = allocations.load();
+	for (unsigned int r = 0; r < o.reps; r++) {
+		PerfSample countersBefore, countersAfter;
+		perf.Read(countersBefore);
+		Clock::time_point start = Clock::now();
+		uint64_t ops = body();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		perf.Read(countersAfter);
+		if (r == 0 || seconds / ops < result.seconds / result.ops) {
+			result.seconds = seconds;
+			result.ops = ops;
+			result.counters = countersAfter.Since(countersBefore);
+		}
+		totalOps += ops;
+	}
+	result.allocsPerOp = totalOps ? static_cast<double>(allocations.load() - before) / totalOps : 0;
+	return result;
+}
+
+#pragma region Benchmarks
+static uint64_t RunInterpreter(Chip8& c, const Options& o) {
+	c.Boot();
+	c.Seed(0);
+	for (uint64_t f = 0; c.cycles < o.instructions; f++) {
+		c.RunFrame(FrameInstructions(f, o.ips));
+	}
+	return c.cycles;
+}
+
+static uint64_t RunLockstep(Chip8& c, Lockstep<16>& engine, const Options& o) {
+	for (unsigned int l = 0; l < Lockstep<16>::Lanes; l++) {
+		c.Boot();
+		c.Seed(l);
+		engine.Load(l, c);
+	}
+	engine.laneInstructions = 0;
+	for (uint64_t f = 0; engine.laneInstructions < o.instructions; f++) {
+		engine.RunFrame(FrameInstructions(f, o.ips));
+	}
+	return engine.laneInstructions;
+}
+
+// A program of nothing but 8x8 draws at scattered positions, with one jump
+// back to the start at the end of RAM
+static void LoadDrawProgram(Chip8& c) {
+	c.Reset();
+	for (unsigned int i = 0; i < REGISTER_COUNT; i++) {
+		c.V[i] = static_cast<uint8_t>(Mix64(i) & 0x7Fu);
+	}
+	c.I = FONTSET_START_ADDRESS;
+	unsigned int addr = START_ADDRESS;
+	for (unsigned int n = 0; addr + 4 <= MEMORY_SIZE; n++, addr += 2) {
+		unsigned int x = n & 0xFu, y = (n >> 4) & 0xFu;
+		c.ram[addr] = static_cast<uint8_t>(0xD0u | x);
+		c.ram[addr + 1] = static_cast<uint8_t>((y << 4) | 0x8u);
+	}
+	c.ram[addr] = static_cast<uint8_t>(0x10u | (START_ADDRESS >> 8));
+	c.ram[addr + 1] = static_cast<uint8_t>(START_ADDRESS & 0xFFu);
+	c.pc = START_ADDRESS;
+	c.MarkAllDirty();
+	c.RehashMemory();
+}
+#pragma endregion
+
+#pragma region Baseline
+// Reads name and ns_per_op back out of an earlier run, one benchmark per line
+static bool LoadBaseline(const char* path, std::unordered_map<std::string, double>& baseline) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cout << "Failed to open baseline " << path << std::endl;
+		return false;
+	}
+	std::string line;
+	while (std::getline(file, line)) {
+		size_t name = line.find("\"name\": \"");
+		size_t ns = line.find("\"ns_per_op\": ");
+		if (name == std::string::npos || ns == std::string::npos)
+			continue;
+		name += 9;
+		size_t end = line.find('"', name);
+		if (end == std::string::npos)
+			continue;
+		baseline[line.substr(name, end - name)] = strtod(line.c_str() + ns + 13, nullptr);
+	}
+	return true;
+}
+#pragma endregion
+
+static void WriteJson(FILE* out, const Options& o, const std::vector<Result>& results) {
+	fprintf(out, "{\n");
+	fprintf(out, "  \"instructions\": %llu,\n", static_cast<unsigned long long>(o.instructions));
+	fprintf(out, "  \"ips\": %u,\n", o.ips);
+	fprintf(out, "  \"reps\": %u,\n", o.reps);
+	fprintf(out, "  \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		fprintf(out, "    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, \"mips\": %.3f, \"allocs_per_op\": %.6f",
+			r.name.c_str(), static_cast<unsigned long long>(r.ops), r.NsPerOp(),
+			r.instructions && r.seconds > 0 ? r.ops / r.seconds / 1e6 : 0.0, r.allocsPerOp);
+		if (r.baseline > 0) {
+			fprintf(out, ", \"baseline_ns_per_op\": %.3f, \"change\": %.4f, \"regression\": %s",
+				r.baseline, r.NsPerOp() / r.baseline - 1, r.regression ? "true" : "false");
+		}
+		const PerfSample& c = r.counters;
+		if (c.Has(PERF_CYCLES) && r.ops) {
+			fprintf(out, ", \"cycles_per_op\": %.2f", static_cast<double>(c[PERF_CYCLES]) / r.ops);
+			if (c.Has(PERF_INSTRUCTIONS))
+				fprintf(out, ", \"ipc\": %.3f", c.Ipc());
+			if (c.Has(PERF_BRANCH_MISSES))
+				fprintf(out, ", \"branch_misses_per_op\": %.4f", static_cast<double>(c[PERF_BRANCH_MISSES]) / r.ops);
+			if (c.Has(PERF_BRANCHES))
+				fprintf(out, ", \"branch_miss_rate\": %.4f", c.BranchMissRate());
+			if (c.Has(PERF_L1D_MISSES))
+				fprintf(out, ", \"l1d_misses_per_op\": %.4f", static_cast<double>(c[PERF_L1D_MISSES]) / r.ops);
+		}
+		fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if (!strcmp(arg, "--counters")) {
+			o.counters = true;
+			continue;
+		}
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--roms"))
+			o.romDir = value;
+		else if (!strcmp(arg, "--instructions"))
+			o.instructions = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--ips"))
+			o.ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--reps"))
+			o.reps = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--scale"))
+			o.scale = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--filter"))
+			o.filter = value;
+		else if (!strcmp(arg, "--json"))
+			o.jsonPath = value;
+		else if (!strcmp(arg, "--baseline"))
+			o.baselinePath = value;
+		else if (!strcmp(arg, "--threshold"))
+			o.threshold = strtod(value, nullptr) / 100;
+		else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+	if (o.instructions == 0 || o.ips == 0 || o.reps == 0) {
+		Usage();
+		return 2;
+	}
+	// Without counters the results just leave the fields out
+	if (o.counters)
+		perf.Open();
+
+	std::vector<std::string> roms;
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(o.romDir, error)) {
+		if (entry.is_regular_file())
+			roms.push_back(entry.path().string());
+	}
+	std::sort(roms.begin(), roms.end());
+
+	auto wanted = [&o](const std::string& name) {
+		return !o.filter || name.find(o.filter) != std::string::npos;
+	};
+
+	std::vector<Result> results;
+	std::unique_ptr<Chip8> c(new Chip8());
+	std::unique_ptr<Lockstep<16>> engine(new Lockstep<16>());
+
+	// Engines, per ROM
+	for (const std::string& path : roms) {
+		std::string rom = std::filesystem::path(path).stem().string();
+		if (!wanted("interpreter/" + rom) && !wanted("lockstep16/" + rom))
+			continue;
+		if (!c->LoadRom(path.c_str()))
+			return 1;
+		if (wanted("interpreter/" + rom))
+			results.push_back(Measure(o, "interpreter/" + rom, true, [&] { return RunInterpreter(*c, o); }));
+		if (wanted("lockstep16/" + rom))
+			results.push_back(Measure(o, "lockstep16/" + rom, true, [&] { return RunLockstep(*c, *engine, o); }));
+	}
+
+	// Generated ROMs, one instruction family each, run to their halt and
+	// checked against the state they must end in
+	for (unsigned int f = 0; f < ROM_FAMILY_COUNT; f++) {
+		std::string family = std::string("synthetic/") + RomFamilyName(static_cast<RomFamily>(f));
+		if (!wanted("interpreter/" + family) && !wanted("lockstep16/" + family))
+			continue;
+		GeneratedRom rom;
+		if (!GenerateRom(static_cast<RomFamily>(f), o.scale, 0, rom) || !c->LoadRom(rom.image))
+			return 1;
+		const uint64_t length = rom.expected.instructions;
+		if (wanted("interpreter/" + family)) {
+			results.push_back(Measure(o, "interpreter/" + family, true, [&] {
+				c->Boot();
+				return RunToHalt(*c, length);
+			}));
+			if (!rom.expected.Check(*c))
+				return 1;
+		}
+		if (wanted("lockstep16/" + family)) {
+			results.push_back(Measure(o, "lockstep16/" + family, true, [&] {
+				c->Boot();
+				for (unsigned int l = 0; l < Lockstep<16>::Lanes; l++) {
+					engine->Load(l, *c);
+				}
+				for (uint64_t i = 0; i < length; i++) {
+					engine->Step();
+				}
+				return length * Lockstep<16>::Lanes;
+			}));
+			engine->Store(Lockstep<16>::Lanes - 1, *c);
+			if (!rom.expected.Check(*c))
+				return 1;
+		}
+	}
+
+	// Draw-bound program: Dxyn and the odd jump
+	if (wanted("op_dxyn")) {
+		results.push_back(Measure(o, "op_dxyn", true, [&] {
+			LoadDrawProgram(*c);
+			uint64_t n = std::min<uint64_t>(o.instructions, 2000000);
+			for (uint64_t i = 0; i < n; i++) {
+				c->RunCycle();
+			}
+			return n;
+		}));
+	}
+
+	// Colour conversion, on a half lit screen
+	std::vector<uint32_t> video(VIDEO_WIDTH * VIDEO_HEIGHT), pixels(VIDEO_WIDTH * VIDEO_HEIGHT);
+	for (size_t i = 0; i < video.size(); i++) {
+		video[i] = (Mix64(i) & 1u) ? 0xFFFFFFFFu : 0;
+	}
+	const uint32_t fg = PackColor(0.05f, 1.0f, 0.05f, 1.0f), bg = PackColor(0.03f, 0.03f, 0.03f, 1.0f);
+	const unsigned int frames = 20000;
+	if (wanted("get_colored_pixel")) {
+		results.push_back(Measure(o, "get_colored_pixel", false, [&] {
+			for (unsigned int f = 0; f < frames; f++) {
+				for (size_t i = 0; i < video.size(); i++) {
+					pixels[i] = GetColoredPixel(video[i], fg, bg);
+				}
+			}
+			return static_cast<uint64_t>(frames) * video.size();
+		}));
+	}
+	if (wanted("texture_prep")) {
+		results.push_back(Measure(o, "texture_prep", false, [&] {
+			for (unsigned int f = 0; f < frames; f++) {
+				ColorizeVideo(video.data(), pixels.data(), video.size(), fg, bg);
+			}
+			return static_cast<uint64_t>(frames);
+		}));
+	}
+
+	// Savestates, flat and copy-on-write, of a core mid-game
+	if (!roms.empty() && (wanted("state_") || wanted("paged_"))) {
+		if (!c->LoadRom(roms[0].c_str()))
+			return 1;
+		c->Boot();
+		for (uint64_t f = 0; f < 600; f++) {
+			c->RunFrame(FrameInstructions(f, o.ips));
+		}
+		SaveStates savestates;
+		std::unique_ptr<State> state(new State());
+		const unsigned int count = 100000;
+		if (wanted("state_create")) {
+			results.push_back(Measure(o, "state_create", false, [&] {
+				for (unsigned int i = 0; i < count; i++) {
+					savestates.CreateState(c.get(), state.get());
+				}
+				return static_cast<uint64_t>(count);
+			}));
+		}
+		if (wanted("state_load")) {
+			savestates.CreateState(c.get(), state.get());
+			results.push_back(Measure(o, "state_load", false, [&] {
+				for (unsigned int i = 0; i < count; i++) {
+					savestates.Loadstate(c.get(), state.get());
+				}
+				return static_cast<uint64_t>(count);
+			}));
+		}
+
+		// One search fork: restore the parent, run a frame, capture the child.
+		// The three are timed together, paged_restore has the restore alone.
+		PagedState parent, child;
+		parent.Capture(*c);
+		if (wanted("paged_fork")) {
+			results.push_back(Measure(o, "paged_fork", false, [&] {
+				for (unsigned int i = 0; i < count; i++) {
+					parent.Restore(*c);
+					c->RunFrame(FrameInstructions(i, o.ips));
+					child.Capture(*c, &parent);
+				}
+				return static_cast<uint64_t>(count);
+			}));
+		}
+		if (wanted("paged_restore")) {
+			child.Capture(*c, &parent);
+			results.push_back(Measure(o, "paged_restore", false, [&] {
+				for (unsigned int i = 0; i < count; i++) {
+					((i & 1u) ? parent : child).Restore(*c);
+				}
+				return static_cast<uint64_t>(count);
+			}));
+		}
+	}
+
+	bool regressed = false;
+	if (o.baselinePath) {
+		std::unordered_map<std::string, double> baseline;
+		if (!LoadBaseline(o.baselinePath, baseline))
+			return 1;
+		for (Result& r : results) {
+			auto it = baseline.find(r.name);
+			if (it == baseline.end() || it->second <= 0)
+				continue;
+			r.baseline = it->second;
+			r.regression = r.NsPerOp() > r.baseline * (1 + o.threshold);
+			if (r.regression) {
+				// stderr, stdout may be carrying the JSON
+				std::cerr << "Regression: " << r.name << " " << r.baseline << " -> " << r.NsPerOp() << " ns/op" << std::endl;
+				regressed = true;
+			}
+		}
+	}
+
+	FILE* out = stdout;
+	if (o.jsonPath) {
+		out = fopen(o.jsonPath, "w");
+		if (!out) {
+			std::cout << "Failed to open " << o.jsonPath << std::endl;
+			return 1;
+		}
+	}
+	WriteJson(out, o, results);
+	if (out != stdout)
+		fclose(out);
+	return regressed ? 1 : 0;
+}
\ No newline at end of file
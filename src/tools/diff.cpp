@@ -0,0 +1,542 @@
+// Differential tester: runs the same ROMs and inputs through two execution
+// engines side by side, compares the full architectural state every N
+// instructions and, once they part, bisects to the first instruction after
+// which they differ and prints both states. The bundled ROMs and the
+// generated opcode-family ROMs run as parallel jobs, 16 seeded lanes each.
+#include "chip8.h"
+#include "hash.h"
+#include "lockstep.h"
+#include "pagedstate.h"
+#include "romgen.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+const unsigned int LANES = 16;
+
+struct Options {
+	std::vector<std::string> roms;
+	const char* romDir = "roms";
+	bool generated = true;
+	const char* moviePath = nullptr;
+	uint64_t instructions = 2000000;
+	uint64_t interval = 10000;
+	unsigned int ips = 500;
+	uint32_t quirks = 0;
+	unsigned int threads = 0;
+	std::string engines[2] = { "scalar", "lockstep" };
+	// Self-test: flip a RAM byte in lane 0 of the second engine at this instruction
+	uint64_t fault = UINT64_MAX;
+};
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_diff [options]\n"
+		"  --rom <file>           ROM to test, repeatable (default every ROM in --roms)\n"
+		"  --roms <dir>           directory of ROMs (default roms)\n"
+		"  --no-generated         skip the generated opcode-family ROMs\n"
+		"  --movie <file>         drive lane 0 from a movie, on the ROM it was recorded with\n"
+		"  --instructions <n>     instructions per lane (default 2000000)\n"
+		"  --interval <n>         compare every n instructions (default 10000)\n"
+		"  --ips <n>              guest instructions per second (default 500)\n"
+		"  --quirks <spec>        quirk profile\n"
+		"  --engines <a,b>        engines to compare: scalar, lockstep (default scalar,lockstep)\n"
+		"  --threads <n>          worker threads (default all cores)\n"
+		"  --fault <n>            corrupt the second engine at instruction n, to test the harness\n";
+}
+
+#pragma region Engines
+// An execution engine driving LANES instances at once
+class Engine {
+public:
+	virtual ~Engine() {}
+	// Copies a booted core into a lane
+	virtual void Load(unsigned int lane, Chip8& chip8) = 0;
+	virtual void SetKeys(unsigned int lane, uint16_t keys) = 0;
+	// n instructions on every loaded lane
+	virtual void Step(uint64_t n) = 0;
+	virtual void Tick() = 0;
+	virtual void Store(unsigned int lane, Chip8& chip8) = 0;
+	// One checkpoint to come back to while bisecting
+	virtual void Save() = 0;
+	virtual void Restore() = 0;
+	// A lane stopped short of undefined behaviour, or -1
+	virtual int OutOfBounds() const { return -1; }
+};
+
+// The reference: one Chip8 per lane through RunCycle
+class ScalarEngine : public Engine {
+public:
+	ScalarEngine() {
+		for (unsigned int l = 0; l < LANES; l++) {
+			cores[l].reset(new Chip8());
+		}
+	}
+
+	void Load(unsigned int lane, Chip8& c) override {
+		PagedState transfer;
+		transfer.Capture(c);
+		transfer.Restore(*cores[lane]);
+		cores[lane]->quirks = c.quirks;
+		count = std::max(count, lane + 1);
+	}
+	void SetKeys(unsigned int lane, uint16_t keys) override {
+		for (unsigned int k = 0; k < KEY_COUNT; k++) {
+			cores[lane]->keypad[k] = (keys >> k) & 1u;
+		}
+	}
+	// Checks every instruction first, the interpreter would scribble over
+	// whatever follows its arrays
+	void Step(uint64_t n) override {
+		for (unsigned int l = 0; l < count; l++) {
+			for (uint64_t i = 0; i < n && stopped < 0; i++) {
+				if (!cores[l]->NextInBounds()) {
+					stopped = static_cast<int>(l);
+					break;
+				}
+				cores[l]->RunCycle();
+			}
+		}
+	}
+	void Tick() override {
+		for (unsigned int l = 0; l < count; l++) {
+			cores[l]->RunTimers();
+		}
+	}
+	void Store(unsigned int lane, Chip8& c) override {
+		PagedState transfer;
+		transfer.Capture(*cores[lane]);
+		transfer.Restore(c);
+	}
+	void Save() override {
+		for (unsigned int l = 0; l < count; l++) {
+			checkpoints[l].Capture(*cores[l], &checkpoints[l]);
+		}
+	}
+	void Restore() override {
+		for (unsigned int l = 0; l < count; l++) {
+			checkpoints[l].Restore(*cores[l]);
+		}
+	}
+	int OutOfBounds() const override { return stopped; }
+
+private:
+	std::unique_ptr<Chip8> cores[LANES];
+	PagedState checkpoints[LANES];
+	unsigned int count = 0;
+	int stopped = -1;
+};
+
+class LockstepEngine : public Engine {
+public:
+	LockstepEngine() : engine(new Lockstep<LANES>()), checkpoint(new Lockstep<LANES>()) {}
+
+	void Load(unsigned int lane, Chip8& c) override { engine->Load(lane, c); }
+	void SetKeys(unsigned int lane, uint16_t keys) override { engine->SetKeys(lane, keys); }
+	void Step(uint64_t n) override {
+		for (uint64_t i = 0; i < n; i++) {
+			engine->Step();
+		}
+	}
+	void Tick() override { engine->RunTimers(); }
+	void Store(unsigned int lane, Chip8& c) override { engine->Store(lane, c); }
+	void Save() override { *checkpoint = *engine; }
+	void Restore() override { *engine = *checkpoint; }
+	int OutOfBounds() const override {
+		for (unsigned int l = 0; l < LANES; l++) {
+			if (engine->OutOfBounds(l))
+				return static_cast<int>(l);
+		}
+		return -1;
+	}
+
+private:
+	std::unique_ptr<Lockstep<LANES>> engine;
+	std::unique_ptr<Lockstep<LANES>> checkpoint;
+};
+
+static Engine* MakeEngine(const std::string& name) {
+	if (name == "scalar")
+		return new ScalarEngine();
+	if (name == "lockstep")
+		return new LockstepEngine();
+	return nullptr;
+}
+#pragma endregion
+
+#pragma region Inputs
+// Timer ticks and key changes by instruction count, applied before the
+// instruction at that count runs, the way MoviePlayer applies them
+struct Schedule {
+	std::vector<uint64_t> ticks;
+	std::vector<MovieEvent> keys[LANES];
+	unsigned int lanes = LANES;
+	uint64_t length = 0;
+};
+
+// Frames at ips with a key press roughly every other frame, different per lane
+static void FrameSchedule(const Options& o, Schedule& s) {
+	s.length = o.instructions;
+	uint64_t at = 0;
+	uint16_t last[LANES] = {};
+	for (uint64_t f = 0; at < s.length; f++) {
+		for (unsigned int l = 0; l < s.lanes; l++) {
+			uint64_t r = Mix64((static_cast<uint64_t>(l) << 32) ^ f);
+			uint16_t keys = (r & 0x10u) ? static_cast<uint16_t>(1u << (r & 0xFu)) : 0;
+			if (keys != last[l])
+				s.keys[l].push_back({ at, false, keys });
+			last[l] = keys;
+		}
+		at += FrameInstructions(f, o.ips);
+		s.ticks.push_back(at);
+	}
+}
+
+// Runs e from instruction from to instruction to. Events due at to are left
+// for the next call, so a state at position t never includes them.
+static void Advance(Engine& e, const Schedule& s, uint64_t from, uint64_t to, uint64_t fault, Chip8& scratch) {
+	size_t t = std::lower_bound(s.ticks.begin(), s.ticks.end(), from) - s.ticks.begin();
+	size_t k[LANES];
+	for (unsigned int l = 0; l < s.lanes; l++) {
+		k[l] = std::lower_bound(s.keys[l].begin(), s.keys[l].end(), from,
+			[](const MovieEvent& event, uint64_t at) { return event.at < at; }) - s.keys[l].begin();
+	}
+
+	for (uint64_t pos = from; pos < to;) {
+		for (; t < s.ticks.size() && s.ticks[t] == pos; t++) {
+			e.Tick();
+		}
+		uint64_t next = to;
+		if (t < s.ticks.size())
+			next = std::min(next, s.ticks[t]);
+		for (unsigned int l = 0; l < s.lanes; l++) {
+			for (; k[l] < s.keys[l].size() && s.keys[l][k[l]].at == pos; k[l]++) {
+				e.SetKeys(l, s.keys[l][k[l]].keys);
+			}
+			if (k[l] < s.keys[l].size())
+				next = std::min(next, s.keys[l][k[l]].at);
+		}
+		if (pos == fault) {
+			// Through Poke, so the page is marked dirty and memHash follows
+			e.Store(0, scratch);
+			uint8_t byte = scratch.ram[MEMORY_SIZE - 1] ^ 0x01;
+			scratch.Poke(MEMORY_SIZE - 1, &byte, 1);
+			e.Load(0, scratch);
+		}
+		if (fault > pos && fault < next)
+			next = fault;
+		e.Step(next - pos);
+		pos = next;
+	}
+}
+#pragma endregion
+
+#pragma region Comparison
+static bool Same(const Chip8& a, const Chip8& b) {
+	return a.StateHash() == b.StateHash()
+		&& a.memHash == b.memHash
+		&& !memcmp(a.plane, b.plane, sizeof(a.plane));
+}
+
+// First lane whose states differ, or -1
+static int FirstDifference(Engine& a, Engine& b, unsigned int lanes, Chip8& sa, Chip8& sb) {
+	for (unsigned int l = 0; l < lanes; l++) {
+		a.Store(l, sa);
+		b.Store(l, sb);
+		if (!Same(sa, sb))
+			return static_cast<int>(l);
+	}
+	return -1;
+}
+
+static void AppendState(std::string& out, const char* engine, const Chip8& c) {
+	char line[256];
+	snprintf(line, sizeof(line), "  %-9s pc=0x%03X opcode=0x%04X I=0x%03X sp=%u dt=%u st=%u cycles=%llu rng=%llu\n",
+		engine, c.pc, c.opcode, c.I, c.sp, c.delayTimer, c.soundTimer,
+		static_cast<unsigned long long>(c.cycles), static_cast<unsigned long long>(c.rngCounter));
+	out += line;
+	out += "            V=";
+	for (unsigned int r = 0; r < REGISTER_COUNT; r++) {
+		snprintf(line, sizeof(line), "%02X%s", c.V[r], r + 1 < REGISTER_COUNT ? " " : "\n");
+		out += line;
+	}
+	out += "            stack=";
+	for (unsigned int s = 0; s < STACK_LEVELS; s++) {
+		snprintf(line, sizeof(line), "%03X%s", c.stack[s], s + 1 < STACK_LEVELS ? " " : "\n");
+		out += line;
+	}
+}
+
+static void AppendDiff(std::string& out, const Chip8& a, const Chip8& b) {
+	char line[128];
+	unsigned int ram = 0, pixels = 0;
+	for (unsigned int i = 0; i < MEMORY_SIZE; i++) {
+		if (a.ram[i] == b.ram[i])
+			continue;
+		if (ram++ < 8) {
+			snprintf(line, sizeof(line), "  ram[0x%03X]: %02X vs %02X\n", i, a.ram[i], b.ram[i]);
+			out += line;
+		}
+	}
+	for (unsigned int p = 0; p < VIDEO_WIDTH * VIDEO_HEIGHT; p++) {
+		pixels += a.video[p] != b.video[p];
+	}
+	snprintf(line, sizeof(line), "  ram bytes differing=%u pixels differing=%u memhash %s\n",
+		ram, pixels, a.memHash == b.memHash ? "equal" : "differs");
+	out += line;
+}
+#pragma endregion
+
+struct Job {
+	std::string name;
+	std::vector<uint8_t> image;
+};
+
+struct Outcome {
+	uint64_t instructions = 0;
+	uint64_t compares = 0;
+	bool ok = true;
+	// Stopped early where the reference interpreter is undefined
+	bool undefined = false;
+	std::string report;
+};
+
+static void RunJob(const Options& o, const Job& job, const Movie* movie, Outcome& out) {
+	std::unique_ptr<Engine> a(MakeEngine(o.engines[0])), b(MakeEngine(o.engines[1]));
+	std::unique_ptr<Chip8> c(new Chip8()), sa(new Chip8()), sb(new Chip8());
+	c->LoadRom(job.image);
+	c->quirks = o.quirks;
+
+	Schedule s;
+	if (movie) {
+		// One lane, replaying the movie
+		s.lanes = 1;
+		s.length = movie->length;
+		std::vector<MovieEvent> events;
+		movie->Decode(events);
+		for (const MovieEvent& event : events) {
+			if (event.tick)
+				s.ticks.push_back(event.at);
+			else
+				s.keys[0].push_back(event);
+		}
+		c->quirks = movie->quirks;
+	} else {
+		FrameSchedule(o, s);
+	}
+
+	for (unsigned int l = 0; l < s.lanes; l++) {
+		c->Boot();
+		c->Seed(movie ? movie->seed : l);
+		a->Load(l, *c);
+		b->Load(l, *c);
+	}
+	a->Save();
+	b->Save();
+
+	for (uint64_t pos = 0; pos < s.length;) {
+		uint64_t next = std::min(s.length, pos + o.interval);
+		Advance(*a, s, pos, next, UINT64_MAX, *sa);
+		Advance(*b, s, pos, next, o.fault, *sb);
+		for (Engine* e : { a.get(), b.get() }) {
+			int lane = e->OutOfBounds();
+			if (lane < 0)
+				continue;
+			// Not a divergence: past this point the reference is undefined
+			char line[192];
+			e->Store(lane, *sa);
+			snprintf(line, sizeof(line), "%s: lane %d goes out of bounds at instruction %llu, pc=0x%03X opcode=0x%04X I=0x%03X sp=%u\n",
+				job.name.c_str(), lane, static_cast<unsigned long long>(sa->cycles + 1), sa->pc,
+				sa->pc + 1u < MEMORY_SIZE ? sa->ram[sa->pc] << 8 | sa->ram[sa->pc + 1] : 0, sa->I, sa->sp);
+			out.report += line;
+			out.instructions = sa->cycles;
+			out.undefined = true;
+			return;
+		}
+		out.compares++;
+		if (FirstDifference(*a, *b, s.lanes, *sa, *sb) < 0) {
+			a->Save();
+			b->Save();
+			out.instructions = next;
+			pos = next;
+			continue;
+		}
+
+		// The engines agree at lo and differ at hi
+		uint64_t lo = pos, hi = next;
+		while (hi - lo > 1) {
+			uint64_t mid = lo + (hi - lo) / 2;
+			a->Restore();
+			b->Restore();
+			Advance(*a, s, pos, mid, UINT64_MAX, *sa);
+			Advance(*b, s, pos, mid, o.fault, *sb);
+			if (FirstDifference(*a, *b, s.lanes, *sa, *sb) < 0)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		// Which lane parts at hi, then that lane's instruction at lo
+		char line[256];
+		a->Restore();
+		b->Restore();
+		Advance(*a, s, pos, hi, UINT64_MAX, *sa);
+		Advance(*b, s, pos, hi, o.fault, *sb);
+		int lane = FirstDifference(*a, *b, s.lanes, *sa, *sb);
+		a->Restore();
+		b->Restore();
+		Advance(*a, s, pos, lo, UINT64_MAX, *sa);
+		Advance(*b, s, pos, lo, o.fault, *sb);
+		a->Store(lane, *sa);
+		uint16_t pc = sa->pc;
+		uint16_t opcode = pc + 1u < MEMORY_SIZE ? static_cast<uint16_t>(sa->ram[pc] << 8 | sa->ram[pc + 1]) : 0;
+		Advance(*a, s, lo, hi, UINT64_MAX, *sa);
+		Advance(*b, s, lo, hi, o.fault, *sb);
+		a->Store(lane, *sa);
+		b->Store(lane, *sb);
+
+		snprintf(line, sizeof(line), "%s: %s and %s diverge at instruction %llu in lane %d, after pc=0x%03X opcode=0x%04X\n",
+			job.name.c_str(), o.engines[0].c_str(), o.engines[1].c_str(),
+			static_cast<unsigned long long>(hi), lane, pc, opcode);
+		out.report += line;
+		AppendState(out.report, o.engines[0].c_str(), *sa);
+		AppendState(out.report, o.engines[1].c_str(), *sb);
+		AppendDiff(out.report, *sa, *sb);
+		out.instructions = lo;
+		out.ok = false;
+		return;
+	}
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		bool takesValue = true;
+		if (!strcmp(arg, "--rom") && value)
+			o.roms.push_back(value);
+		else if (!strcmp(arg, "--roms") && value)
+			o.romDir = value;
+		else if (!strcmp(arg, "--movie") && value)
+			o.moviePath = value;
+		else if (!strcmp(arg, "--instructions") && value)
+			o.instructions = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--interval") && value)
+			o.interval = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--ips") && value)
+			o.ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--threads") && value)
+			o.threads = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--fault") && value)
+			o.fault = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--engines") && value) {
+			std::string list = value;
+			size_t comma = list.find(',');
+			if (comma == std::string::npos) {
+				Usage();
+				return 2;
+			}
+			o.engines[0] = list.substr(0, comma);
+			o.engines[1] = list.substr(comma + 1);
+		} else if (!strcmp(arg, "--quirks") && value) {
+			if (!ParseQuirks(value, o.quirks)) {
+				std::cout << "Unknown quirk profile " << value << std::endl;
+				return 2;
+			}
+		} else if (!strcmp(arg, "--no-generated")) {
+			o.generated = false;
+			takesValue = false;
+		} else {
+			Usage();
+			return 2;
+		}
+		if (takesValue)
+			i++;
+	}
+	for (const std::string& name : o.engines) {
+		std::unique_ptr<Engine> probe(MakeEngine(name));
+		if (!probe) {
+			std::cout << "Unknown engine " << name << std::endl;
+			return 2;
+		}
+	}
+	if (o.interval == 0 || o.ips == 0) {
+		Usage();
+		return 2;
+	}
+
+	std::vector<Job> jobs;
+	if (o.roms.empty()) {
+		std::error_code error;
+		for (const auto& entry : std::filesystem::directory_iterator(o.romDir, error)) {
+			if (entry.is_regular_file())
+				o.roms.push_back(entry.path().string());
+		}
+		std::sort(o.roms.begin(), o.roms.end());
+	}
+	for (const std::string& path : o.roms) {
+		std::ifstream is(path, std::ios::binary);
+		if (!is) {
+			std::cout << "Failed to open ROM " << path << std::endl;
+			return 1;
+		}
+		Job job;
+		job.name = path;
+		job.image.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+		jobs.push_back(std::move(job));
+	}
+
+	// A movie only fits the ROM it was recorded with
+	Movie movie;
+	if (o.moviePath) {
+		if (!movie.Load(o.moviePath))
+			return 1;
+		jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [&movie](const Job& job) {
+			return Hash64(job.image.data(), job.image.size()) != movie.romHash;
+		}), jobs.end());
+		if (jobs.empty()) {
+			std::cout << "No ROM matches the movie" << std::endl;
+			return 1;
+		}
+	} else if (o.generated) {
+		for (unsigned int f = 0; f < ROM_FAMILY_COUNT; f++) {
+			GeneratedRom rom;
+			if (!GenerateRom(static_cast<RomFamily>(f), 1, 0, rom))
+				return 1;
+			jobs.push_back({ "synthetic/" + rom.name, std::move(rom.image) });
+		}
+	}
+
+	unsigned int threads = o.threads ? o.threads : std::max(1u, std::thread::hardware_concurrency());
+	std::vector<Outcome> outcomes(jobs.size());
+	{
+		ThreadPool pool(threads);
+		for (size_t j = 0; j < jobs.size(); j++) {
+			pool.Submit([&o, &jobs, &outcomes, &movie, j] {
+				RunJob(o, jobs[j], o.moviePath ? &movie : nullptr, outcomes[j]);
+			});
+		}
+		pool.Wait();
+	}
+
+	unsigned int failures = 0;
+	for (size_t j = 0; j < jobs.size(); j++) {
+		const Outcome& r = outcomes[j];
+		printf("%s instructions=%llu compares=%llu %s\n", jobs[j].name.c_str(),
+			static_cast<unsigned long long>(r.instructions), static_cast<unsigned long long>(r.compares),
+			!r.ok ? "DIVERGED" : r.undefined ? "undefined" : "ok");
+		fputs(r.report.c_str(), stdout);
+		failures += !r.ok;
+	}
+	return failures ? 1 : 0;
+}
\ No newline at end of file
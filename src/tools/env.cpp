@@ -0,0 +1,129 @@
+// RL environment driver: steps a VecEnv with a random policy and reports
+// environment steps per second, the number an agent's sampler cares about.
+#include "env.h"
+#include "hash.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_env --rom <file> [options]\n"
+		"  --envs <n>        environments in the batch (default 256)\n"
+		"  --steps <n>       batched steps to run (default 1000)\n"
+		"  --frameskip <n>   frames per step, the action is held throughout (default 4)\n"
+		"  --stack <n>       frames per observation, up to 8 (default 4)\n"
+		"  --ips <n>         guest instructions per second (default 500)\n"
+		"  --max-frames <n>  truncate episodes after n frames (default 3600)\n"
+		"  --warmup <n>      frames run once before the snapshot episodes start from\n"
+		"  --quirks <spec>   quirk profile\n"
+		"  --score <spec>    byte:ADDR or bcd:ADDR[:DIGITS], reward is its change\n"
+		"  --done <spec>     halted or ram:ADDR=VALUE\n"
+		"  --threads <n>     worker threads (default 1)\n"
+		"  --seed <n>        base seed, also seeds the warmup (default 0)\n";
+}
+
+int main(int argc, char** argv) {
+	const char* romPath = nullptr;
+	unsigned int count = 256;
+	uint64_t steps = 1000;
+	unsigned int threads = 1;
+	uint64_t seed = 0;
+	EnvConfig config;
+	config.maxFrames = 3600;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--rom"))
+			romPath = value;
+		else if (!strcmp(arg, "--envs"))
+			count = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--steps"))
+			steps = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--frameskip"))
+			config.frameSkip = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--stack"))
+			config.frameStack = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--ips"))
+			config.ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--max-frames"))
+			config.maxFrames = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--warmup"))
+			config.warmupFrames = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--threads"))
+			threads = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--seed"))
+			seed = config.warmupSeed = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--quirks")) {
+			if (!ParseQuirks(value, config.quirks)) {
+				std::cout << "Unknown quirk profile " << value << std::endl;
+				return 2;
+			}
+		} else if (!strcmp(arg, "--score")) {
+			if (!ParseScore(value, config.score)) {
+				std::cout << "Bad score spec " << value << std::endl;
+				return 2;
+			}
+		} else if (!strcmp(arg, "--done")) {
+			if (!ParseDone(value, config.done)) {
+				std::cout << "Bad done spec " << value << std::endl;
+				return 2;
+			}
+		} else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+	if (!romPath || count == 0) {
+		Usage();
+		return 2;
+	}
+
+	VecEnv envs(count, config, threads);
+	if (!envs.LoadRom(romPath))
+		return 1;
+	envs.Reset(seed);
+
+	std::vector<uint16_t> actions(count);
+	std::vector<float> rewards(count);
+	std::vector<uint8_t> dones(count);
+	double totalReward = 0;
+	// Touch every observation each step, as a learner would
+	uint64_t checksum = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint64_t s = 0; s < steps; s++) {
+		for (unsigned int i = 0; i < count; i++) {
+			// Random policy: no key or one of the sixteen
+			uint64_t r = Mix64(seed ^ (s << 20) ^ i);
+			actions[i] = (r & 0x10u) ? static_cast<uint16_t>(1u << (r & 0xFu)) : 0;
+		}
+		envs.Step(actions.data(), rewards.data(), dones.data());
+		for (unsigned int i = 0; i < count; i++) {
+			totalReward += rewards[i];
+			checksum += envs.Observe(i).frames[0][0];
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("rom=%s\n", romPath);
+	printf("envs=%u\n", count);
+	printf("threads=%u\n", threads);
+	printf("steps=%llu\n", static_cast<unsigned long long>(envs.steps));
+	printf("episodes=%llu\n", static_cast<unsigned long long>(envs.episodes));
+	printf("reward=%.0f\n", totalReward);
+	printf("seconds=%.6f\n", seconds);
+	printf("steps_per_second=%.0f\n", envs.steps / seconds);
+	printf("frames_per_second=%.0f\n", envs.steps * config.frameSkip / seconds);
+	printf("observation_checksum=%016llx\n", static_cast<unsigned long long>(checksum));
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,382 @@
+// Fleet runner: many independent headless sessions (ROM x quirk profile x
+// seed, or ROM x movie) scheduled in frame-sized slices over a work-stealing pool.
+#include "chip8.h"
+#include "json.h"
+#include "movie.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct FleetConfig {
+	std::vector<std::string> roms;
+	std::vector<std::string> movies;
+	std::vector<std::string> quirks;
+	uint64_t seeds = 1;
+	uint64_t frames = 3600;
+	unsigned int ips = 500;
+	// Per-instance instruction cap, 0 for none
+	uint64_t budget = 0;
+	// Per-instance wall-clock watchdog in seconds, 0 for none
+	double timeout = 0;
+	unsigned int slice = 60;
+	unsigned int threads = 0;
+};
+
+struct Instance {
+	std::string rom;
+	std::string movieName;
+	std::string quirkName;
+	uint64_t seed = 0;
+
+	std::unique_ptr<Chip8> core;
+	const Movie* movie = nullptr;
+	MoviePlayer player;
+	uint64_t frame = 0;
+
+	const char* status = "ok";
+	Clock::time_point started;
+	bool hasStarted = false;
+	double busySeconds = 0;
+	uint64_t hash = 0;
+};
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_fleet --rom <file> [--rom ...] [options]\n"
+		"  --movie <file>    replay a movie on the ROM it was recorded with, once under its\n"
+		"                    own quirks and seed (repeatable)\n"
+		"  --quirks <spec>   quirk profile to run each ROM under (repeatable)\n"
+		"  --seeds <n>       instances per combination, seeded 0..n-1 (default 1)\n"
+		"  --frames <n>      frames per instance without a movie (default 3600)\n"
+		"  --ips <n>         guest instructions per second (default 500)\n"
+		"  --budget <n>      per-instance instruction budget\n"
+		"  --timeout <s>     per-instance wall-clock watchdog\n"
+		"  --slice <n>       frames per scheduling slice (default 60)\n"
+		"  --threads <n>     worker threads (default: all hardware threads)\n"
+		"  --csv <file>      write per-instance results as CSV\n"
+		"  --json <file>     write per-instance results and totals as JSON\n"
+		"  --scaling         rerun the fleet at 1, 2, 4 ... threads and report efficiency\n";
+}
+
+// Steps one instance for a slice, then queues its next slice on the same worker
+static void RunSlice(ThreadPool& pool, const FleetConfig& cfg, Instance& in) {
+	Clock::time_point t0 = Clock::now();
+	if (!in.hasStarted) {
+		in.started = t0;
+		in.hasStarted = true;
+	}
+
+	Chip8& c = *in.core;
+	uint64_t budget = cfg.budget ? cfg.budget : UINT64_MAX;
+	bool finished = false;
+
+	if (in.movie) {
+		uint64_t sliceEnd = c.cycles + static_cast<uint64_t>(cfg.slice) * cfg.ips / FRAME_RATE + 1;
+		in.player.Run(&c, std::min(sliceEnd, budget));
+		if (!in.player.IsPlaying()) {
+			finished = true;
+		} else if (c.cycles >= budget) {
+			in.status = "budget";
+			finished = true;
+		}
+	} else {
+		for (unsigned int f = 0; f < cfg.slice; f++) {
+			if (in.frame >= cfg.frames) {
+				finished = true;
+				break;
+			}
+			unsigned int n = FrameInstructions(in.frame, cfg.ips);
+			if (c.cycles + n > budget) {
+				in.status = "budget";
+				finished = true;
+				break;
+			}
+			c.RunFrame(n);
+			in.frame++;
+			if (c.IsHalted()) {
+				in.status = "halted";
+				finished = true;
+				break;
+			}
+		}
+	}
+
+	Clock::time_point t1 = Clock::now();
+	in.busySeconds += std::chrono::duration<double>(t1 - t0).count();
+	if (!finished && cfg.timeout > 0 && std::chrono::duration<double>(t1 - in.started).count() > cfg.timeout) {
+		in.status = "timeout";
+		finished = true;
+	}
+
+	if (finished) {
+		in.hash = c.StateHash();
+		return;
+	}
+	pool.Submit([&pool, &cfg, &in] { RunSlice(pool, cfg, in); });
+}
+
+static bool BuildFleet(const FleetConfig& cfg, const std::vector<std::unique_ptr<Movie>>& movies,
+	std::vector<std::unique_ptr<Instance>>& fleet) {
+	std::vector<std::string> quirkNames = cfg.quirks.empty() ? std::vector<std::string>{ "none" } : cfg.quirks;
+
+	for (const std::string& rom : cfg.roms) {
+		Chip8 probe;
+		if (!probe.LoadRom(rom.c_str()))
+			return false;
+
+		// Movies only make sense on the ROM they were recorded with
+		std::vector<int> movieIndex;
+		for (size_t m = 0; m < movies.size(); m++) {
+			if (movies[m]->romHash == probe.romHash)
+				movieIndex.push_back(static_cast<int>(m));
+		}
+
+		if (!movieIndex.empty()) {
+			// A movie brings its own quirks and seed, so it runs once rather
+			// than once per profile and seed
+			for (int m : movieIndex) {
+				std::unique_ptr<Instance> in(new Instance());
+				in->rom = rom;
+				in->movie = movies[m].get();
+				in->movieName = cfg.movies[m];
+				char quirkName[16];
+				snprintf(quirkName, sizeof(quirkName), "0x%x", in->movie->quirks);
+				in->quirkName = quirkName;
+				in->seed = in->movie->seed;
+				in->core.reset(new Chip8());
+				in->core->LoadRom(rom.c_str());
+				in->player.Start(in->core.get(), in->movie);
+				fleet.push_back(std::move(in));
+			}
+			continue;
+		}
+
+		for (const std::string& q : quirkNames) {
+			uint32_t quirks;
+			if (!ParseQuirks(q.c_str(), quirks)) {
+				std::cout << "Unknown quirk profile " << q << std::endl;
+				return false;
+			}
+			for (uint64_t seed = 0; seed < cfg.seeds; seed++) {
+				std::unique_ptr<Instance> in(new Instance());
+				in->rom = rom;
+				in->quirkName = q;
+				in->seed = seed;
+				in->core.reset(new Chip8());
+				in->core->quirks = quirks;
+				in->core->LoadRom(rom.c_str());
+				in->core->Seed(seed);
+				fleet.push_back(std::move(in));
+			}
+		}
+	}
+	return true;
+}
+
+struct FleetResult {
+	unsigned int threads = 0;
+	double wallSeconds = 0;
+	uint64_t cycles = 0;
+	uint64_t steals = 0;
+	double Mips() const { return wallSeconds > 0 ? cycles / wallSeconds / 1e6 : 0; }
+};
+
+static bool RunFleet(const FleetConfig& cfg, const std::vector<std::unique_ptr<Movie>>& movies,
+	unsigned int threads, std::vector<std::unique_ptr<Instance>>& fleet, FleetResult& result) {
+	fleet.clear();
+	if (!BuildFleet(cfg, movies, fleet))
+		return false;
+
+	ThreadPool pool(threads);
+	Clock::time_point start = Clock::now();
+	for (auto& in : fleet) {
+		Instance* p = in.get();
+		pool.Submit([&pool, &cfg, p] { RunSlice(pool, cfg, *p); });
+	}
+	pool.Wait();
+
+	result.threads = pool.Size();
+	result.wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	result.steals = pool.steals;
+	result.cycles = 0;
+	for (auto& in : fleet) {
+		result.cycles += in->core->cycles;
+	}
+	return true;
+}
+
+// RFC 4180 field: quoted, embedded quotes doubled, so commas, quotes and
+// line breaks in a path stay inside their column
+static std::string CsvQuote(const std::string& text) {
+	std::string out = "\"";
+	for (char c : text) {
+		if (c == '"')
+			out += '"';
+		out += c;
+	}
+	out += '"';
+	return out;
+}
+
+static void WriteCsv(FILE* f, const std::vector<std::unique_ptr<Instance>>& fleet) {
+	fprintf(f, "rom,movie,quirks,seed,status,cycles,frames,hash,seconds,mips\n");
+	for (auto& in : fleet) {
+		fprintf(f, "%s,%s,%s,%llu,%s,%llu,%llu,%016llx,%.6f,%.2f\n",
+			CsvQuote(in->rom).c_str(), CsvQuote(in->movieName).c_str(), CsvQuote(in->quirkName).c_str(),
+			static_cast<unsigned long long>(in->seed), in->status,
+			static_cast<unsigned long long>(in->core->cycles), static_cast<unsigned long long>(in->frame),
+			static_cast<unsigned long long>(in->hash), in->busySeconds,
+			in->busySeconds > 0 ? in->core->cycles / in->busySeconds / 1e6 : 0.0);
+	}
+}
+
+static void WriteJson(FILE* f, const std::vector<std::unique_ptr<Instance>>& fleet,
+	const FleetResult& total, const std::vector<FleetResult>& scaling) {
+	fprintf(f, "{\n  \"threads\": %u,\n  \"instances\": %zu,\n  \"wall_seconds\": %.6f,\n"
+		"  \"cycles\": %llu,\n  \"mips\": %.2f,\n  \"steals\": %llu,\n",
+		total.threads, fleet.size(), total.wallSeconds,
+		static_cast<unsigned long long>(total.cycles), total.Mips(), static_cast<unsigned long long>(total.steals));
+
+	fprintf(f, "  \"scaling\": [");
+	for (size_t i = 0; i < scaling.size(); i++) {
+		double speedup = scaling[i].Mips() / scaling[0].Mips();
+		fprintf(f, "%s\n    { \"threads\": %u, \"wall_seconds\": %.6f, \"mips\": %.2f, \"speedup\": %.3f, \"efficiency\": %.3f }",
+			i ? "," : "", scaling[i].threads, scaling[i].wallSeconds, scaling[i].Mips(), speedup, speedup / scaling[i].threads);
+	}
+	fprintf(f, "%s],\n", scaling.empty() ? "" : "\n  ");
+
+	fprintf(f, "  \"results\": [");
+	for (size_t i = 0; i < fleet.size(); i++) {
+		const Instance& in = *fleet[i];
+		fprintf(f, "%s\n    { \"rom\": \"%s\", \"movie\": \"%s\", \"quirks\": \"%s\", \"seed\": %llu, \"status\": \"%s\", "
+			"\"cycles\": %llu, \"frames\": %llu, \"hash\": \"%016llx\", \"seconds\": %.6f }",
+			i ? "," : "", JsonEscape(in.rom).c_str(), JsonEscape(in.movieName).c_str(), JsonEscape(in.quirkName).c_str(),
+			static_cast<unsigned long long>(in.seed), in.status,
+			static_cast<unsigned long long>(in.core->cycles), static_cast<unsigned long long>(in.frame),
+			static_cast<unsigned long long>(in.hash), in.busySeconds);
+	}
+	fprintf(f, "\n  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+	FleetConfig cfg;
+	const char* csvPath = nullptr;
+	const char* jsonPath = nullptr;
+	bool scaling = false;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!strcmp(arg, "--scaling")) {
+			scaling = true;
+			continue;
+		}
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--rom"))
+			cfg.roms.push_back(value);
+		else if (!strcmp(arg, "--movie"))
+			cfg.movies.push_back(value);
+		else if (!strcmp(arg, "--quirks"))
+			cfg.quirks.push_back(value);
+		else if (!strcmp(arg, "--seeds"))
+			cfg.seeds = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--frames"))
+			cfg.frames = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--ips"))
+			cfg.ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--budget"))
+			cfg.budget = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--timeout"))
+			cfg.timeout = atof(value);
+		else if (!strcmp(arg, "--slice"))
+			cfg.slice = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--threads"))
+			cfg.threads = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--csv"))
+			csvPath = value;
+		else if (!strcmp(arg, "--json"))
+			jsonPath = value;
+		else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+	if (cfg.roms.empty() || cfg.ips == 0 || cfg.slice == 0) {
+		Usage();
+		return 2;
+	}
+
+	std::vector<std::unique_ptr<Movie>> movies;
+	for (const std::string& path : cfg.movies) {
+		movies.emplace_back(new Movie());
+		if (!movies.back()->Load(path.c_str()))
+			return 1;
+	}
+
+	unsigned int maxThreads = cfg.threads ? cfg.threads : std::max(1u, std::thread::hardware_concurrency());
+	std::vector<FleetResult> scalingResults;
+	std::vector<std::unique_ptr<Instance>> fleet;
+	FleetResult total;
+
+	if (scaling) {
+		std::vector<unsigned int> counts;
+		for (unsigned int t = 1; t < maxThreads; t *= 2)
+			counts.push_back(t);
+		counts.push_back(maxThreads);
+
+		printf("threads  wall_s      mips    speedup  efficiency\n");
+		for (unsigned int t : counts) {
+			FleetResult r;
+			if (!RunFleet(cfg, movies, t, fleet, r))
+				return 1;
+			scalingResults.push_back(r);
+			double speedup = r.Mips() / scalingResults[0].Mips();
+			printf("%7u  %8.3f  %8.2f  %7.2fx  %9.1f%%\n", r.threads, r.wallSeconds, r.Mips(), speedup, 100.0 * speedup / r.threads);
+		}
+		total = scalingResults.back();
+	} else if (!RunFleet(cfg, movies, maxThreads, fleet, total)) {
+		return 1;
+	}
+
+	size_t failures = 0;
+	for (auto& in : fleet) {
+		if (!strcmp(in->status, "timeout") || !strcmp(in->status, "budget"))
+			failures++;
+	}
+	printf("instances=%zu threads=%u wall=%.3fs cycles=%llu mips=%.2f steals=%llu watchdog=%zu\n",
+		fleet.size(), total.threads, total.wallSeconds, static_cast<unsigned long long>(total.cycles),
+		total.Mips(), static_cast<unsigned long long>(total.steals), failures);
+
+	if (csvPath) {
+		FILE* f = fopen(csvPath, "w");
+		if (!f) {
+			std::cout << "Failed to write " << csvPath << std::endl;
+			return 1;
+		}
+		WriteCsv(f, fleet);
+		fclose(f);
+	}
+	if (jsonPath) {
+		FILE* f = fopen(jsonPath, "w");
+		if (!f) {
+			std::cout << "Failed to write " << jsonPath << std::endl;
+			return 1;
+		}
+		WriteJson(f, fleet, total, scalingResults);
+		fclose(f);
+	}
+	return 0;
+}
\ No newline at end of file
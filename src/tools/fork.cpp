@@ -0,0 +1,159 @@
+// Fork benchmark: grows a random tree of copy-on-write snapshots the way a
+// search over inputs does and reports what a fork costs in time and memory.
+#include "chip8.h"
+#include "hash.h"
+#include "pagedstate.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_fork --rom <file> [options]\n"
+		"  --nodes <n>    snapshots to grow the tree to (default 100000)\n"
+		"  --frames <n>   frames run between a node and its child (default 4)\n"
+		"  --ips <n>      guest instructions per second (default 500)\n"
+		"  --quirks <spec> quirk profile\n"
+		"  --seed <n>     seed for the RNG and the tree shape (default 0)\n";
+}
+
+struct Node {
+	PagedState state;
+	uint64_t hash;
+	// Full hash at capture time, IncrementalHash restores along with memHash
+	uint64_t check;
+};
+
+int main(int argc, char** argv) {
+	const char* romPath = nullptr;
+	unsigned int nodes = 100000;
+	unsigned int frames = 4;
+	unsigned int ips = 500;
+	uint32_t quirks = 0;
+	uint64_t seed = 0;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--rom"))
+			romPath = value;
+		else if (!strcmp(arg, "--nodes"))
+			nodes = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--frames"))
+			frames = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--ips"))
+			ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--seed"))
+			seed = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--quirks")) {
+			if (!ParseQuirks(value, quirks)) {
+				std::cout << "Unknown quirk profile " << value << std::endl;
+				return 2;
+			}
+		} else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+	if (!romPath || nodes == 0) {
+		Usage();
+		return 2;
+	}
+
+	Chip8 c;
+	if (!c.LoadRom(romPath))
+		return 1;
+	c.quirks = quirks;
+	c.Boot();
+	c.Seed(seed);
+
+	std::vector<Node> tree;
+	tree.reserve(nodes);
+	tree.emplace_back();
+	tree[0].state.Capture(c);
+	tree[0].hash = c.IncrementalHash();
+	tree[0].check = c.StateHash();
+	// Transposition check: distinct paths that reach the same state
+	std::unordered_set<uint64_t> seen;
+	seen.insert(tree[0].hash);
+	unsigned int duplicates = 0;
+
+	double restoreSeconds = 0, runSeconds = 0, captureSeconds = 0;
+	for (unsigned int n = 1; n < nodes; n++) {
+		// Expand a random node, biased towards recent ones like a best-first search
+		uint64_t r = Mix64(seed ^ n);
+		unsigned int span = n < 64 ? n : 64;
+		const Node& parent = tree[(r & 1u) ? n - 1 - (r >> 8) % span : (r >> 8) % n];
+
+		Clock::time_point t0 = Clock::now();
+		parent.state.Restore(c);
+		Clock::time_point t1 = Clock::now();
+		for (unsigned int k = 0; k < KEY_COUNT; k++) {
+			c.keypad[k] = ((r >> 40) & 0xFu) == k && (r & 0x10000u);
+		}
+		for (unsigned int f = 0; f < frames; f++) {
+			c.RunFrame(FrameInstructions(f, ips));
+		}
+		Clock::time_point t2 = Clock::now();
+		tree.emplace_back();
+		tree.back().state.Capture(c, &parent.state);
+		Clock::time_point t3 = Clock::now();
+		tree.back().hash = c.IncrementalHash();
+		tree.back().check = c.StateHash();
+		duplicates += !seen.insert(tree.back().hash).second;
+
+		restoreSeconds += std::chrono::duration<double>(t1 - t0).count();
+		runSeconds += std::chrono::duration<double>(t2 - t1).count();
+		captureSeconds += std::chrono::duration<double>(t3 - t2).count();
+	}
+
+	// A plain copy of a snapshot is the cheapest fork of all
+	size_t cloneCount = tree.size() < 10000 ? tree.size() : 10000;
+	std::vector<PagedState> clones(cloneCount);
+	Clock::time_point t0 = Clock::now();
+	for (size_t i = 0; i < cloneCount; i++) {
+		clones[i] = tree[i].state;
+	}
+	double cloneSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+	clones.clear();
+
+	// Every snapshot must still restore to exactly what was captured
+	unsigned int mismatches = 0;
+	for (size_t i = 0; i < tree.size(); i += 1 + tree.size() / 1000) {
+		tree[i].state.Restore(c);
+		if (c.StateHash() != tree[i].check)
+			mismatches++;
+	}
+
+	size_t owned = 0;
+	uint64_t pages = 0;
+	for (const Node& node : tree) {
+		owned += node.state.OwnedBytes();
+		pages += node.state.OwnedPages();
+	}
+
+	unsigned int forks = nodes - 1;
+	printf("rom=%s\n", romPath);
+	printf("nodes=%zu\n", tree.size());
+	printf("restore_ns=%.0f\n", forks ? restoreSeconds / forks * 1e9 : 0.0);
+	printf("capture_ns=%.0f\n", forks ? captureSeconds / forks * 1e9 : 0.0);
+	printf("run_ns=%.0f\n", forks ? runSeconds / forks * 1e9 : 0.0);
+	printf("clone_ns=%.0f\n", cloneSeconds / cloneCount * 1e9);
+	printf("pages_per_node=%.2f\n", static_cast<double>(pages) / tree.size());
+	printf("bytes_per_node=%.0f\n", static_cast<double>(owned) / tree.size());
+	printf("flat_state_bytes=%zu\n", sizeof(State));
+	printf("duplicate_states=%u\n", duplicates);
+	printf("mismatches=%u\n", mismatches);
+	return mismatches ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,297 @@
+// Fuzz target for the core, for libFuzzer (built with XCHIP8_LIBFUZZER) or
+// AFL (any build, input on stdin). An input is a ROM plus an input schedule:
+//   byte 0      quirk bits
+//   byte 1      RNG seed
+//   bytes 2-3   ROM length, little endian, clipped to what follows
+//   ROM
+//   3 bytes per schedule entry: frames to hold (byte + 1), key mask (LE)
+// Once the schedule runs out the keys are released and the run goes on up to
+// MAX_INSTRUCTIONS. The core is built with XCHIP8_CHECK_BOUNDS, so an
+// instruction that would index past ram, the stack or the keypad stops the
+// run and is counted by handler. XCHIP8_FUZZ_OOB=abort turns those into
+// crashes the fuzzer keeps instead.
+// Without libFuzzer this is also a driver that replays files and corpus
+// directories, or runs random inputs, and reports executions per second.
+#include "chip8.h"
+#include "hash.h"
+#include "pagedstate.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const uint64_t MAX_INSTRUCTIONS = 20000;
+static const unsigned int IPS = 600;
+static const size_t HEADER_SIZE = 4;
+
+enum Fault {
+	FAULT_FETCH,
+	FAULT_00EE,
+	FAULT_2NNN,
+	FAULT_DXYN,
+	FAULT_EX,
+	FAULT_FX33,
+	FAULT_FX55,
+	FAULT_FX65,
+	FAULT_COUNT
+};
+
+static const char* faultNames[FAULT_COUNT] = { "fetch", "00EE", "2nnn", "Dxyn", "Ex9E/ExA1", "Fx33", "Fx55", "Fx65" };
+
+struct Stats {
+	uint64_t execs = 0;
+	uint64_t instructions = 0;
+	uint64_t halted = 0;
+	uint64_t faults[FAULT_COUNT] = {};
+};
+
+struct Harness {
+	std::unique_ptr<Chip8> core;
+	// Freshly reset core with nothing loaded, every input restarts from here
+	// and only copies back the pages the last one wrote
+	PagedState blank;
+	bool abortOnFault = false;
+	Stats stats;
+
+	Harness() : core(new Chip8()) {
+		core->Reset();
+		blank.Capture(*core);
+		const char* oob = getenv("XCHIP8_FUZZ_OOB");
+		abortOnFault = oob && !strcmp(oob, "abort");
+	}
+};
+
+static Harness& GetHarness() {
+	static Harness harness;
+	return harness;
+}
+
+// The instruction the core refused, it is still at pc
+static Fault Classify(const Chip8& c) {
+	if (c.pc + 1u >= MEMORY_SIZE)
+		return FAULT_FETCH;
+	uint16_t op = static_cast<uint16_t>(c.ram[c.pc] << 8 | c.ram[c.pc + 1]);
+	switch (op >> 12u) {
+	case 0x0:
+		return FAULT_00EE;
+	case 0x2:
+		return FAULT_2NNN;
+	case 0xD:
+		return FAULT_DXYN;
+	case 0xE:
+		return FAULT_EX;
+	}
+	switch (op & 0x00FFu) {
+	case 0x33:
+		return FAULT_FX33;
+	case 0x55:
+		return FAULT_FX55;
+	}
+	return FAULT_FX65;
+}
+
+static void RunInput(const uint8_t* data, size_t size) {
+	Harness& h = GetHarness();
+	Chip8& c = *h.core;
+	h.stats.execs++;
+	if (size < HEADER_SIZE)
+		return;
+
+	size_t romSize = data[2] | data[3] << 8;
+	if (romSize > size - HEADER_SIZE)
+		romSize = size - HEADER_SIZE;
+	if (romSize > MEMORY_SIZE - START_ADDRESS)
+		romSize = MEMORY_SIZE - START_ADDRESS;
+
+	h.blank.Restore(c);
+	// The four Quirk bits
+	c.quirks = data[0] & 0x0Fu;
+	c.Seed(data[1]);
+	c.Poke(START_ADDRESS, data + HEADER_SIZE, romSize);
+
+	const uint8_t* schedule = data + HEADER_SIZE + romSize;
+	const uint8_t* end = data + size;
+	uint64_t frame = 0;
+	while (c.cycles < MAX_INSTRUCTIONS) {
+		unsigned int hold = ~0u;
+		uint16_t keys = 0;
+		if (end - schedule >= 3) {
+			hold = schedule[0] + 1u;
+			keys = static_cast<uint16_t>(schedule[1] | schedule[2] << 8);
+			schedule += 3;
+		}
+		for (unsigned int k = 0; k < KEY_COUNT; k++) {
+			c.keypad[k] = (keys >> k) & 1u;
+		}
+
+		for (unsigned int f = 0; f < hold && c.cycles < MAX_INSTRUCTIONS; f++, frame++) {
+			c.RunFrame(FrameInstructions(frame, IPS));
+			if (c.outOfBounds) {
+				Fault fault = Classify(c);
+				h.stats.faults[fault]++;
+				h.stats.instructions += c.cycles;
+				if (h.abortOnFault) {
+					printf("Out of bounds %s at pc=0x%03X I=0x%03X sp=%u\n", faultNames[fault], c.pc, c.I, c.sp);
+					fflush(stdout);
+					abort();
+				}
+				return;
+			}
+			if (c.IsHalted()) {
+				h.stats.halted++;
+				h.stats.instructions += c.cycles;
+				return;
+			}
+		}
+	}
+	h.stats.instructions += c.cycles;
+}
+
+static void PrintStats(double seconds) {
+	const Stats& s = GetHarness().stats;
+	uint64_t faults = 0;
+	for (uint64_t n : s.faults) {
+		faults += n;
+	}
+	printf("execs=%llu seconds=%.3f execs_per_sec=%.0f instructions=%llu mips=%.2f halted=%llu out_of_bounds=%llu\n",
+		static_cast<unsigned long long>(s.execs), seconds, seconds > 0 ? s.execs / seconds : 0.0,
+		static_cast<unsigned long long>(s.instructions), seconds > 0 ? s.instructions / seconds / 1e6 : 0.0,
+		static_cast<unsigned long long>(s.halted), static_cast<unsigned long long>(faults));
+	for (unsigned int f = 0; f < FAULT_COUNT; f++) {
+		if (s.faults[f])
+			printf("  %-10s %llu\n", faultNames[f], static_cast<unsigned long long>(s.faults[f]));
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	RunInput(data, size);
+	return 0;
+}
+
+#ifdef XCHIP8_LIBFUZZER
+// libFuzzer reports exec/s itself, add the guest side when it exits
+static Clock::time_point startTime;
+
+static void PrintStatsAtExit() {
+	PrintStats(std::chrono::duration<double>(Clock::now() - startTime).count());
+}
+
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+	startTime = Clock::now();
+	GetHarness();
+	atexit(PrintStatsAtExit);
+	return 0;
+}
+#else
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_fuzz [options] [file|dir ...]\n"
+		"  Runs every file once, directories recursively. Without files and\n"
+		"  without --random the input is read from stdin, in an AFL\n"
+		"  persistent loop when built with afl-clang-fast.\n"
+		"  --random <n>     run n random inputs instead\n"
+		"  --size <bytes>   largest random input (default 1024)\n"
+		"  --seed <n>       random input seed (default 0)\n";
+}
+
+static bool ReadFile(const std::filesystem::path& path, std::vector<uint8_t>& data) {
+	std::ifstream is(path, std::ios::binary);
+	if (!is) {
+		std::cout << "Failed to open " << path.string() << std::endl;
+		return false;
+	}
+	data.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+	return true;
+}
+
+static void ReadStdin(std::vector<uint8_t>& data) {
+	data.clear();
+	uint8_t buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+		data.insert(data.end(), buffer, buffer + n);
+	}
+}
+
+int main(int argc, char** argv) {
+	uint64_t randomCount = 0;
+	size_t maxSize = 1024;
+	uint64_t seed = 0;
+	std::vector<std::string> paths;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if (arg[0] != '-') {
+			paths.push_back(arg);
+			continue;
+		}
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--random"))
+			randomCount = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--size"))
+			maxSize = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--seed"))
+			seed = strtoull(value, nullptr, 0);
+		else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+
+	GetHarness();
+	std::vector<uint8_t> data;
+	Clock::time_point start = Clock::now();
+
+	if (randomCount) {
+		if (maxSize < HEADER_SIZE)
+			maxSize = HEADER_SIZE;
+		uint64_t counter = seed * 0x9E3779B97F4A7C15ull;
+		for (uint64_t n = 0; n < randomCount; n++) {
+			data.resize(HEADER_SIZE + Mix64(++counter) % (maxSize - HEADER_SIZE + 1));
+			for (size_t i = 0; i < data.size(); i += 8) {
+				uint64_t word = Mix64(++counter);
+				memcpy(&data[i], &word, data.size() - i < 8 ? data.size() - i : 8);
+			}
+			RunInput(data.data(), data.size());
+		}
+	} else if (!paths.empty()) {
+		for (const std::string& path : paths) {
+			std::error_code error;
+			if (std::filesystem::is_directory(path, error)) {
+				for (const auto& entry : std::filesystem::recursive_directory_iterator(path, error)) {
+					if (entry.is_regular_file() && ReadFile(entry.path(), data))
+						RunInput(data.data(), data.size());
+				}
+			} else if (ReadFile(path, data)) {
+				RunInput(data.data(), data.size());
+			}
+		}
+	} else {
+#ifdef __AFL_LOOP
+		while (__AFL_LOOP(10000)) {
+			ReadStdin(data);
+			RunInput(data.data(), data.size());
+		}
+#else
+		ReadStdin(data);
+		RunInput(data.data(), data.size());
+#endif
+	}
+
+	PrintStats(std::chrono::duration<double>(Clock::now() - start).count());
+	return 0;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,382 @@
+// Golden-frame regression runner: boots every ROM of a corpus headlessly,
+// drives it for a fixed number of frames and records the framebuffer every
+// few frames. Compares against a stored manifest and writes a PNG per
+// failing ROM, expected, actual and their difference side by side. ROMs run
+// as parallel jobs, one core each.
+// Input comes from <rom>.movie next to the ROM when there is one, otherwise
+// from a key schedule derived from the ROM's hash, so runs are repeatable.
+#include "chip8.h"
+#include "hash.h"
+#include "movie.h"
+#include "palette.h"
+#include "png.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// Run settings, stored in the manifest header so comparisons always rerun
+// the way the manifest was made
+struct Settings {
+	unsigned int frames = 600;
+	unsigned int interval = 60;
+	unsigned int ips = 500;
+	uint32_t quirks = 0;
+};
+
+struct Options {
+	std::vector<std::string> roms;
+	const char* romDir = "roms";
+	const char* manifestPath = "golden.txt";
+	const char* diffDir = "golden_diffs";
+	bool update = false;
+	unsigned int threads = 0;
+	Settings settings;
+};
+
+struct Checkpoint {
+	unsigned int frame = 0;
+	uint64_t plane[VIDEO_HEIGHT] = {};
+};
+
+struct Job {
+	std::string path;
+	// Path relative to the corpus directory, the manifest key
+	std::string name;
+	std::vector<Checkpoint> checkpoints;
+	// Frame at which an out of bounds instruction stopped the core, 0 if none
+	unsigned int faultFrame = 0;
+	bool movie = false;
+	bool failed = false;
+};
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_golden [options]\n"
+		"  --rom <file>        ROM to run, repeatable (default every .ch8 under --roms)\n"
+		"  --roms <dir>        corpus directory, searched recursively (default roms)\n"
+		"  --manifest <file>   golden manifest (default golden.txt)\n"
+		"  --update            write the manifest from this run instead of comparing\n"
+		"  --diffs <dir>       where failing ROMs get their PNG (default golden_diffs)\n"
+		"  --threads <n>       worker threads (default all cores)\n"
+		"  with --update only, the rest comes from the manifest:\n"
+		"  --frames <n>        frames per ROM (default 600)\n"
+		"  --interval <n>      frames between checkpoints (default 60)\n"
+		"  --ips <n>           guest instructions per second (default 500)\n"
+		"  --quirks <spec>     quirk profile\n";
+}
+
+#pragma region Running
+// Holds a key for half a second at a time, or nothing
+static uint16_t ScheduledKeys(uint64_t romHash, unsigned int frame) {
+	uint64_t r = Mix64(romHash ^ (frame / 30));
+	return (r & 3u) ? static_cast<uint16_t>(1u << ((r >> 8) & 15u)) : 0;
+}
+
+static void Run(const Settings& s, Job& job) {
+	std::unique_ptr<Chip8> c(new Chip8());
+	if (!c->LoadRom(job.path.c_str())) {
+		job.failed = true;
+		return;
+	}
+	c->quirks = s.quirks;
+	// The constructor seeds from the clock
+	c->Seed(c->romHash);
+
+	Movie movie;
+	MoviePlayer player;
+	std::filesystem::path moviePath = std::filesystem::path(job.path).replace_extension(".movie");
+	std::error_code error;
+	if (std::filesystem::exists(moviePath, error)) {
+		if (!movie.Load(moviePath.string().c_str()) || !player.Start(c.get(), &movie)) {
+			job.failed = true;
+			return;
+		}
+		job.movie = true;
+	}
+
+	uint64_t limit = 0;
+	for (unsigned int f = 0; f < s.frames; f++) {
+		unsigned int n = FrameInstructions(f, s.ips);
+		// Either way, stop rather than let the ROM scribble over the heap,
+		// the frame stays as it was from here on
+		if (job.movie && !job.faultFrame) {
+			// The movie brings its own keys and timer ticks
+			limit += n;
+			while (c->cycles < limit && player.Apply(c.get())) {
+				if (!c->NextInBounds()) {
+					job.faultFrame = f + 1;
+					break;
+				}
+				c->RunCycle();
+			}
+		} else if (!job.faultFrame) {
+			uint16_t keys = ScheduledKeys(c->romHash, f);
+			for (unsigned int k = 0; k < KEY_COUNT; k++) {
+				c->keypad[k] = (keys >> k) & 1u;
+			}
+			for (unsigned int i = 0; i < n; i++) {
+				if (!c->NextInBounds()) {
+					job.faultFrame = f + 1;
+					break;
+				}
+				c->RunCycle();
+			}
+			c->RunTimers();
+		}
+
+		if ((f + 1) % s.interval == 0) {
+			job.checkpoints.emplace_back();
+			job.checkpoints.back().frame = f + 1;
+			memcpy(job.checkpoints.back().plane, c->plane, sizeof(c->plane));
+		}
+	}
+}
+#pragma endregion
+
+#pragma region Manifest
+// A header line with the settings, then one line per checkpoint:
+// frame hash plane name, the plane as 32 words of 16 hex digits. The name
+// comes last and runs to the end of the line, so it may hold spaces.
+static bool SaveManifest(const char* path, const Settings& s, const std::vector<Job>& jobs) {
+	std::ofstream os(path);
+	if (!os) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	os << "# xchip8_golden frames=" << s.frames << " interval=" << s.interval
+		<< " ips=" << s.ips << " quirks=" << s.quirks << "\n";
+	char hex[17];
+	for (const Job& job : jobs) {
+		if (job.failed)
+			continue;
+		for (const Checkpoint& cp : job.checkpoints) {
+			snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(Hash64(cp.plane, sizeof(cp.plane))));
+			os << cp.frame << ' ' << hex << ' ';
+			for (uint64_t row : cp.plane) {
+				snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(row));
+				os << hex;
+			}
+			os << ' ' << job.name << "\n";
+		}
+	}
+	return static_cast<bool>(os);
+}
+
+static bool LoadManifest(const char* path, Settings& s, std::map<std::string, std::vector<Checkpoint>>& golden) {
+	std::ifstream is(path);
+	if (!is) {
+		std::cout << "Failed to open manifest " << path << ", create it with --update" << std::endl;
+		return false;
+	}
+	std::string line;
+	if (!std::getline(is, line) || sscanf(line.c_str(), "# xchip8_golden frames=%u interval=%u ips=%u quirks=%u",
+		&s.frames, &s.interval, &s.ips, &s.quirks) != 4 || !s.interval) {
+		std::cout << "Bad manifest header in " << path << std::endl;
+		return false;
+	}
+	while (std::getline(is, line)) {
+		std::istringstream ls(line);
+		std::string name, hash, plane;
+		Checkpoint cp;
+		if (!(ls >> cp.frame >> hash >> plane) || plane.size() != VIDEO_HEIGHT * 16
+			|| ls.get() != ' ' || !std::getline(ls, name) || name.empty()) {
+			std::cout << "Bad manifest line: " << line << std::endl;
+			return false;
+		}
+		// A manifest checked out with CRLF line endings
+		if (name.back() == '\r')
+			name.pop_back();
+		for (unsigned int y = 0; y < VIDEO_HEIGHT; y++) {
+			cp.plane[y] = strtoull(plane.substr(y * 16, 16).c_str(), nullptr, 16);
+		}
+		golden[name].push_back(cp);
+	}
+	return true;
+}
+#pragma endregion
+
+// Expected, actual and the difference at 4x: red only expected, green only
+// actual, grey both
+static bool WriteDiff(const std::string& path, const Checkpoint& expected, const Checkpoint& actual) {
+	const unsigned int SCALE = 4, GAP = 4;
+	const unsigned int width = 3 * VIDEO_WIDTH * SCALE + 2 * GAP, height = VIDEO_HEIGHT * SCALE;
+	const uint32_t off = PackColor(0, 0, 0, 1), on = PackColor(0.8f, 0.8f, 0.8f, 1);
+	const uint32_t missing = PackColor(1, 0.2f, 0.2f, 1), extra = PackColor(0.2f, 1, 0.2f, 1);
+	std::vector<uint32_t> pixels(width * height, PackColor(0.25f, 0.25f, 0.25f, 1));
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y++) {
+		for (unsigned int x = 0; x < VIDEO_WIDTH; x++) {
+			bool e = (expected.plane[y] >> (63 - x)) & 1u;
+			bool a = (actual.plane[y] >> (63 - x)) & 1u;
+			uint32_t colors[3] = { e ? on : off, a ? on : off, e && a ? on : e ? missing : a ? extra : off };
+			for (unsigned int panel = 0; panel < 3; panel++) {
+				unsigned int left = panel * (VIDEO_WIDTH * SCALE + GAP) + x * SCALE;
+				for (unsigned int dy = 0; dy < SCALE; dy++) {
+					std::fill_n(&pixels[(y * SCALE + dy) * width + left], SCALE, colors[panel]);
+				}
+			}
+		}
+	}
+	return WritePng(path.c_str(), pixels.data(), width, height);
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if (!strcmp(arg, "--update")) {
+			o.update = true;
+			continue;
+		}
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--rom"))
+			o.roms.push_back(value);
+		else if (!strcmp(arg, "--roms"))
+			o.romDir = value;
+		else if (!strcmp(arg, "--manifest"))
+			o.manifestPath = value;
+		else if (!strcmp(arg, "--diffs"))
+			o.diffDir = value;
+		else if (!strcmp(arg, "--threads"))
+			o.threads = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--frames"))
+			o.settings.frames = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--interval"))
+			o.settings.interval = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--ips"))
+			o.settings.ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--quirks")) {
+			if (!ParseQuirks(value, o.settings.quirks)) {
+				std::cout << "Unknown quirk profile " << value << std::endl;
+				return 2;
+			}
+		} else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+	if (!o.settings.interval) {
+		Usage();
+		return 2;
+	}
+
+	std::map<std::string, std::vector<Checkpoint>> golden;
+	if (!o.update && !LoadManifest(o.manifestPath, o.settings, golden))
+		return 2;
+
+	// The corpus, sorted so the manifest comes out in a stable order
+	std::vector<Job> jobs;
+	std::error_code error;
+	if (o.roms.empty()) {
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(o.romDir, error)) {
+			if (entry.is_regular_file() && entry.path().extension() == ".ch8") {
+				jobs.emplace_back();
+				jobs.back().path = entry.path().string();
+				jobs.back().name = entry.path().lexically_relative(o.romDir).generic_string();
+			}
+		}
+	} else {
+		for (const std::string& rom : o.roms) {
+			jobs.emplace_back();
+			jobs.back().path = rom;
+			jobs.back().name = std::filesystem::path(rom).lexically_relative(o.romDir).generic_string();
+		}
+	}
+	if (jobs.empty()) {
+		std::cout << "No ROMs found in " << o.romDir << std::endl;
+		return 2;
+	}
+	std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.name < b.name; });
+
+	Clock::time_point start = Clock::now();
+	{
+		ThreadPool pool(o.threads);
+		for (Job& job : jobs) {
+			pool.Submit([&o, &job] { Run(o.settings, job); });
+		}
+		pool.Wait();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	unsigned int failed = 0, added = 0, passed = 0;
+	for (const Job& job : jobs) {
+		if (job.failed) {
+			printf("%s: could not run\n", job.name.c_str());
+			failed++;
+		}
+		if (job.faultFrame)
+			printf("%s: out of bounds at frame %u, frozen from there\n", job.name.c_str(), job.faultFrame);
+	}
+
+	if (o.update) {
+		if (!SaveManifest(o.manifestPath, o.settings, jobs))
+			return 2;
+		printf("roms=%zu seconds=%.3f wrote %s\n", jobs.size(), seconds, o.manifestPath);
+		return failed ? 1 : 0;
+	}
+
+	for (const Job& job : jobs) {
+		if (job.failed)
+			continue;
+		auto it = golden.find(job.name);
+		if (it == golden.end()) {
+			printf("%s: not in the manifest\n", job.name.c_str());
+			added++;
+			continue;
+		}
+		// Taken out of the map, whatever is left at the end has no ROM
+		std::vector<Checkpoint> expected = std::move(it->second);
+		golden.erase(it);
+
+		size_t count = std::min(expected.size(), job.checkpoints.size());
+		size_t bad = count;
+		for (size_t i = 0; i < count && bad == count; i++) {
+			if (expected[i].frame != job.checkpoints[i].frame
+				|| memcmp(expected[i].plane, job.checkpoints[i].plane, sizeof(expected[i].plane)))
+				bad = i;
+		}
+		if (bad == count && expected.size() == job.checkpoints.size()) {
+			passed++;
+			continue;
+		}
+
+		failed++;
+		if (bad == count) {
+			printf("%s: %zu checkpoints, manifest has %zu\n", job.name.c_str(), job.checkpoints.size(), expected.size());
+			continue;
+		}
+		std::filesystem::create_directories(o.diffDir, error);
+		std::string file = job.name;
+		std::replace(file.begin(), file.end(), '/', '_');
+		std::string png = (std::filesystem::path(o.diffDir) / (file + "_" + std::to_string(job.checkpoints[bad].frame) + ".png")).string();
+		WriteDiff(png, expected[bad], job.checkpoints[bad]);
+		printf("%s: FAIL at frame %u%s, see %s\n", job.name.c_str(), job.checkpoints[bad].frame,
+			job.movie ? " (movie)" : "", png.c_str());
+	}
+	for (const auto& missing : golden) {
+		printf("%s: in the manifest but not in the corpus\n", missing.first.c_str());
+	}
+
+	printf("roms=%zu passed=%u failed=%u new=%u missing=%zu seconds=%.3f\n",
+		jobs.size(), passed, failed, added, golden.size(), seconds);
+	return failed ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,200 @@
+// Headless runner: boots a ROM without a window and runs it as fast as the
+// core goes, for CI and batch farms. Prints the final state hash and speed.
+#include "chip8.h"
+#include "movie.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_headless --rom <file> [options]\n"
+		"  --cycles <n>    run n instructions\n"
+		"  --frames <n>    run n 60Hz frames (default 600)\n"
+		"  --ips <n>       instructions per second of guest time (default 500)\n"
+		"  --quirks <spec> none, vip, schip, a list like shift,jump or a number\n"
+		"  --seed <n>      RNG seed (default 0)\n"
+		"  --movie <file>  replay a movie instead of running frames\n"
+		"  --screen        print the final framebuffer\n"
+		"  --pbm <file>    write the final framebuffer as a PBM image\n"
+		"  --profile <file> write per-opcode counts and sampled host cycles as CSV\n"
+		"  --heatmap <file> write the guest memory heatmap, see profile.h\n"
+		"  --folded <file> write subroutine call stacks for flame graphs\n"
+		"  --labels <file> Octo-style symbols for --folded\n"
+		"                  (these need a build with XCHIP8_PROFILE)\n"
+		"  --zones <file>  write host timing zones as Chrome trace JSON\n"
+		"                  (needs a build with XCHIP8_ZONES)\n";
+}
+
+static bool WritePbm(const char* path, const Chip8& c) {
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+	fprintf(f, "P4\n%d %d\n", VIDEO_WIDTH, VIDEO_HEIGHT);
+	for (int y = 0; y < VIDEO_HEIGHT; y++) {
+		for (int x = 0; x < VIDEO_WIDTH; x += 8) {
+			uint8_t byte = 0;
+			for (int b = 0; b < 8; b++) {
+				if (c.video[y * VIDEO_WIDTH + x + b])
+					byte |= 0x80u >> b;
+			}
+			fputc(byte, f);
+		}
+	}
+	return fclose(f) == 0;
+}
+
+int main(int argc, char** argv) {
+	const char* romPath = nullptr;
+	const char* moviePath = nullptr;
+	const char* pbmPath = nullptr;
+	const char* profilePath = nullptr;
+	const char* heatmapPath = nullptr;
+	const char* foldedPath = nullptr;
+	const char* labelsPath = nullptr;
+	const char* zonesPath = nullptr;
+	uint64_t cycles = 0;
+	uint64_t frames = 600;
+	unsigned int ips = 500;
+	uint32_t quirks = 0;
+	uint64_t seed = 0;
+	bool screen = false;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		bool takesValue = true;
+		if (!strcmp(arg, "--rom") && value)
+			romPath = value;
+		else if (!strcmp(arg, "--cycles") && value)
+			cycles = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--frames") && value)
+			frames = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--ips") && value)
+			ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--seed") && value)
+			seed = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--movie") && value)
+			moviePath = value;
+		else if (!strcmp(arg, "--pbm") && value)
+			pbmPath = value;
+		else if (!strcmp(arg, "--profile") && value)
+			profilePath = value;
+		else if (!strcmp(arg, "--heatmap") && value)
+			heatmapPath = value;
+		else if (!strcmp(arg, "--folded") && value)
+			foldedPath = value;
+		else if (!strcmp(arg, "--labels") && value)
+			labelsPath = value;
+		else if (!strcmp(arg, "--zones") && value)
+			zonesPath = value;
+		else if (!strcmp(arg, "--quirks") && value) {
+			if (!ParseQuirks(value, quirks)) {
+				std::cout << "Unknown quirk profile " << value << std::endl;
+				return 2;
+			}
+		} else if (!strcmp(arg, "--screen")) {
+			screen = true;
+			takesValue = false;
+		} else {
+			Usage();
+			return 2;
+		}
+		if (takesValue)
+			i++;
+	}
+	if (!romPath || ips == 0) {
+		Usage();
+		return 2;
+	}
+
+#ifndef XCHIP8_PROFILE
+	if (profilePath || heatmapPath || foldedPath || labelsPath) {
+		std::cout << "--profile, --heatmap, --folded and --labels need a build with XCHIP8_PROFILE" << std::endl;
+		return 2;
+	}
+#endif
+#ifndef XCHIP8_ZONES
+	if (zonesPath) {
+		std::cout << "--zones needs a build with XCHIP8_ZONES" << std::endl;
+		return 2;
+	}
+#endif
+
+	Chip8 chip8;
+	chip8.quirks = quirks;
+	if (!chip8.LoadRom(romPath))
+		return 1;
+	chip8.Seed(seed);
+
+	Movie movie;
+	MoviePlayer player;
+	if (moviePath) {
+		// Seed, quirks and timer ticks all come from the movie
+		if (!movie.Load(moviePath) || !player.Start(&chip8, &movie))
+			return 1;
+	}
+
+#ifdef XCHIP8_PROFILE
+	chip8.profile.sampleCycles = profilePath != nullptr;
+	if (labelsPath && !chip8.calls.LoadLabels(labelsPath))
+		return 1;
+#endif
+
+	auto start = std::chrono::steady_clock::now();
+	uint64_t frame = 0;
+	if (moviePath) {
+		player.Run(&chip8);
+	} else {
+		uint64_t target = cycles ? cycles : UINT64_MAX;
+		uint64_t lastFrame = cycles ? UINT64_MAX : frames;
+		while (chip8.cycles < target && frame < lastFrame) {
+			unsigned int n = FrameInstructions(frame, ips);
+			if (chip8.cycles + n > target) {
+				// Partial frame at the end of a --cycles run, no timer tick
+				while (chip8.cycles < target)
+					chip8.RunCycle();
+				break;
+			}
+			chip8.RunFrame(n);
+			frame++;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("rom=%s\n", romPath);
+	printf("cycles=%llu\n", static_cast<unsigned long long>(chip8.cycles));
+	if (!moviePath)
+		printf("frames=%llu\n", static_cast<unsigned long long>(frame));
+	printf("hash=%016llx\n", static_cast<unsigned long long>(chip8.StateHash()));
+	printf("seconds=%.6f\n", seconds);
+	printf("ips=%.0f\n", seconds > 0 ? chip8.cycles / seconds : 0.0);
+
+	if (screen) {
+		for (int y = 0; y < VIDEO_HEIGHT; y++) {
+			char line[VIDEO_WIDTH + 1];
+			for (int x = 0; x < VIDEO_WIDTH; x++) {
+				line[x] = chip8.video[y * VIDEO_WIDTH + x] ? '#' : '.';
+			}
+			line[VIDEO_WIDTH] = '\0';
+			printf("%s\n", line);
+		}
+	}
+	if (pbmPath && !WritePbm(pbmPath, chip8)) {
+		std::cout << "Failed to write " << pbmPath << std::endl;
+		return 1;
+	}
+#ifdef XCHIP8_PROFILE
+	if (profilePath && !chip8.profile.WriteCsv(profilePath))
+		return 1;
+	if (heatmapPath && !chip8.heatmap.Save(heatmapPath, chip8.romHash))
+		return 1;
+	if (foldedPath && !chip8.calls.WriteFolded(foldedPath, chip8.cycles))
+		return 1;
+#endif
+	if (zonesPath && !WriteZonesJson(zonesPath))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,184 @@
+// Lockstep benchmark: runs many seeded instances of one ROM through the SoA
+// lockstep engine and through the scalar core, reports instances x
+// instructions per second for both and checks they end in the same state.
+#include "chip8.h"
+#include "hash.h"
+#include "lockstep.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	const char* romPath = nullptr;
+	unsigned int instances = 1024;
+	unsigned int lanes = 16;
+	uint64_t frames = 600;
+	unsigned int ips = 500;
+	uint32_t quirks = 0;
+	// Feed every instance its own pseudo-random key presses, forcing divergence
+	bool randomKeys = false;
+};
+
+struct RunResult {
+	double seconds = 0;
+	uint64_t instructions = 0;
+	double groupsPerStep = 1;
+	std::vector<uint64_t> hashes;
+};
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_lockstep --rom <file> [options]\n"
+		"  --instances <n>  instances to run, seeded 0..n-1 (default 1024)\n"
+		"  --lanes <n>      lanes per lockstep engine: 8, 16 or 32 (default 16)\n"
+		"  --frames <n>     60Hz frames per instance (default 600)\n"
+		"  --ips <n>        guest instructions per second (default 500)\n"
+		"  --quirks <spec>  quirk profile shared by all instances\n"
+		"  --random-keys    give every instance its own key presses\n";
+}
+
+// Key mask for an instance in a frame: a press roughly every other frame
+static uint16_t KeysFor(const Options& o, unsigned int instance, uint64_t frame) {
+	if (!o.randomKeys)
+		return 0;
+	uint64_t r = Mix64((static_cast<uint64_t>(instance) << 32) ^ frame);
+	return (r & 0x10u) ? static_cast<uint16_t>(1u << (r & 0xFu)) : 0;
+}
+
+static void RunScalar(const Options& o, Chip8& c, RunResult& result) {
+	Clock::time_point start = Clock::now();
+	for (unsigned int i = 0; i < o.instances; i++) {
+		c.Boot();
+		c.Seed(i);
+		for (uint64_t f = 0; f < o.frames; f++) {
+			uint16_t keys = KeysFor(o, i, f);
+			for (unsigned int k = 0; k < KEY_COUNT; k++) {
+				c.keypad[k] = (keys >> k) & 1u;
+			}
+			c.RunFrame(FrameInstructions(f, o.ips));
+		}
+		result.instructions += c.cycles;
+		result.hashes.push_back(c.StateHash());
+	}
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <unsigned int LANES>
+static void RunLockstep(const Options& o, Chip8& c, RunResult& result) {
+	std::unique_ptr<Lockstep<LANES>> engine(new Lockstep<LANES>());
+	uint64_t steps = 0, groups = 0;
+
+	for (unsigned int base = 0; base < o.instances; base += LANES) {
+		unsigned int count = o.instances - base < LANES ? o.instances - base : LANES;
+		for (unsigned int l = 0; l < LANES; l++) {
+			if (l < count) {
+				c.Boot();
+				c.Seed(base + l);
+				engine->Load(l, c);
+			} else {
+				engine->SetActive(l, false);
+			}
+		}
+		engine->steps = engine->groups = engine->laneInstructions = 0;
+
+		// Only the stepping is timed, loading and storing lanes is setup
+		Clock::time_point start = Clock::now();
+		for (uint64_t f = 0; f < o.frames; f++) {
+			if (o.randomKeys) {
+				for (unsigned int l = 0; l < count; l++) {
+					engine->SetKeys(l, KeysFor(o, base + l, f));
+				}
+			}
+			engine->RunFrame(FrameInstructions(f, o.ips));
+		}
+		result.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+		result.instructions += engine->laneInstructions;
+		steps += engine->steps;
+		groups += engine->groups;
+
+		for (unsigned int l = 0; l < count; l++) {
+			engine->Store(l, c);
+			result.hashes.push_back(c.StateHash());
+		}
+	}
+	result.groupsPerStep = steps ? static_cast<double>(groups) / steps : 1;
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		bool takesValue = true;
+		if (!strcmp(arg, "--rom") && value)
+			o.romPath = value;
+		else if (!strcmp(arg, "--instances") && value)
+			o.instances = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--lanes") && value)
+			o.lanes = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--frames") && value)
+			o.frames = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--ips") && value)
+			o.ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--quirks") && value) {
+			if (!ParseQuirks(value, o.quirks)) {
+				std::cout << "Unknown quirk profile " << value << std::endl;
+				return 2;
+			}
+		} else if (!strcmp(arg, "--random-keys")) {
+			o.randomKeys = true;
+			takesValue = false;
+		} else {
+			Usage();
+			return 2;
+		}
+		if (takesValue)
+			i++;
+	}
+	if (!o.romPath || o.instances == 0 || (o.lanes != 8 && o.lanes != 16 && o.lanes != 32)) {
+		Usage();
+		return 2;
+	}
+
+	Chip8 c;
+	if (!c.LoadRom(o.romPath))
+		return 1;
+	c.quirks = o.quirks;
+
+	RunResult lockstep, scalar;
+	if (o.lanes == 8)
+		RunLockstep<8>(o, c, lockstep);
+	else if (o.lanes == 16)
+		RunLockstep<16>(o, c, lockstep);
+	else
+		RunLockstep<32>(o, c, lockstep);
+	RunScalar(o, c, scalar);
+
+	unsigned int mismatches = 0;
+	for (unsigned int i = 0; i < o.instances; i++) {
+		if (lockstep.hashes[i] != scalar.hashes[i]) {
+			if (!mismatches)
+				printf("first_mismatch=%u\n", i);
+			mismatches++;
+		}
+	}
+
+	printf("rom=%s\n", o.romPath);
+	printf("instances=%u\n", o.instances);
+	printf("lanes=%u\n", o.lanes);
+	printf("instructions=%llu\n", static_cast<unsigned long long>(lockstep.instructions));
+	printf("groups_per_step=%.3f\n", lockstep.groupsPerStep);
+	printf("lockstep_seconds=%.6f\n", lockstep.seconds);
+	printf("lockstep_ips=%.0f\n", lockstep.instructions / lockstep.seconds);
+	printf("scalar_seconds=%.6f\n", scalar.seconds);
+	printf("scalar_ips=%.0f\n", scalar.instructions / scalar.seconds);
+	printf("speedup=%.2f\n", (lockstep.instructions / lockstep.seconds) / (scalar.instructions / scalar.seconds));
+	printf("mismatches=%u\n", mismatches);
+	return mismatches ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+// Synthetic ROM generator: writes opcode-family ROMs with their expected end
+// states, and checks that the interpreter halts in exactly that state.
+#include "romgen.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_romgen [options]\n"
+		"  --out <dir>       write <family>.ch8 and <family>.expect there\n"
+		"  --family <name>   only this family: alu, call, memory, draw or jump\n"
+		"  --scale <n>       outer loop multiplier (default 1)\n"
+		"  --seed <n>        operand seed (default 0)\n";
+}
+
+int main(int argc, char** argv) {
+	const char* outDir = nullptr;
+	int only = -1;
+	unsigned int scale = 1;
+	uint64_t seed = 0;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--out"))
+			outDir = value;
+		else if (!strcmp(arg, "--scale"))
+			scale = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--seed"))
+			seed = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--family")) {
+			RomFamily family;
+			if (!ParseRomFamily(value, family)) {
+				std::cout << "Unknown ROM family " << value << std::endl;
+				return 2;
+			}
+			only = family;
+		} else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+
+	if (outDir) {
+		std::error_code error;
+		std::filesystem::create_directories(outDir, error);
+	}
+
+	unsigned int failures = 0;
+	std::unique_ptr<Chip8> c(new Chip8());
+	for (unsigned int f = 0; f < ROM_FAMILY_COUNT; f++) {
+		if (only >= 0 && static_cast<unsigned int>(only) != f)
+			continue;
+		GeneratedRom rom;
+		if (!GenerateRom(static_cast<RomFamily>(f), scale, seed, rom)) {
+			failures++;
+			continue;
+		}
+
+		// The interpreter has to land exactly where the reference did
+		c->LoadRom(rom.image);
+		RunToHalt(*c, rom.expected.instructions + 1);
+		bool ok = rom.expected.Check(*c);
+		failures += !ok;
+
+		if (outDir) {
+			std::string base = (std::filesystem::path(outDir) / rom.name).string();
+			std::ofstream os(base + ".ch8", std::ios::binary);
+			os.write(reinterpret_cast<const char*>(rom.image.data()), rom.image.size());
+			if (!os || !rom.expected.Save((base + ".expect").c_str())) {
+				std::cout << "Failed to write " << base << std::endl;
+				failures++;
+			}
+		}
+		printf("%s bytes=%zu instructions=%llu %s\n", rom.name.c_str(), rom.image.size(),
+			static_cast<unsigned long long>(rom.expected.instructions), ok ? "ok" : "MISMATCH");
+	}
+	return failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+// Input search driver: runs beam search or MCTS over keypad inputs to push a
+// RAM score up, then records the best sequence found as a movie and replays
+// it to check the score is reproduced.
+#include "search.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_search --rom <file> --score <spec> [options]\n"
+		"  --algo <name>      beam or mcts (default beam)\n"
+		"  --score <spec>     byte:ADDR or bcd:ADDR[:DIGITS], the value to maximise\n"
+		"  --done <spec>      halted or ram:ADDR=VALUE, states not expanded further\n"
+		"  --keys <list>      comma separated hex keys to choose between, none for no key\n"
+		"                     (default none,0,...,F)\n"
+		"  --depth <n>        beam: actions per sequence (default 200)\n"
+		"  --width <n>        beam: candidates kept per depth (default 64)\n"
+		"  --iterations <n>   mcts: tree iterations (default 2000)\n"
+		"  --rollout <n>      mcts: actions per rollout (default 50)\n"
+		"  --rollouts <n>     mcts: rollouts per iteration (default 8)\n"
+		"  --frameskip <n>    frames each action is held for (default 4)\n"
+		"  --ips <n>          guest instructions per second (default 500)\n"
+		"  --quirks <spec>    quirk profile\n"
+		"  --seed <n>         RNG seed (default 0)\n"
+		"  --threads <n>      worker threads (default all cores)\n"
+		"  --movie <file>     write the best input sequence as a movie\n";
+}
+
+static bool ParseKeys(const char* text, std::vector<uint16_t>& actions) {
+	actions.clear();
+	std::string list = text;
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		std::string key = list.substr(start, end - start);
+		if (key == "none") {
+			actions.push_back(0);
+		} else {
+			char* rest = nullptr;
+			unsigned long k = strtoul(key.c_str(), &rest, 16);
+			if (key.empty() || *rest || k >= KEY_COUNT)
+				return false;
+			actions.push_back(static_cast<uint16_t>(1u << k));
+		}
+		start = end + 1;
+	}
+	return !actions.empty();
+}
+
+int main(int argc, char** argv) {
+	const char* romPath = nullptr;
+	const char* moviePath = nullptr;
+	bool mcts = false;
+	SearchConfig config;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--rom"))
+			romPath = value;
+		else if (!strcmp(arg, "--movie"))
+			moviePath = value;
+		else if (!strcmp(arg, "--algo")) {
+			if (!strcmp(value, "mcts"))
+				mcts = true;
+			else if (strcmp(value, "beam")) {
+				Usage();
+				return 2;
+			}
+		} else if (!strcmp(arg, "--depth"))
+			config.depth = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--width"))
+			config.width = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--iterations"))
+			config.iterations = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--rollout"))
+			config.rolloutDepth = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--rollouts"))
+			config.rollouts = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--frameskip"))
+			config.frameSkip = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--ips"))
+			config.ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--seed"))
+			config.seed = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--threads"))
+			config.threads = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--keys")) {
+			if (!ParseKeys(value, config.actions)) {
+				std::cout << "Bad key list " << value << std::endl;
+				return 2;
+			}
+		} else if (!strcmp(arg, "--quirks")) {
+			if (!ParseQuirks(value, config.quirks)) {
+				std::cout << "Unknown quirk profile " << value << std::endl;
+				return 2;
+			}
+		} else if (!strcmp(arg, "--score")) {
+			if (!ParseScore(value, config.score)) {
+				std::cout << "Bad score spec " << value << std::endl;
+				return 2;
+			}
+		} else if (!strcmp(arg, "--done")) {
+			if (!ParseDone(value, config.done)) {
+				std::cout << "Bad done spec " << value << std::endl;
+				return 2;
+			}
+		} else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+	if (!romPath || !config.score) {
+		Usage();
+		return 2;
+	}
+	if (config.actions.empty()) {
+		config.actions.push_back(0);
+		for (unsigned int k = 0; k < KEY_COUNT; k++) {
+			config.actions.push_back(static_cast<uint16_t>(1u << k));
+		}
+	}
+
+	Search search(config);
+	if (!search.LoadRom(romPath))
+		return 1;
+	SearchResult result = mcts ? search.Mcts() : search.Beam();
+
+	Movie movie;
+	int64_t recorded = search.Record(result.inputs, movie);
+
+	// Replay the movie on a fresh core: the score has to come back exactly
+	Chip8 c;
+	if (!c.LoadRom(romPath))
+		return 1;
+	MoviePlayer player;
+	if (!player.Start(&c, &movie))
+		return 1;
+	player.Run(&c);
+	int64_t replayed = config.score(c);
+
+	printf("rom=%s\n", romPath);
+	printf("algo=%s\n", mcts ? "mcts" : "beam");
+	printf("score=%lld\n", static_cast<long long>(result.score));
+	printf("inputs=%zu\n", result.inputs.size());
+	printf("steps=%llu\n", static_cast<unsigned long long>(result.steps));
+	printf("steps_per_sec=%.0f\n", result.seconds > 0 ? result.steps / result.seconds : 0.0);
+	printf("nodes=%llu\n", static_cast<unsigned long long>(result.nodes));
+	printf("transpositions=%llu\n", static_cast<unsigned long long>(result.transpositions));
+	printf("seconds=%.3f\n", result.seconds);
+	printf("recorded_score=%lld\n", static_cast<long long>(recorded));
+	printf("movie_score=%lld\n", static_cast<long long>(replayed));
+
+	if (moviePath && !movie.Save(moviePath))
+		return 1;
+	return (recorded == result.score && replayed == result.score) ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,239 @@
+// Instruction tracer: records a headless run of a ROM into a trace file and
+// reports what tracing cost, or turns a trace file into Chrome trace JSON
+// (chrome://tracing, Perfetto UI) with instructions, subroutine spans and
+// frame, timer-tick and draw markers on separate tracks.
+#include "chip8.h"
+#include "json.h"
+#include "movie.h"
+#include "profile.h"
+#include "trace.h"
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+typedef std::chrono::steady_clock Clock;
+
+static void Usage() {
+	std::cout <<
+		"usage: xchip8_trace --rom <file> --out <trace> [options]\n"
+		"       xchip8_trace --in <trace> --chrome <json> [options]\n"
+		"  recording:\n"
+		"  --frames <n>      60Hz frames to run (default 3600)\n"
+		"  --seed <n>        RNG seed (default 0)\n"
+		"  --quirks <spec>   quirk profile\n"
+		"  --movie <file>    replay a movie instead of running frames\n"
+		"  converting:\n"
+		"  --from <n>        first record to export (default 0)\n"
+		"  --count <n>       records to export (default 200000)\n"
+		"  both:\n"
+		"  --ips <n>         guest instructions per second, also the time base of\n"
+		"                    the JSON (default 500)\n";
+}
+
+struct Options {
+	const char* romPath = nullptr;
+	const char* outPath = nullptr;
+	const char* inPath = nullptr;
+	const char* chromePath = nullptr;
+	const char* moviePath = nullptr;
+	uint64_t frames = 3600;
+	uint64_t seed = 0;
+	uint32_t quirks = 0;
+	unsigned int ips = 500;
+	uint64_t from = 0;
+	uint64_t count = 200000;
+};
+
+// Runs the ROM once, tracing into o.outPath through trace if given, returns
+// the seconds taken or -1
+static double Run(const Options& o, Chip8& c, TraceBuffer* trace) {
+	c.quirks = o.quirks;
+	if (!c.LoadRom(o.romPath))
+		return -1;
+	c.Seed(o.seed);
+	Movie movie;
+	MoviePlayer player;
+	if (o.moviePath && (!movie.Load(o.moviePath) || !player.Start(&c, &movie)))
+		return -1;
+	if (trace && !trace->Open(o.outPath, c.romHash))
+		return -1;
+
+	c.trace = trace;
+	Clock::time_point start = Clock::now();
+	if (o.moviePath) {
+		player.Run(&c);
+	} else {
+		for (uint64_t f = 0; f < o.frames; f++) {
+			c.RunFrame(FrameInstructions(f, o.ips));
+		}
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	c.trace = nullptr;
+	return seconds;
+}
+
+static int Record(const Options& o) {
+	std::unique_ptr<Chip8> c(new Chip8());
+	// Untraced first, for the overhead
+	double plain = Run(o, *c, nullptr);
+	if (plain < 0)
+		return 1;
+
+	TraceBuffer trace;
+	c.reset(new Chip8());
+	double traced = Run(o, *c, &trace);
+	if (traced < 0)
+		return 1;
+	// Flushing the tail of the ring is part of the cost
+	Clock::time_point start = Clock::now();
+	uint64_t records = trace.Count();
+	bool ok = trace.Close();
+	double closing = std::chrono::duration<double>(Clock::now() - start).count();
+	if (!ok)
+		return 1;
+
+	printf("records=%llu bytes=%llu bytes_per_record=%.2f\n", static_cast<unsigned long long>(records),
+		static_cast<unsigned long long>(trace.FileBytes()), records ? static_cast<double>(trace.FileBytes()) / records : 0.0);
+	printf("plain_seconds=%.4f traced_seconds=%.4f overhead=%.2fx\n", plain, traced + closing,
+		plain > 0 ? (traced + closing) / plain : 0.0);
+	return 0;
+}
+
+#pragma region Chrome JSON
+static void Event(FILE* f, bool& firstEvent, const char* fmt, ...) {
+	fputs(firstEvent ? "\n" : ",\n", f);
+	firstEvent = false;
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(f, fmt, args);
+	va_end(args);
+}
+
+// Tracks: 1 instructions, 2 subroutines, 3 markers. Timestamps are guest
+// microseconds at the given rate.
+static int Convert(const Options& o) {
+	TraceReader reader;
+	if (!reader.Open(o.inPath))
+		return 1;
+	FILE* f = fopen(o.chromePath, "w");
+	if (!f) {
+		std::cout << "Failed to open " << o.chromePath << std::endl;
+		return 1;
+	}
+
+	const double usPerInstruction = 1e6 / o.ips;
+	bool firstEvent = true;
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+	Event(f, firstEvent, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}", JsonEscape(o.inPath).c_str());
+	const char* tracks[3] = { "instructions", "subroutines", "markers" };
+	for (int t = 0; t < 3; t++) {
+		Event(f, firstEvent, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", t + 1, tracks[t]);
+	}
+
+	TraceRecord r;
+	uint64_t index = 0, exported = 0;
+	unsigned int depth = 0;
+	while (exported < o.count && reader.Next(r)) {
+		if (index++ < o.from)
+			continue;
+		exported++;
+		// The record's cycle is after the instruction
+		double ts = (r.cycle - 1) * usPerInstruction;
+
+		if (r.events & TRACE_FRAME)
+			Event(f, firstEvent, "{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":1,\"tid\":3}", ts);
+		if (r.events & TRACE_TICK)
+			Event(f, firstEvent, "{\"name\":\"tick\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":3}", ts);
+
+		OpHandler handler = DecodeHandler(r.opcode);
+		char reg[32] = "";
+		if (r.reg != TRACE_REG_NONE)
+			snprintf(reg, sizeof(reg), ",\"V%X\":\"0x%02X%s\"", r.reg & 0x0Fu, r.value, (r.reg & TRACE_REG_MORE) ? "+" : "");
+		Event(f, firstEvent, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1,"
+			"\"args\":{\"pc\":\"0x%03X\",\"op\":\"0x%04X\"%s}}", OpHandlerName(handler), ts, usPerInstruction, r.pc, r.opcode, reg);
+
+		switch (handler) {
+		case OPH_2nnn:
+			depth++;
+			Event(f, firstEvent, "{\"name\":\"sub_%03X\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":2}", r.opcode & 0x0FFFu, ts + usPerInstruction);
+			break;
+		case OPH_00EE:
+			// Returns out of calls made before the window have nothing to close
+			if (depth) {
+				depth--;
+				Event(f, firstEvent, "{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":2}", ts + usPerInstruction);
+			}
+			break;
+		case OPH_00E0:
+		case OPH_Dxyn:
+			Event(f, firstEvent, "{\"name\":\"draw\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":3}", ts);
+			break;
+		default:
+			break;
+		}
+	}
+	fputs("\n]}\n", f);
+	bool ok = fclose(f) == 0;
+	if (!ok)
+		std::cout << "Failed to write " << o.chromePath << std::endl;
+	printf("records=%llu exported=%llu\n", static_cast<unsigned long long>(reader.records), static_cast<unsigned long long>(exported));
+	return ok ? 0 : 1;
+}
+#pragma endregion
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value) {
+			Usage();
+			return 2;
+		}
+		if (!strcmp(arg, "--rom"))
+			o.romPath = value;
+		else if (!strcmp(arg, "--out"))
+			o.outPath = value;
+		else if (!strcmp(arg, "--in"))
+			o.inPath = value;
+		else if (!strcmp(arg, "--chrome"))
+			o.chromePath = value;
+		else if (!strcmp(arg, "--movie"))
+			o.moviePath = value;
+		else if (!strcmp(arg, "--frames"))
+			o.frames = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--seed"))
+			o.seed = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--ips"))
+			o.ips = static_cast<unsigned int>(strtoul(value, nullptr, 0));
+		else if (!strcmp(arg, "--from"))
+			o.from = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--count"))
+			o.count = strtoull(value, nullptr, 0);
+		else if (!strcmp(arg, "--quirks")) {
+			if (!ParseQuirks(value, o.quirks)) {
+				std::cout << "Unknown quirk profile " << value << std::endl;
+				return 2;
+			}
+		} else {
+			Usage();
+			return 2;
+		}
+		i++;
+	}
+	if (o.ips == 0) {
+		Usage();
+		return 2;
+	}
+
+	if (o.romPath && o.outPath)
+		return Record(o);
+	if (o.inPath && o.chromePath)
+		return Convert(o);
+	Usage();
+	return 2;
+}
\ No newline at end of file
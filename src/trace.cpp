@@ -0,0 +1,197 @@
+#include "trace.h"
+#include "ring.h"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+static const char TRACE_MAGIC[4] = { 'X', 'C', '8', 'T' };
+
+// Encoding, per record: a flags byte, then
+//   pc, 2 bytes LE        unless TRACE_SEQUENTIAL
+//   opcode, 2 bytes LE
+//   reg and value         if TRACE_HAS_REG
+//   cycle delta           if TRACE_HAS_CYCLE, a zigzag LEB128 varint of
+//                         cycle - (previous cycle + 1)
+// Flags bits 0-1 hold the TraceEvent bits.
+const uint8_t TRACE_SEQUENTIAL = 1u << 2; // pc is the previous pc + 2
+const uint8_t TRACE_HAS_REG = 1u << 3;
+const uint8_t TRACE_HAS_CYCLE = 1u << 4;
+
+TraceBuffer::TraceBuffer(size_t capacity) {
+	size_t size = 2;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	ring.resize(size);
+	mask = size - 1;
+}
+
+TraceBuffer::~TraceBuffer() {
+	Close();
+}
+
+bool TraceBuffer::Open(const char* path, uint64_t hash) {
+	Close();
+	file = fopen(path, "wb");
+	if (!file) {
+		std::cout << "Failed to open trace " << path << std::endl;
+		return false;
+	}
+	romHash = hash;
+	first = flushed = head.load(std::memory_order_relaxed);
+	bytes = 0;
+	prevPc = 0;
+	prevCycle = 0;
+
+	// Placeholder, the counts are only known on Close
+	TraceHeader header = {};
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		std::cout << "Failed to write trace " << path << std::endl;
+		fclose(file);
+		file = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool TraceBuffer::Close() {
+	if (!file)
+		return true;
+	Drain();
+
+	TraceHeader header = {};
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.romHash = romHash;
+	header.records = flushed - first;
+	header.bytes = bytes;
+	bool ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = fclose(file) == 0 && ok;
+	file = nullptr;
+	if (!ok)
+		std::cout << "Failed to finish trace file" << std::endl;
+	return ok;
+}
+
+void TraceBuffer::Drain() {
+	uint64_t end = head.load(std::memory_order_relaxed);
+	// Anything older than a full ring is gone, only possible if a caller
+	// wrote past Record's own draining
+	if (end - flushed > ring.size())
+		flushed = end - ring.size();
+
+	// Worst case: flags, pc, opcode, reg and value, ten bytes of LEB128
+	chunk.resize((end - flushed) * 17);
+	uint8_t* out = chunk.data();
+	for (; flushed < end; flushed++) {
+		const TraceRecord& r = ring[flushed & mask];
+		uint8_t flags = r.events & (TRACE_TICK | TRACE_FRAME);
+		bool sequential = r.pc == static_cast<uint16_t>(prevPc + 2);
+		if (sequential)
+			flags |= TRACE_SEQUENTIAL;
+		if (r.reg != TRACE_REG_NONE)
+			flags |= TRACE_HAS_REG;
+		if (r.cycle != prevCycle + 1)
+			flags |= TRACE_HAS_CYCLE;
+
+		*out++ = flags;
+		if (!sequential) {
+			*out++ = static_cast<uint8_t>(r.pc);
+			*out++ = static_cast<uint8_t>(r.pc >> 8);
+		}
+		*out++ = static_cast<uint8_t>(r.opcode);
+		*out++ = static_cast<uint8_t>(r.opcode >> 8);
+		if (flags & TRACE_HAS_REG) {
+			*out++ = r.reg;
+			*out++ = r.value;
+		}
+		if (flags & TRACE_HAS_CYCLE) {
+			int64_t delta = static_cast<int64_t>(r.cycle - (prevCycle + 1));
+			uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+			// LEB128
+			do {
+				uint8_t byte = zigzag & 0x7Fu;
+				zigzag >>= 7;
+				*out++ = byte | (zigzag ? 0x80u : 0u);
+			} while (zigzag);
+		}
+		prevPc = r.pc;
+		prevCycle = r.cycle;
+	}
+	size_t size = out - chunk.data();
+	if (size && fwrite(chunk.data(), 1, size, file) == size)
+		bytes += size;
+}
+
+size_t TraceBuffer::Recent(std::vector<TraceRecord>& out, size_t count) const {
+	out.clear();
+	return RingRecent(ring, mask, head, count, out);
+}
+
+bool TraceReader::Open(const char* path) {
+	std::ifstream is(path, std::ios::in | std::ios::binary);
+	data.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+
+	TraceHeader header;
+	if (data.size() < sizeof(header)) {
+		std::cout << "Failed to read trace " << path << std::endl;
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION
+		|| header.bytes > data.size() - sizeof(header)) {
+		std::cout << path << " is not a supported trace" << std::endl;
+		return false;
+	}
+	data.resize(sizeof(header) + header.bytes);
+	romHash = header.romHash;
+	records = header.records;
+	offset = sizeof(header);
+	prevPc = 0;
+	prevCycle = 0;
+	return true;
+}
+
+bool TraceReader::Next(TraceRecord& r) {
+	if (offset >= data.size())
+		return false;
+	uint8_t flags = data[offset++];
+	size_t need = ((flags & TRACE_SEQUENTIAL) ? 0 : 2) + 2 + ((flags & TRACE_HAS_REG) ? 2 : 0);
+	if (data.size() - offset < need)
+		return false;
+
+	r.events = flags & (TRACE_TICK | TRACE_FRAME);
+	if (flags & TRACE_SEQUENTIAL) {
+		r.pc = static_cast<uint16_t>(prevPc + 2);
+	} else {
+		r.pc = static_cast<uint16_t>(data[offset] | data[offset + 1] << 8);
+		offset += 2;
+	}
+	r.opcode = static_cast<uint16_t>(data[offset] | data[offset + 1] << 8);
+	offset += 2;
+	r.reg = TRACE_REG_NONE;
+	r.value = 0;
+	if (flags & TRACE_HAS_REG) {
+		r.reg = data[offset];
+		r.value = data[offset + 1];
+		offset += 2;
+	}
+	r.cycle = prevCycle + 1;
+	if (flags & TRACE_HAS_CYCLE) {
+		uint64_t zigzag = 0;
+		unsigned int shift = 0;
+		uint8_t byte;
+		do {
+			if (offset >= data.size() || shift > 63)
+				return false;
+			byte = data[offset++];
+			zigzag |= static_cast<uint64_t>(byte & 0x7Fu) << shift;
+			shift += 7;
+		} while (byte & 0x80u);
+		int64_t delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+		r.cycle += static_cast<uint64_t>(delta);
+	}
+	prevPc = r.pc;
+	prevCycle = r.cycle;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Instruction trace: one compact record per instruction, written by
+// Chip8::RunCycle into a per-core ring buffer while Chip8::trace is set.
+// The ring has a single producer, the emulation thread, and can be read
+// from another thread without locks. With a file open, every half ring is
+// also delta-encoded into it, a few bytes per instruction, so long sessions
+// stay small.
+const uint16_t TRACE_VERSION = 1;
+
+// Markers, attached to the next instruction
+enum TraceEvent : uint8_t {
+	TRACE_TICK = 1u << 0,  // 60Hz timer tick
+	TRACE_FRAME = 1u << 1, // Frame boundary, the end of Chip8::RunFrame
+};
+
+// TraceRecord::reg
+const uint8_t TRACE_REG_NONE = 0xFF;
+// Set when more than one register changed, the low bits hold the lowest
+const uint8_t TRACE_REG_MORE = 0x10;
+
+struct TraceRecord {
+	uint64_t cycle;  // Chip8::cycles after the instruction
+	uint16_t pc;     // Address it was fetched from
+	uint16_t opcode;
+	uint8_t reg;     // V register it changed, see TRACE_REG_NONE/TRACE_REG_MORE
+	uint8_t value;   // Its new value
+	uint8_t events;  // TraceEvent bits since the previous instruction
+};
+
+// On-disk trace header, followed by the encoded records
+struct TraceHeader {
+	char magic[4];    // "XC8T"
+	uint16_t version; // TRACE_VERSION
+	uint16_t flags;
+	uint64_t romHash; // Hash64 of the ROM image
+	uint64_t records; // Filled in by Close
+	uint64_t bytes;   // Encoded bytes after the header, filled in by Close
+};
+static_assert(sizeof(TraceHeader) == 32, "TraceHeader must stay fixed-layout");
+
+class TraceBuffer {
+public:
+	// capacity is rounded up to a power of two
+	TraceBuffer(size_t capacity = 1u << 16);
+	~TraceBuffer();
+
+	TraceBuffer(const TraceBuffer&) = delete;
+	TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+	// Also write every record from now on to path
+	bool Open(const char* path, uint64_t romHash);
+	// Flushes the rest of the ring and finishes the header
+	bool Close();
+	bool IsOpen() const { return file != nullptr; }
+
+	void Mark(uint8_t event) { pending |= event; }
+
+	// before holds the V registers ahead of the instruction as two words,
+	// after points at them once it ran
+	void Record(uint16_t pc, uint16_t opcode, uint64_t cycle, const uint64_t before[2], const uint8_t* after) {
+		uint64_t a[2];
+		memcpy(a, after, sizeof(a));
+		uint64_t lo = a[0] ^ before[0], hi = a[1] ^ before[1];
+
+		uint64_t h = head.load(std::memory_order_relaxed);
+		TraceRecord& r = ring[h & mask];
+		r.cycle = cycle;
+		r.pc = pc;
+		r.opcode = opcode;
+		r.events = pending;
+		pending = 0;
+		if (lo | hi) {
+			// Lowest changed byte, then whether any other byte changed
+			uint64_t word = lo ? lo : hi;
+			unsigned int shift = std::countr_zero(word) & ~7u;
+			unsigned int index = (lo ? 0u : 8u) + shift / 8;
+			bool more = (lo && hi) || (word & ~(0xFFull << shift));
+			r.reg = static_cast<uint8_t>(index | (more ? TRACE_REG_MORE : 0));
+			r.value = after[index];
+		} else {
+			r.reg = TRACE_REG_NONE;
+			r.value = 0;
+		}
+		head.store(h + 1, std::memory_order_release);
+
+		if (file && h + 1 - flushed >= ring.size() / 2)
+			Drain();
+	}
+
+	// Copies up to count of the newest records into out, oldest first. Safe
+	// to call from another thread while recording, records the producer
+	// overwrote during the copy are left out.
+	size_t Recent(std::vector<TraceRecord>& out, size_t count) const;
+	// Records since construction
+	uint64_t Count() const { return head.load(std::memory_order_acquire); }
+	uint64_t FileBytes() const { return bytes; }
+
+private:
+	// Encodes the records the file has not seen yet
+	void Drain();
+
+	std::vector<TraceRecord> ring;
+	uint64_t mask;
+	std::atomic<uint64_t> head{ 0 };
+	uint8_t pending = 0;
+
+	FILE* file = nullptr;
+	uint64_t romHash = 0;
+	uint64_t first = 0;   // First record that went to the file
+	uint64_t flushed = 0; // Records encoded so far
+	uint64_t bytes = 0;
+	uint16_t prevPc = 0;
+	uint64_t prevCycle = 0;
+	std::vector<uint8_t> chunk;
+};
+
+// Reads a trace file back, record by record
+class TraceReader {
+public:
+	bool Open(const char* path);
+	bool Next(TraceRecord& record);
+
+	uint64_t romHash = 0;
+	uint64_t records = 0;
+
+private:
+	std::vector<uint8_t> data;
+	size_t offset = 0;
+	uint16_t prevPc = 0;
+	uint64_t prevCycle = 0;
+};
\ No newline at end of file
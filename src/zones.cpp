@@ -0,0 +1,96 @@
+#include "zones.h"
+#include "json.h"
+#include "ring.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+uint64_t ZoneNow() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+ZoneBuffer::ZoneBuffer(const char* threadName, size_t capacity) : name(threadName) {
+	size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	ring.resize(size);
+	mask = size - 1;
+}
+
+size_t ZoneBuffer::Recent(std::vector<ZoneEvent>& out, uint64_t since) const {
+	size_t first = out.size();
+	RingRecent(ring, mask, head, ring.size(), out);
+	// Filter after the copy, so the stale ones dropped are the oldest ones
+	out.erase(std::remove_if(out.begin() + first, out.end(),
+		[since](const ZoneEvent& e) { return e.end < since; }), out.end());
+	return out.size() - first;
+}
+
+#pragma region Thread registry
+// Rings outlive their threads, the GUI's worker threads are detached
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<ZoneBuffer>> registry;
+
+ZoneBuffer& ThisThreadZones() {
+	thread_local ZoneBuffer* buffer = nullptr;
+	if (!buffer) {
+		std::lock_guard<std::mutex> lock(registryMutex);
+		registry.emplace_back(new ZoneBuffer(("thread " + std::to_string(registry.size())).c_str()));
+		buffer = registry.back().get();
+	}
+	return *buffer;
+}
+
+void NameThreadZones(const char* name) {
+	ZoneBuffer& buffer = ThisThreadZones();
+	std::lock_guard<std::mutex> lock(registryMutex);
+	buffer.name = name;
+}
+
+std::vector<ZoneThread> ZoneThreads() {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	std::vector<ZoneThread> threads;
+	for (const std::unique_ptr<ZoneBuffer>& buffer : registry) {
+		threads.push_back({ buffer.get(), buffer->name });
+	}
+	return threads;
+}
+#pragma endregion
+
+bool WriteZonesJson(const char* path) {
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+	std::vector<ZoneThread> threads = ZoneThreads();
+	std::vector<std::vector<ZoneEvent>> events(threads.size());
+	uint64_t origin = UINT64_MAX;
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].buffer->Recent(events[t], 0);
+		for (const ZoneEvent& e : events[t]) {
+			origin = std::min(origin, e.start);
+		}
+	}
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+	fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"XCHIP8\"}}", f);
+	for (size_t t = 0; t < threads.size(); t++) {
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}", t + 1, JsonEscape(threads[t].name).c_str());
+		for (const ZoneEvent& e : events[t]) {
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu}",
+				e.name, (e.start - origin) / 1e3, (e.end - e.start) / 1e3, t + 1);
+		}
+	}
+	fputs("\n]}\n", f);
+	if (fclose(f) != 0) {
+		std::cout << "Failed to write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Host timing zones: XCHIP8_ZONE("name") times the rest of the enclosing
+// scope into a ring owned by the calling thread. Only that thread writes
+// its ring, the timeline window and WriteZonesJson read every ring without
+// locks. Builds without XCHIP8_ZONES compile the macros away entirely.
+
+struct ZoneEvent {
+	const char* name; // String literal from XCHIP8_ZONE
+	uint64_t start;   // ZoneNow() at entry
+	uint64_t end;
+	uint32_t depth;   // Zones open around it on the same thread
+};
+
+// Nanoseconds on the steady clock, shared by every thread
+uint64_t ZoneNow();
+
+class ZoneBuffer {
+public:
+	// capacity is rounded up to a power of two
+	ZoneBuffer(const char* threadName, size_t capacity = 1u << 14);
+
+	void Push(const char* name, uint64_t start, uint64_t end, uint32_t depth) {
+		uint64_t h = head.load(std::memory_order_relaxed);
+		ZoneEvent& e = ring[h & mask];
+		e.name = name;
+		e.start = start;
+		e.end = end;
+		e.depth = depth;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	// Copies the events that ended at or after since into out, oldest
+	// first. Safe from any thread, events overwritten during the copy are
+	// left out.
+	size_t Recent(std::vector<ZoneEvent>& out, uint64_t since) const;
+
+	// Guarded by the thread registry, read it through ZoneThreads
+	std::string name;
+	// Open zones, only touched by the owning thread
+	uint32_t depth = 0;
+
+private:
+	std::vector<ZoneEvent> ring;
+	uint64_t mask;
+	std::atomic<uint64_t> head{ 0 };
+};
+
+// The calling thread's ring, created on first use
+ZoneBuffer& ThisThreadZones();
+// Names the calling thread's track in the timeline
+void NameThreadZones(const char* name);
+
+struct ZoneThread {
+	const ZoneBuffer* buffer;
+	std::string name;
+};
+
+// Every thread that has recorded a zone, in order of first use
+std::vector<ZoneThread> ZoneThreads();
+// Chrome trace JSON of everything still in the rings, one track per thread
+bool WriteZonesJson(const char* path);
+
+class ZoneScope {
+public:
+	explicit ZoneScope(const char* name) : name(name), buffer(ThisThreadZones()), depth(buffer.depth++), start(ZoneNow()) {}
+	~ZoneScope() {
+		uint64_t end = ZoneNow();
+		buffer.depth--;
+		buffer.Push(name, start, end, depth);
+	}
+
+	ZoneScope(const ZoneScope&) = delete;
+	ZoneScope& operator=(const ZoneScope&) = delete;
+
+private:
+	const char* name;
+	ZoneBuffer& buffer;
+	uint32_t depth;
+	uint64_t start;
+};
+
+#ifdef XCHIP8_ZONES
+#define XCHIP8_ZONE_JOIN2(a, b) a##b
+#define XCHIP8_ZONE_JOIN(a, b) XCHIP8_ZONE_JOIN2(a, b)
+#define XCHIP8_ZONE(name) ZoneScope XCHIP8_ZONE_JOIN(zone_, __LINE__)(name)
+#define XCHIP8_ZONE_THREAD(name) NameThreadZones(name)
+#else
+#define XCHIP8_ZONE(name) do {} while (0)
+#define XCHIP8_ZONE_THREAD(name) do {} while (0)
+#endif
\ No newline at end of file